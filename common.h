@@ -1,8 +1,7 @@
 #ifndef __CS267_COMMON_H__
 #define __CS267_COMMON_H__
 
-inline int min( int a, int b ) { return a < b ? a : b; }
-inline int max( int a, int b ) { return a > b ? a : b; }
+#include "engine/heat.h"
 
 //
 //  saving parameters
@@ -11,41 +10,23 @@ const int NSTEPS = 1000;
 const int SAVEFREQ = 10;
 
 //
-// mesh node data structure
+// mesh data structure
+// a bar with both ends held at a fixed temperature and no heat source;
+// node i lives at T[i+1]. See engine/mesh.h for the layout.
 //
-typedef struct 
-{
-  double T;
-  double T_sum;
-  double x;
-  int fixed;
-} node_t;
-
-//
-//  timing routines
-//
-double read_timer( );
+typedef mesh_t<1, double, dirichlet, no_source> grid_t;
 
 //
 //  simulation routines
 //
 void set_len( int n );
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem );
-void apply_tsum( node_t &tnode, node_t &neighbor );
-void tupdate( node_t &tnode, int dim );
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem );
 
 
 //
 //  I/O routines
 //
 FILE *open_save( char *filename, int n );
-void save( FILE *f, int step, int n, node_t *tnodes );
-
-//
-//  argument processing routines
-//
-int find_option( int argc, char **argv, const char *option );
-int read_int( int argc, char **argv, const char *option, int default_value );
-char *read_string( int argc, char **argv, const char *option, char *default_value );
+void save( FILE *f, int step, int n, double *T );
 
 #endif
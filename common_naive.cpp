@@ -6,7 +6,7 @@
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
-#include "common.h"
+#include "common_naive.h"
 
 int mesh_pts;
 
@@ -68,6 +68,17 @@ void init_bar( node_t *tnodes, double ltem, double rtem )
     }
 }
 
+//
+//  interaction range
+//
+#define range  (dx + 0.001)
+
+static bool near( const node_t &tnode, const node_t &neighbor )
+{
+    double dist = fabs(tnode.x - neighbor.x);
+    return dist <= range && dist != 0;
+}
+
 //
 //  interact two temperature nodes
 //
@@ -76,12 +87,82 @@ void apply_tsum( node_t &tnode, node_t &neighbor)
     if (tnode.fixed) {
         return;
     }
-    double dist = fabs(tnode.x - neighbor.x);
-    if ( dist <= dx + 0.001 && dist != 0 ) {
+    if ( near( tnode, neighbor ) ) {
         tnode.T_sum += neighbor.T;
     }
 }
 
+//
+//  Find the nodes each node interacts with, once: the nodes are hashed
+//  by the cell of width range they lie in, so only the cell of a node
+//  and the two next to it need testing, wherever the nodes are. Each
+//  list is sorted, so the sums add up in the order of the nodes as an
+//  all-pairs loop would; fixed nodes get empty lists.
+//
+void find_neighbors( node_t *tnodes, int n, neighbors_t &nb )
+{
+    double xmin = tnodes[0].x;
+    for (int i = 1; i < n; i++)
+        xmin = fmin( xmin, tnodes[i].x );
+
+    // counting sort of the nodes by bucket; at least 3 buckets keep
+    // the 3 cells of a node apart
+    int nbuckets = max( n, 3 );
+    long long *cell = (long long *) malloc( n * sizeof(long long) );
+    int *bucket_start = (int *) calloc( nbuckets + 1, sizeof(int) );
+    int *bucket = (int *) malloc( n * sizeof(int) );
+    for (int i = 0; i < n; i++) {
+        cell[i] = (long long) floor( (tnodes[i].x - xmin) / range );
+        bucket_start[cell[i] % nbuckets + 1]++;
+    }
+    for (int b = 0; b < nbuckets; b++)
+        bucket_start[b + 1] += bucket_start[b];
+    int *fill = (int *) malloc( nbuckets * sizeof(int) );
+    memcpy( fill, bucket_start, nbuckets * sizeof(int) );
+    for (int i = 0; i < n; i++)
+        bucket[fill[cell[i] % nbuckets]++] = i;
+
+    int capacity = 2 * n;
+    nb.start = (int *) malloc( (n + 1) * sizeof(int) );
+    nb.neighbor = (int *) malloc( capacity * sizeof(int) );
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        nb.start[i] = count;
+        if (tnodes[i].fixed)
+            continue;
+        for (long long c = cell[i] - 1; c <= cell[i] + 1; c++) {
+            if (c < 0)
+                continue;
+            int b = c % nbuckets;
+            for (int k = bucket_start[b]; k < bucket_start[b + 1]; k++) {
+                int j = bucket[k];
+                if (!near( tnodes[i], tnodes[j] ))
+                    continue;
+                if (count == capacity) {
+                    capacity *= 2;
+                    nb.neighbor = (int *) realloc( nb.neighbor, capacity * sizeof(int) );
+                }
+                int at = count++;
+                for (; at > nb.start[i] && nb.neighbor[at - 1] > j; at--)
+                    nb.neighbor[at] = nb.neighbor[at - 1];
+                nb.neighbor[at] = j;
+            }
+        }
+    }
+    nb.start[n] = count;
+
+    free( cell );
+    free( bucket_start );
+    free( bucket );
+    free( fill );
+}
+
+void free_neighbors( neighbors_t &nb )
+{
+    free( nb.start );
+    free( nb.neighbor );
+}
+
 //
 //  Solve for the temperature
 //
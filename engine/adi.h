@@ -0,0 +1,335 @@
+#ifndef __HEAT_ADI_H__
+#define __HEAT_ADI_H__
+
+#include <assert.h>
+#include "stencil.h"
+
+//
+//  alternating-direction implicit (ADI) steps for a 2D mesh
+//
+//  With Lx and Ly the second differences along and across the rows
+//  (2 T - the two neighbours on that axis) and f the source term, the
+//  Peaceman-Rachford scheme splits a step of diffusion number r into
+//  two half steps, each implicit along one axis only:
+//
+//      (1 + r/2 Lx) T* = T  + r/2 (f - Ly T)
+//      (1 + r/2 Ly) T' = T* + r/2 (f - Lx T*)
+//
+//  It is stable for any r and second order in time, and every solve is
+//  a tridiagonal system along one line of nodes. A line holds all n
+//  nodes of a row or column, with the coupling k = r/2 at updated nodes
+//  and 0 at the others, which makes a node that is not updated its own
+//  equation, x = T; the halo nodes at the ends of the line are known.
+//  Ghosts would couple the lines, so only meshes without them qualify.
+//
+//  Lines are solved by the Thomas algorithm, in double whatever the
+//  stored type. The matrices never change, so init_adi( ) eliminates
+//  them once, keeping the inverse pivots m and the couplings c = k m
+//  left to the next node, and a step only carries the right hand sides
+//  d through: d = (d + k d_prev) m down the line, d += c d_next back up.
+//  Many lines are solved at a time so the recurrences run across SIMD
+//  lanes. Along the rows, the rows are batched by ADI_LANES (rows
+//  b*ADI_LANES on) and each batch is transposed into a tile, node by
+//  lane, so a vector holds the same node of every row in the batch.
+//  Across the rows, the nodes of a row already are the lanes:
+//  adi_forward( ) eliminates a block of columns down rows
+//  [rbegin, rend), and adi_backward( ) substitutes back up them, so a
+//  column can be cut between processes that pass on d of their last
+//  (first) row. T* lives in grid.T_next and T' goes back to grid.T, so
+//  a step needs no swap_grid( ).
+//
+const int ADI_LANES = 8;
+const int ADI_COLUMNS = 256;
+
+struct adi_t
+{
+    double r;
+    double *k;          // r/2 at updated nodes, 0 elsewhere
+    double *m;          // across the rows: inverse pivots
+    double *c;          // and couplings to the next row
+    double *kt;         // k, m and c along the rows, in tiles: batch b
+    double *mt;         // from b*ADI_LANES*ld on, node j of lane l at
+    double *ct;         // (j+1)*ADI_LANES + l
+    double *d;          // right hand sides, as tiles or as the mesh
+};
+
+template <class Mesh>
+void init_adi( adi_t &adi, const Mesh &grid, double r )
+{
+    assert( Mesh::dim == 2 && grid.nghosts == 0 );
+    const int L = ADI_LANES;
+    const int n = grid.n;
+    const int ld = grid.ld;
+    adi.r = r;
+
+    int len = max( grid.size, (grid.rows + L) * ld );
+    adi.k = alloc_aligned<double>( grid.size );
+    adi.m = alloc_aligned<double>( grid.size );
+    adi.c = alloc_aligned<double>( grid.size );
+    adi.kt = alloc_aligned<double>( len );
+    adi.mt = alloc_aligned<double>( len );
+    adi.ct = alloc_aligned<double>( len );
+    adi.d = alloc_aligned<double>( len );
+    for( int idx = 0; idx < grid.size; idx++ )
+        adi.k[idx] = is_updated( grid, idx ) ? r / 2 : 0;
+
+    for( int rr = 0; rr < grid.rows; rr++ )
+    {
+        int row = row_index( grid, rr );
+        for( int j = 0; j < n; j++ )
+        {
+            double k = adi.k[row + j];
+            double c_prev = rr > 0 ? adi.c[row + j - ld] : 0;
+            adi.m[row + j] = 1 / (1 + 2*k - k * c_prev);
+            adi.c[row + j] = k * adi.m[row + j];
+        }
+    }
+
+    // lanes past the last row keep k = 0
+    for( int r0 = 0; r0 < grid.rows; r0 += L )
+        for( int l = 0; l < L && r0 + l < grid.rows; l++ )
+        {
+            int row = row_index( grid, r0 + l );
+            double *kt = &adi.kt[r0 * ld + l];
+            double *mt = &adi.mt[r0 * ld + l];
+            double *ct = &adi.ct[r0 * ld + l];
+            for( int p = 1; p <= n; p++ )
+            {
+                kt[p*L] = adi.k[row + p-1];
+                mt[p*L] = 1 / (1 + 2*kt[p*L] - kt[p*L] * ct[(p-1)*L]);
+                ct[p*L] = kt[p*L] * mt[p*L];
+            }
+        }
+}
+
+inline void free_adi( adi_t &adi )
+{
+    free_aligned( adi.k );
+    free_aligned( adi.m );
+    free_aligned( adi.c );
+    free_aligned( adi.kt );
+    free_aligned( adi.mt );
+    free_aligned( adi.ct );
+    free_aligned( adi.d );
+}
+
+//
+//  First half step for rows [rbegin, rend), which lie in one batch;
+//  the other lanes of the batch solve x = 0 and are dropped
+//
+template <class Mesh>
+inline __attribute__((always_inline))
+void adi_rows_any( const Mesh &grid, const adi_t &adi, int rbegin, int rend )
+{
+    typedef typename Mesh::real_t real;
+    const int L = ADI_LANES;
+    const int n = grid.n;
+    const int ld = grid.ld;
+    const int r0 = rbegin - rbegin % L;
+    const double * __restrict__ kt = &adi.kt[r0 * ld];
+    const double * __restrict__ mt = &adi.mt[r0 * ld];
+    const double * __restrict__ ct = &adi.ct[r0 * ld];
+    double * __restrict__ d = &adi.d[r0 * ld];
+
+    // right hand sides, explicit across the rows; tile position p holds
+    // node p-1, so the halo nodes are positions 0 and n+1
+    for( int l = 0; l < L; l++ )
+    {
+        if( r0 + l < rbegin || r0 + l >= rend )
+        {
+            for( int p = 0; p < n+2; p++ )
+                d[p*L + l] = 0;
+            continue;
+        }
+        const int row = row_index( grid, r0 + l );
+        const real * __restrict__ T = &grid.T[row];
+        const double * __restrict__ k = &adi.k[row];
+        for( int j = -1; j <= n; j++ )
+            d[(j+1)*L + l] = T[j] + k[j] * (grid.source.add( 0.0, row + j ) - 2 * (double) T[j] + T[j - ld] + T[j + ld]);
+        for( int s = first_point( grid.source, row ); s < grid.source.points( ) && grid.source.point( s ) < row + n; s++ )
+        {
+            int j = grid.source.point( s ) - row;
+            d[(j+1)*L + l] += k[j] * grid.source.point_term( s );
+        }
+    }
+
+    // every lane at once, down the rows and back
+    for( int p = 1; p <= n; p++ )
+        for( int l = 0; l < L; l++ )
+            d[p*L + l] = (d[p*L + l] + kt[p*L + l] * d[(p-1)*L + l]) * mt[p*L + l];
+    for( int p = n; p >= 1; p-- )
+        for( int l = 0; l < L; l++ )
+            d[p*L + l] += ct[p*L + l] * d[(p+1)*L + l];
+
+    for( int r = rbegin; r < rend; r++ )
+    {
+        real * __restrict__ T_half = &grid.T_next[row_index( grid, r )];
+        for( int j = 0; j < n; j++ )
+            T_half[j] = (real) d[(j+1)*L + r - r0];
+    }
+}
+
+//
+//  Second half step: eliminate columns [jlo, jhi) down rows
+//  [rbegin, rend), from adi.d of row rbegin-1
+//
+template <class Mesh>
+inline __attribute__((always_inline))
+void adi_forward_any( const Mesh &grid, const adi_t &adi, int rbegin, int rend, int jlo, int jhi )
+{
+    typedef typename Mesh::real_t real;
+    const int ld = grid.ld;
+    for( int r = rbegin; r < rend; r++ )
+    {
+        const int row = row_index( grid, r );
+        const real * __restrict__ T_half = &grid.T_next[row];
+        const double * __restrict__ k = &adi.k[row];
+        const double * __restrict__ m = &adi.m[row];
+        const double * __restrict__ d_prev = &adi.d[row - ld];
+        double * __restrict__ d = &adi.d[row];
+        for( int j = jlo; j < jhi; j++ )
+        {
+            double rhs = T_half[j] + k[j] * (grid.source.add( 0.0, row + j ) - 2 * (double) T_half[j] + T_half[j - 1] + T_half[j + 1]);
+            d[j] = (rhs + k[j] * d_prev[j]) * m[j];
+        }
+        for( int s = first_point( grid.source, row + jlo ); s < grid.source.points( ) && grid.source.point( s ) < row + jhi; s++ )
+        {
+            int j = grid.source.point( s ) - row;
+            d[j] += k[j] * grid.source.point_term( s ) * m[j];
+        }
+    }
+}
+
+//
+//  ... and substitute back up them, from adi.d of row rend
+//
+template <class Mesh>
+inline __attribute__((always_inline))
+void adi_backward_any( const Mesh &grid, const adi_t &adi, int rbegin, int rend, int jlo, int jhi )
+{
+    typedef typename Mesh::real_t real;
+    const int ld = grid.ld;
+    for( int r = rend - 1; r >= rbegin; r-- )
+    {
+        const int row = row_index( grid, r );
+        const double * __restrict__ c = &adi.c[row];
+        const double * __restrict__ d_next = &adi.d[row + ld];
+        double * __restrict__ d = &adi.d[row];
+        real * __restrict__ T = &grid.T[row];
+        for( int j = jlo; j < jhi; j++ )
+        {
+            d[j] += c[j] * d_next[j];
+            T[j] = (real) d[j];
+        }
+    }
+}
+
+//
+//  one entry point per ISA, as for the stencil
+//
+enum adi_pass_t { ADI_ROWS, ADI_FORWARD, ADI_BACKWARD };
+
+template <class Mesh>
+inline __attribute__((always_inline))
+void adi_pass_any( const Mesh &grid, const adi_t &adi, adi_pass_t pass, int rbegin, int rend, int jlo, int jhi )
+{
+    if( pass == ADI_ROWS )
+        adi_rows_any( grid, adi, rbegin, rend );
+    else if( pass == ADI_FORWARD )
+        adi_forward_any( grid, adi, rbegin, rend, jlo, jhi );
+    else
+        adi_backward_any( grid, adi, rbegin, rend, jlo, jhi );
+}
+
+template <class Mesh>
+void adi_pass_scalar( const Mesh &grid, const adi_t &adi, adi_pass_t pass, int rbegin, int rend, int jlo, int jhi )
+{
+    adi_pass_any( grid, adi, pass, rbegin, rend, jlo, jhi );
+}
+
+template <class Mesh>
+__attribute__((target("avx2,fma")))
+void adi_pass_avx2( const Mesh &grid, const adi_t &adi, adi_pass_t pass, int rbegin, int rend, int jlo, int jhi )
+{
+    adi_pass_any( grid, adi, pass, rbegin, rend, jlo, jhi );
+}
+
+template <class Mesh>
+__attribute__((target("avx512f")))
+void adi_pass_avx512( const Mesh &grid, const adi_t &adi, adi_pass_t pass, int rbegin, int rend, int jlo, int jhi )
+{
+    adi_pass_any( grid, adi, pass, rbegin, rend, jlo, jhi );
+}
+
+template <class Mesh>
+inline void adi_pass( const Mesh &grid, const adi_t &adi, adi_pass_t pass, int rbegin, int rend, int jlo, int jhi )
+{
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        adi_pass_avx512( grid, adi, pass, rbegin, rend, jlo, jhi );
+        break;
+    case KERNEL_AVX2:
+        adi_pass_avx2( grid, adi, pass, rbegin, rend, jlo, jhi );
+        break;
+    default:
+        adi_pass_scalar( grid, adi, pass, rbegin, rend, jlo, jhi );
+    }
+}
+
+template <class Mesh>
+inline void adi_rows( const Mesh &grid, const adi_t &adi, int rbegin, int rend )
+{
+    adi_pass( grid, adi, ADI_ROWS, rbegin, rend, 0, grid.n );
+}
+
+template <class Mesh>
+inline void adi_forward( const Mesh &grid, const adi_t &adi, int rbegin, int rend, int jlo, int jhi )
+{
+    adi_pass( grid, adi, ADI_FORWARD, rbegin, rend, jlo, jhi );
+}
+
+template <class Mesh>
+inline void adi_backward( const Mesh &grid, const adi_t &adi, int rbegin, int rend, int jlo, int jhi )
+{
+    adi_pass( grid, adi, ADI_BACKWARD, rbegin, rend, jlo, jhi );
+}
+
+//
+//  Start the columns [jlo, jhi) at the halo row above the mesh and end
+//  them at the one below it
+//
+template <class Mesh>
+void adi_edges( const Mesh &grid, const adi_t &adi, int jlo, int jhi )
+{
+    const int top = row_index( grid, -1 );
+    const int bottom = row_index( grid, grid.rows );
+    for( int j = jlo; j < jhi; j++ )
+    {
+        adi.d[top + j] = grid.T_next[top + j];
+        adi.d[bottom + j] = grid.T_next[bottom + j];
+    }
+}
+
+//
+//  One ADI step of the whole mesh; the loops are orphaned omp for
+//  constructs, so a team can share them
+//
+template <class Mesh>
+void adi_step( Mesh &grid, const adi_t &adi )
+{
+    #pragma omp for
+    for( int r0 = 0; r0 < grid.rows; r0 += ADI_LANES )
+        adi_rows( grid, adi, r0, min( grid.rows, r0 + ADI_LANES ) );
+
+    #pragma omp for
+    for( int jlo = 0; jlo < grid.n; jlo += ADI_COLUMNS )
+    {
+        int jhi = min( grid.n, jlo + ADI_COLUMNS );
+        adi_edges( grid, adi, jlo, jhi );
+        adi_forward( grid, adi, 0, grid.rows, jlo, jhi );
+        adi_backward( grid, adi, 0, grid.rows, jlo, jhi );
+    }
+}
+
+#endif
@@ -0,0 +1,700 @@
+#ifndef __HEAT_AMR_H__
+#define __HEAT_AMR_H__
+
+#include "mesh.h"
+#include "stencil.h"
+#include "converge.h"
+#include "morton.h"
+
+//
+//  block-structured quadtree mesh refinement of a 2D field
+//  The n by n nodes are cut into fine blocks of AMR_BLOCK nodes a side,
+//  and the field is held in leaves of AMR_BLOCK by AMR_BLOCK cells, each
+//  stored row by row inside a frame of halo cells. A leaf of level l
+//  covers 2^l by 2^l fine blocks, aligned to its size, with cells of
+//  2^l by 2^l nodes holding their average, so the leaves are those of a
+//  quadtree over the blocks; level[ ] keeps the level of the leaf over
+//  every block, and leaves next to each other differ by a level at
+//  most. A block holding a node that is not updated, a point source or
+//  the edge of the field is pinned to level 0, where a leaf is a piece
+//  of the mesh: with every block at level 0 a run gives the field of
+//  the mesh.
+//
+//  Every level takes the same steps, each cell moving r / 4^l of the
+//  way, so the flux through a face of a level l cell is that of the
+//  mesh scaled to its size. Across a change of level the flux is found
+//  once, on the fine side: a fine cell sees across the face the value
+//  amr_interface( ) puts between it and the coarse cell, 1.5 fine
+//  cells away, and the coarse cell sees the value that draws the sum
+//  of the fluxes of the two fine faces it borders, so no heat is made
+//  or lost between levels. The frames of a leaf are filled that way
+//  just before it is stepped, from the old field of the leaves next to
+//  it, so the leaves can be stepped in any order or in parallel.
+//
+//  regrid_amr( ) splits the leaves where cells next to each other
+//  differ by more than the threshold, merges four leaves where they all
+//  differ by under a quarter of it, restores the balance between the
+//  levels and moves the field to the new leaves, each cell taking the
+//  average of the old ones it covers, which keeps the heat of the
+//  field. Leaves are numbered along a Z curve of their first block, so
+//  a run of leaves is a compact piece of the field. regrid_amr( ) uses
+//  orphaned omp constructs, and so is called by a whole team, or
+//  outside one.
+//
+const int AMR_BLOCK = 16;
+const int AMR_LD = AMR_BLOCK + 2;
+const int AMR_SIZE = AMR_LD * AMR_LD;
+const int AMR_LEVELS = 8;
+
+struct amr_tree_t
+{
+    int nleaves;
+    int *level;         // blocks * blocks: the level of the leaf over each block
+    int *leaf_of;       // blocks * blocks: that leaf
+    int *leaves;        // 3 per leaf: its first block (bi, bj) and its level
+    int *neighbours;    // 2 per side (above, below, left, right): the leaf next to
+                        // it, or the two finer ones, or -1
+};
+
+template <typename real>
+struct amr_t
+{
+    typedef real real_t;
+
+    int n;
+    int blocks;         // along each axis
+    double r;
+    double threshold;   // in kelvin, between cells next to each other
+    unsigned char *pinned;  // blocks * blocks
+    int *row_begin;     // n each: the updated span of every row of the mesh
+    int *row_end;
+    int nsources;
+    int *source_node;   // i * n + j
+    double *source_term;
+    int *source_at;     // offset into T
+    double gain;
+    amr_tree_t tree;
+    amr_tree_t next;    // planned by regrid_amr( )
+    int regrids;
+    int peak_cells;
+    real *field;        // T and T_next
+    real *next_field;
+    real *next_T;
+    real *next_T_next;
+    real *T;
+    real *T_next;
+};
+
+inline void amr_source( const no_source & /* source */, int &count, int * /* node */, double * /* term */ ) { count = 0; }
+
+inline void amr_source( const point_sources &source, int &count, int *node, double *term )
+{
+    count = source.points( );
+    for( int k = 0; k < count; k++ )
+    {
+        node[k] = source.point( k );
+        term[k] = source.term[k];
+    }
+}
+
+//
+//  The value a fine cell sees across a face with a coarse one
+//
+template <typename real>
+inline real amr_interface( real fine, real coarse )
+{
+    return (fine + 2 * coarse) / 3;
+}
+
+//
+//  Offset into a field of the cell of leaf L holding node (i, j)
+//
+inline int amr_cell( const amr_tree_t &tree, int L, int i, int j )
+{
+    const int *leaf = &tree.leaves[3*L];
+    const int ci = (i - leaf[0] * AMR_BLOCK) >> leaf[2];
+    const int cj = (j - leaf[1] * AMR_BLOCK) >> leaf[2];
+    return L * AMR_SIZE + (ci+1) * AMR_LD + cj+1;
+}
+
+template <typename real>
+inline real amr_value( const amr_t<real> &a, int i, int j )
+{
+    const int L = a.tree.leaf_of[(i / AMR_BLOCK) * a.blocks + j / AMR_BLOCK];
+    return a.T[amr_cell( a.tree, L, i, j )];
+}
+
+//
+//  The updated span of row ci of leaf L: whole unless at level 0, where
+//  it is that of the mesh
+//
+template <typename real>
+inline void amr_span( const amr_t<real> &a, int L, int ci, int &begin, int &end )
+{
+    const int *leaf = &a.tree.leaves[3*L];
+    begin = 0;
+    end = AMR_BLOCK;
+    if( leaf[2] > 0 )
+        return;
+    const int i = leaf[0] * AMR_BLOCK + ci, j = leaf[1] * AMR_BLOCK;
+    if( i >= a.n )
+    {
+        end = 0;
+        return;
+    }
+    begin = min( max( a.row_begin[i] - j, 0 ), AMR_BLOCK );
+    end = max( min( a.row_end[i] - j, AMR_BLOCK ), begin );
+}
+
+//
+//  Offset of the k-th cell along side s (0 to 3: above, below, left and
+//  right) of leaf L, and of the frame cell beyond it
+//
+inline int amr_edge( int L, int s, int k )
+{
+    const int ci = s == 0 ? 0 : s == 1 ? AMR_BLOCK-1 : k;
+    const int cj = s == 2 ? 0 : s == 3 ? AMR_BLOCK-1 : k;
+    return L * AMR_SIZE + (ci+1) * AMR_LD + cj+1;
+}
+
+inline int amr_frame( int L, int s, int k )
+{
+    const int ci = s == 0 ? -1 : s == 1 ? AMR_BLOCK : k;
+    const int cj = s == 2 ? -1 : s == 3 ? AMR_BLOCK : k;
+    return L * AMR_SIZE + (ci+1) * AMR_LD + cj+1;
+}
+
+//
+//  The first node of leaf L along the sides s, in nodes
+//
+inline int amr_along( const amr_tree_t &tree, int L, int s )
+{
+    return tree.leaves[3*L + (s < 2 ? 1 : 0)] * AMR_BLOCK;
+}
+
+//
+//  The leaves over the blocks of the level map, their numbers along a Z
+//  curve and the leaves next to them
+//
+inline void build_tree( amr_tree_t &tree, int blocks )
+{
+    unsigned long long *keys = (unsigned long long *) malloc( max( blocks * blocks, 1 ) * sizeof(unsigned long long) );
+    int count = 0;
+    for( int bi = 0; bi < blocks; bi++ )
+        for( int bj = 0; bj < blocks; bj++ )
+        {
+            const int l = tree.level[bi * blocks + bj];
+            if( (bi | bj) & ((1 << l) - 1) )
+                continue;
+            keys[count++] = morton_key( bi, bj ) << 32 | (unsigned) (bi * blocks + bj);
+        }
+    qsort( keys, count, sizeof(unsigned long long), compare_keys );
+
+    tree.nleaves = count;
+    tree.leaves = (int *) malloc( 3 * max( count, 1 ) * sizeof(int) );
+    tree.neighbours = (int *) malloc( 8 * max( count, 1 ) * sizeof(int) );
+    for( int L = 0; L < count; L++ )
+    {
+        const int b = keys[L] & 0xffffffffu;
+        const int bi = b / blocks, bj = b % blocks, l = tree.level[b];
+        tree.leaves[3*L] = bi;
+        tree.leaves[3*L + 1] = bj;
+        tree.leaves[3*L + 2] = l;
+        for( int i = bi; i < bi + (1 << l); i++ )
+            for( int j = bj; j < bj + (1 << l); j++ )
+                tree.leaf_of[i * blocks + j] = L;
+    }
+    free( keys );
+
+    for( int L = 0; L < count; L++ )
+    {
+        const int bi = tree.leaves[3*L], bj = tree.leaves[3*L + 1], e = 1 << tree.leaves[3*L + 2];
+        const int at[4][2] = { { bi-1, bj }, { bi+e, bj }, { bi, bj-1 }, { bi, bj+e } };
+        for( int s = 0; s < 4; s++ )
+        {
+            int *nb = &tree.neighbours[8*L + 2*s];
+            nb[0] = nb[1] = -1;
+            const int i = at[s][0], j = at[s][1];
+            if( i < 0 || i >= blocks || j < 0 || j >= blocks )
+                continue;
+            nb[0] = tree.leaf_of[i * blocks + j];
+            if( tree.level[i * blocks + j] < tree.leaves[3*L + 2] )
+                nb[1] = s < 2 ? tree.leaf_of[i * blocks + j + e/2] : tree.leaf_of[(i + e/2) * blocks + j];
+        }
+    }
+}
+
+inline void free_tree( amr_tree_t &tree )
+{
+    free( tree.leaves );
+    free( tree.neighbours );
+}
+
+//
+//  A field for the leaves of tree, T and T_next half a page out of
+//  step, as in morton.h
+//
+template <typename real>
+real *alloc_amr_field( const amr_tree_t &tree, real *&T, real *&T_next )
+{
+    const int page = 4096 / sizeof(real);
+    const int stride = (tree.nleaves * AMR_SIZE + page-1) / page * page + page/2;
+    real *field = alloc_aligned<real>( 2 * stride );
+    T = field;
+    T_next = field + stride;
+    return field;
+}
+
+template <typename real>
+void find_amr_sources( amr_t<real> &a )
+{
+    for( int k = 0; k < a.nsources; k++ )
+    {
+        const int i = a.source_node[k] / a.n, j = a.source_node[k] % a.n;
+        a.source_at[k] = amr_cell( a.tree, a.tree.leaf_of[(i / AMR_BLOCK) * a.blocks + j / AMR_BLOCK], i, j );
+    }
+}
+
+template <typename real>
+void regrid_amr( amr_t<real> &a );
+
+//
+//  Copy the field of grid into leaves of level 0, and regrid them until
+//  they stop changing, cells next to each other differing by about
+//  threshold kelvin at most
+//
+template <class Mesh>
+void init_amr( amr_t<typename Mesh::real_t> &a, const Mesh &grid, double threshold )
+{
+    assert( Mesh::dim == 2 && grid.nghosts == 0 );
+
+    const int n = grid.n;
+    a.n = n;
+    a.r = grid.r;
+    a.threshold = threshold;
+    a.blocks = (n + AMR_BLOCK - 1) / AMR_BLOCK;
+    a.regrids = 0;
+    a.gain = 1;
+
+    a.row_begin = (int *) malloc( n * sizeof(int) );
+    a.row_end = (int *) malloc( n * sizeof(int) );
+    for( int i = 0; i < n; i++ )
+    {
+        assert( !grid.row_gaps[i] );
+        a.row_begin[i] = grid.row_begin[i];
+        a.row_end[i] = max( grid.row_end[i], grid.row_begin[i] );
+    }
+
+    const int capacity = max( grid.source.points( ), 1 );
+    a.source_node = (int *) malloc( capacity * sizeof(int) );
+    a.source_term = (double *) malloc( capacity * sizeof(double) );
+    a.source_at = (int *) malloc( capacity * sizeof(int) );
+    amr_source( grid.source, a.nsources, a.source_node, a.source_term );
+    for( int k = 0; k < a.nsources; k++ )
+        a.source_node[k] = (a.source_node[k] / grid.ld - 1) * n + a.source_node[k] % grid.ld - 1;
+
+    // blocks with the edge of the field, a node that is not updated or
+    // a source stay at level 0
+    const int nblocks = a.blocks * a.blocks;
+    a.pinned = (unsigned char *) calloc( nblocks, 1 );
+    for( int bi = 0; bi < a.blocks; bi++ )
+        for( int bj = 0; bj < a.blocks; bj++ )
+            for( int i = bi * AMR_BLOCK; i < (bi+1) * AMR_BLOCK; i++ )
+                if( i >= n || a.row_begin[i] > bj * AMR_BLOCK || a.row_end[i] < (bj+1) * AMR_BLOCK )
+                    a.pinned[bi * a.blocks + bj] = 1;
+    for( int k = 0; k < a.nsources; k++ )
+        a.pinned[(a.source_node[k] / n / AMR_BLOCK) * a.blocks + a.source_node[k] % n / AMR_BLOCK] = 1;
+
+    a.tree.level = (int *) calloc( nblocks, sizeof(int) );
+    a.tree.leaf_of = (int *) malloc( nblocks * sizeof(int) );
+    a.next.level = (int *) malloc( nblocks * sizeof(int) );
+    a.next.leaf_of = (int *) malloc( nblocks * sizeof(int) );
+    build_tree( a.tree, a.blocks );
+    a.field = alloc_amr_field( a.tree, a.T, a.T_next );
+    for( int L = 0; L < a.tree.nleaves; L++ )
+        for( int ci = 0; ci < AMR_BLOCK; ci++ )
+            for( int cj = 0; cj < AMR_BLOCK; cj++ )
+            {
+                const int i = a.tree.leaves[3*L] * AMR_BLOCK + ci, j = a.tree.leaves[3*L + 1] * AMR_BLOCK + cj;
+                if( i >= n || j >= n )
+                    continue;
+                const int at = amr_cell( a.tree, L, i, j );
+                a.T[at] = grid.T[node_index( grid, i, j )];
+                a.T_next[at] = grid.T_next[node_index( grid, i, j )];
+            }
+    find_amr_sources( a );
+    a.peak_cells = 0;
+
+    for( int l = 0; l < AMR_LEVELS; l++ )
+        regrid_amr( a );
+    a.regrids = 0;
+    a.peak_cells = a.tree.nleaves * AMR_BLOCK * AMR_BLOCK;
+}
+
+template <typename real>
+void free_amr( amr_t<real> &a )
+{
+    free( a.pinned );
+    free( a.row_begin );
+    free( a.row_end );
+    free( a.source_node );
+    free( a.source_term );
+    free( a.source_at );
+    free_tree( a.tree );
+    free( a.tree.level );
+    free( a.tree.leaf_of );
+    free( a.next.level );
+    free( a.next.leaf_of );
+    free_aligned( a.field );
+}
+
+template <typename real>
+void swap_amr( amr_t<real> &a )
+{
+    real *tmp = a.T;
+    a.T = a.T_next;
+    a.T_next = tmp;
+}
+
+//
+//  Fill the frame of leaf L of T from the old field of the leaves next
+//  to it
+//
+template <typename real>
+inline __attribute__((always_inline))
+void amr_halo( const amr_t<real> &a, int L )
+{
+    real *T = a.T;
+    const amr_tree_t &tree = a.tree;
+    const int l = tree.leaves[3*L + 2];
+    for( int s = 0; s < 4; s++ )
+    {
+        const int *nb = &tree.neighbours[8*L + 2*s];
+        if( nb[0] < 0 )
+            continue;
+        const int N = nb[0], ln = tree.leaves[3*N + 2];
+        if( ln == l )
+            for( int k = 0; k < AMR_BLOCK; k++ )
+                T[amr_frame( L, s, k )] = T[amr_edge( N, s^1, k )];
+        else if( ln > l )
+        {
+            // each cell of the coarse edge borders two of these
+            const int first = (amr_along( tree, L, s ) - amr_along( tree, N, s )) >> l;
+            for( int k = 0; k < AMR_BLOCK; k++ )
+            {
+                const real fine = T[amr_edge( L, s, k )];
+                T[amr_frame( L, s, k )] = amr_interface( fine, T[amr_edge( N, s^1, (first + k) >> 1 )] );
+            }
+        }
+        else
+            for( int k = 0; k < AMR_BLOCK; k++ )
+            {
+                // the two fine cells next to cell k, in nb[0] or nb[1]
+                const int F = 2*k < AMR_BLOCK ? nb[0] : nb[1];
+                const int kf = (2*k) % AMR_BLOCK;
+                const real coarse = T[amr_edge( L, s, k )];
+                const real f0 = T[amr_edge( F, s^1, kf )], f1 = T[amr_edge( F, s^1, kf+1 )];
+                T[amr_frame( L, s, k )] = coarse + (f0 - amr_interface( f0, coarse )) + (f1 - amr_interface( f1, coarse ));
+            }
+    }
+}
+
+template <typename acc, typename real>
+inline __attribute__((always_inline))
+void step_amr_any( const amr_t<real> &a, int lbegin, int lend )
+{
+    for( int L = lbegin; L < lend; L++ )
+    {
+        amr_halo( a, L );
+        const int l = a.tree.leaves[3*L + 2];
+        const bool mean = l == 0 && a.r == 0.25;
+        const acc d = (acc) (a.r / (1 << 2*l));
+        for( int ci = 0; ci < AMR_BLOCK; ci++ )
+        {
+            const int row = L * AMR_SIZE + (ci+1) * AMR_LD + 1;
+            const real * __restrict__ T = &a.T[row];
+            real * __restrict__ T_next = &a.T_next[row];
+            int jbegin, jend;
+            amr_span( a, L, ci, jbegin, jend );
+            if( mean )
+                for( int j = jbegin; j < jend; j++ )
+                    T_next[j] = (real) (neighbour_sum<acc, 2>( T, j, AMR_LD, 0 ) / 4);
+            else
+                for( int j = jbegin; j < jend; j++ )
+                    T_next[j] = (real) (T[j] + d * (neighbour_sum<acc, 2>( T, j, AMR_LD, 0 ) - 4 * (acc) T[j]));
+        }
+    }
+}
+
+template <typename acc, class Amr>
+void step_amr_scalar( const Amr &a, int lbegin, int lend )
+{
+    step_amr_any<acc>( a, lbegin, lend );
+}
+
+template <typename acc, class Amr>
+__attribute__((target("avx2,fma")))
+void step_amr_avx2( const Amr &a, int lbegin, int lend )
+{
+    step_amr_any<acc>( a, lbegin, lend );
+}
+
+template <typename acc, class Amr>
+__attribute__((target("avx512f")))
+void step_amr_avx512( const Amr &a, int lbegin, int lend )
+{
+    step_amr_any<acc>( a, lbegin, lend );
+}
+
+//
+//  hot kernel: advance leaves [lbegin, lend) by one step, reading a.T
+//  and writing a.T_next; step_amr_sources( ) adds the sources after it
+//
+template <typename acc, class Amr>
+inline void step_amr( const Amr &a, int lbegin, int lend )
+{
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        step_amr_avx512<acc>( a, lbegin, lend );
+        break;
+    case KERNEL_AVX2:
+        step_amr_avx2<acc>( a, lbegin, lend );
+        break;
+    default:
+        step_amr_scalar<acc>( a, lbegin, lend );
+    }
+}
+
+template <class Amr>
+inline void step_amr( const Amr &a, int lbegin, int lend )
+{
+    step_amr<typename Amr::real_t>( a, lbegin, lend );
+}
+
+//
+//  Add the point sources, all in leaves of level 0, to the step just
+//  taken, as step_points( ) does for the mesh
+//
+template <typename real>
+void step_amr_sources( const amr_t<real> &a )
+{
+    for( int k = 0; k < a.nsources; k++ )
+        a.T_next[a.source_at[k]] += (real) (a.r * (a.gain * a.source_term[k]));
+}
+
+//
+//  The change of the last step over the updated cells of leaves
+//  [lbegin, lend), as change_rows( ) for the mesh
+//
+template <typename real>
+void change_amr( const amr_t<real> &a, int lbegin, int lend, double &largest, double &sq )
+{
+    double mx = largest, s = sq;
+    for( int L = lbegin; L < lend; L++ )
+        for( int ci = 0; ci < AMR_BLOCK; ci++ )
+        {
+            const int row = L * AMR_SIZE + (ci+1) * AMR_LD + 1;
+            int jbegin, jend;
+            amr_span( a, L, ci, jbegin, jend );
+            for( int j = jbegin; j < jend; j++ )
+            {
+                double d = (double) a.T[row + j] - a.T_next[row + j];
+                mx = fmax( mx, fabs( d ) );
+                s += d * d;
+            }
+        }
+    largest = mx;
+    sq = s;
+}
+
+template <typename real>
+bool check_step( converge_t &conv, const amr_t<real> &a, int step )
+{
+    if( !check_due( conv, step ) )
+        return false;
+    double largest = 0, sq = 0;
+    change_amr( a, 0, a.tree.nleaves, largest, sq );
+    end_check( conv, step, largest, sq );
+    return converged( conv );
+}
+
+//
+//  The largest difference between cells next to each other in leaf L
+//
+template <typename real>
+double amr_jump( const amr_t<real> &a, int L )
+{
+    double jump = 0;
+    for( int ci = 0; ci < AMR_BLOCK; ci++ )
+    {
+        const real *T = &a.T[L * AMR_SIZE + (ci+1) * AMR_LD + 1];
+        for( int cj = 0; cj < AMR_BLOCK; cj++ )
+        {
+            if( cj+1 < AMR_BLOCK )
+                jump = fmax( jump, fabs( (double) T[cj+1] - T[cj] ) );
+            if( ci+1 < AMR_BLOCK )
+                jump = fmax( jump, fabs( (double) T[cj + AMR_LD] - T[cj] ) );
+        }
+    }
+    return jump;
+}
+
+//
+//  Set the blocks of the square of e blocks a side at (bi, bj) to
+//  level l
+//
+inline void set_amr_level( int *level, int blocks, int bi, int bj, int e, int l )
+{
+    for( int i = bi; i < bi + e; i++ )
+        for( int j = bj; j < bj + e; j++ )
+            level[i * blocks + j] = l;
+}
+
+//
+//  The average of the old field over the square of size nodes a side
+//  at (i, j), aligned to its size
+//
+template <typename real>
+double amr_average( const amr_t<real> &a, int i, int j, int size )
+{
+    const int L = a.tree.leaf_of[(i / AMR_BLOCK) * a.blocks + j / AMR_BLOCK];
+    if( (1 << a.tree.leaves[3*L + 2]) >= size )
+        return a.T[amr_cell( a.tree, L, i, j )];
+    const int half = size / 2;
+    return (amr_average( a, i, j, half ) + amr_average( a, i, j + half, half )
+            + amr_average( a, i + half, j, half ) + amr_average( a, i + half, j + half, half )) / 4;
+}
+
+//
+//  Plan the next leaves into a.next, leaving it empty if they are the
+//  leaves already in use
+//
+template <typename real>
+void plan_amr( amr_t<real> &a )
+{
+    const int blocks = a.blocks, nblocks = blocks * blocks;
+    const amr_tree_t &tree = a.tree;
+    int *level = a.next.level;
+    memcpy( level, tree.level, nblocks * sizeof(int) );
+
+    // split where the field is steep, and mark where it is flat
+    unsigned char *flat = (unsigned char *) calloc( max( tree.nleaves, 1 ), 1 );
+    for( int L = 0; L < tree.nleaves; L++ )
+    {
+        const int bi = tree.leaves[3*L], bj = tree.leaves[3*L + 1], l = tree.leaves[3*L + 2];
+        if( a.pinned[bi * blocks + bj] )
+            continue;
+        const double jump = amr_jump( a, L );
+        if( jump > a.threshold && l > 0 )
+            set_amr_level( level, blocks, bi, bj, 1 << l, l-1 );
+        flat[L] = jump < a.threshold / 4;
+    }
+
+    // merge four flat leaves that have not been split
+    for( int L = 0; L < tree.nleaves; L++ )
+    {
+        const int bi = tree.leaves[3*L], bj = tree.leaves[3*L + 1], l = tree.leaves[3*L + 2];
+        const int e = 1 << l;
+        if( l+1 >= AMR_LEVELS || (bi | bj) & (2*e - 1) || bi + 2*e > blocks || bj + 2*e > blocks )
+            continue;
+        bool merge = true;
+        for( int q = 0; q < 4 && merge; q++ )
+        {
+            const int b = (bi + (q >> 1) * e) * blocks + bj + (q & 1) * e;
+            merge = tree.level[b] == l && level[b] == l && !a.pinned[b] && flat[tree.leaf_of[b]];
+        }
+        if( merge )
+            set_amr_level( level, blocks, bi, bj, 2*e, l+1 );
+    }
+    free( flat );
+
+    // split leaves more than a level coarser than one next to them
+    for( bool changed = true; changed; )
+    {
+        changed = false;
+        for( int bi = 0; bi < blocks; bi++ )
+            for( int bj = 0; bj < blocks; bj++ )
+            {
+                const int l = level[bi * blocks + bj];
+                const int at[4][2] = { { bi-1, bj }, { bi+1, bj }, { bi, bj-1 }, { bi, bj+1 } };
+                for( int s = 0; s < 4 && l > 0; s++ )
+                {
+                    const int i = at[s][0], j = at[s][1];
+                    if( i < 0 || i >= blocks || j < 0 || j >= blocks || level[i * blocks + j] >= l-1 )
+                        continue;
+                    set_amr_level( level, blocks, bi >> l << l, bj >> l << l, 1 << l, l-1 );
+                    changed = true;
+                    break;
+                }
+            }
+    }
+
+    a.next.nleaves = 0;
+    if( memcmp( level, tree.level, nblocks * sizeof(int) ) == 0 )
+        return;
+    build_tree( a.next, blocks );
+    a.next_field = alloc_amr_field( a.next, a.next_T, a.next_T_next );
+}
+
+//
+//  Move to the leaves planned by plan_amr( ), if any, each cell of them
+//  taking the average of the old field over it
+//
+template <typename real>
+void regrid_amr( amr_t<real> &a )
+{
+    #pragma omp single
+    plan_amr( a );
+    if( a.next.nleaves == 0 )
+        return;
+
+    const int n = a.n;
+    #pragma omp for
+    for( int L = 0; L < a.next.nleaves; L++ )
+        for( int ci = 0; ci < AMR_BLOCK; ci++ )
+            for( int cj = 0; cj < AMR_BLOCK; cj++ )
+            {
+                const int l = a.next.leaves[3*L + 2];
+                const int i = a.next.leaves[3*L] * AMR_BLOCK + (ci << l), j = a.next.leaves[3*L + 1] * AMR_BLOCK + (cj << l);
+                if( i >= n || j >= n )
+                    continue;
+                const int at = L * AMR_SIZE + (ci+1) * AMR_LD + cj+1;
+                a.next_T[at] = a.next_T_next[at] = (real) amr_average( a, i, j, 1 << l );
+            }
+
+    #pragma omp single
+    {
+        free_tree( a.tree );
+        free_aligned( a.field );
+        amr_tree_t tree = a.tree;
+        a.tree = a.next;
+        a.next = tree;
+        a.next.nleaves = 0;
+        a.field = a.next_field;
+        a.T = a.next_T;
+        a.T_next = a.next_T_next;
+        find_amr_sources( a );
+        a.regrids++;
+        a.peak_cells = max( a.peak_cells, a.tree.nleaves * AMR_BLOCK * AMR_BLOCK );
+    }
+}
+
+//
+//  The number of leaves at each level, and of levels in use
+//
+template <typename real>
+int amr_levels( const amr_t<real> &a, int *count )
+{
+    int levels = 0;
+    for( int l = 0; l < AMR_LEVELS; l++ )
+        count[l] = 0;
+    for( int L = 0; L < a.tree.nleaves; L++ )
+    {
+        count[a.tree.leaves[3*L + 2]]++;
+        levels = max( levels, a.tree.leaves[3*L + 2] + 1 );
+    }
+    return levels;
+}
+
+#endif
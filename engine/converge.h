@@ -0,0 +1,110 @@
+#ifndef __HEAT_CONVERGE_H__
+#define __HEAT_CONVERGE_H__
+
+#include <math.h>
+#include "mesh.h"
+
+//
+//  early termination of the time stepping
+//  Every conv.every steps the change made by the last step is measured,
+//  as its largest value over the updated nodes and as its L2 norm, and
+//  the run has converged once the chosen one (the largest by default)
+//  is below conv.tol; a tol of 0 never stops a run. The change is taken
+//  between grid.T and grid.T_next after swap_grid( ), which then hold
+//  the last two steps, after a temporally blocked sweep as well as
+//  after a single step.
+//
+//  change_rows( ) and change_nodes( ) add the change of part of the
+//  mesh into largest and sq (the sum of squares), so the drivers can
+//  reduce the parts over threads and processes before handing the
+//  totals to end_check( ).
+//
+struct converge_t
+{
+    double tol;
+    int every;
+    bool l2;
+    int checks;
+    int step;           // of the last check
+    double max_change;
+    double l2_change;
+};
+
+inline void init_converge( converge_t &conv, double tol, int every, bool l2 )
+{
+    conv.tol = tol;
+    conv.every = every > 0 ? every : 1;
+    conv.l2 = l2;
+    conv.checks = 0;
+    conv.step = -1;
+    conv.max_change = 0;
+    conv.l2_change = 0;
+}
+
+inline bool check_due( const converge_t &conv, int step )
+{
+    return conv.tol > 0 && step % conv.every == 0;
+}
+
+template <class Mesh>
+void change_nodes( const Mesh &grid, int r, int jbegin, int jend, double &largest, double &sq )
+{
+    const int row = row_index( grid, r );
+    const typename Mesh::real_t *T = &grid.T[row];
+    const typename Mesh::real_t *T_prev = &grid.T_next[row];
+    const unsigned char *flags = &grid.flags[row];
+    const bool gaps = grid.row_gaps[r];
+    jbegin = max( grid.row_begin[r], jbegin );
+    jend = min( grid.row_end[r], jend );
+    double m = largest, s = sq;
+    for( int j = jbegin; j < jend; j++ )
+    {
+        if( gaps && (flags[j] & NOT_UPDATED) )
+            continue;
+        double d = (double) T[j] - T_prev[j];
+        m = fmax( m, fabs( d ) );
+        s += d * d;
+    }
+    largest = m;
+    sq = s;
+}
+
+template <class Mesh>
+void change_rows( const Mesh &grid, int rbegin, int rend, double &largest, double &sq )
+{
+    for( int r = rbegin; r < rend; r++ )
+        change_nodes( grid, r, 0, grid.n, largest, sq );
+}
+
+//
+//  Record the totals of the check of step
+//
+inline void end_check( converge_t &conv, int step, double largest, double sq )
+{
+    conv.checks++;
+    conv.step = step;
+    conv.max_change = largest;
+    conv.l2_change = sqrt( sq );
+}
+
+inline bool converged( const converge_t &conv )
+{
+    return conv.checks > 0 && (conv.l2 ? conv.l2_change : conv.max_change) < conv.tol;
+}
+
+//
+//  Check step over the whole mesh if it is due, for the serial drivers;
+//  returns whether the run has converged
+//
+template <class Mesh>
+bool check_step( converge_t &conv, const Mesh &grid, int step )
+{
+    if( !check_due( conv, step ) )
+        return false;
+    double largest = 0, sq = 0;
+    change_rows( grid, 0, grid.rows, largest, sq );
+    end_check( conv, step, largest, sq );
+    return converged( conv );
+}
+
+#endif
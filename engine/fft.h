@@ -0,0 +1,238 @@
+#ifndef __HEAT_FFT_H__
+#define __HEAT_FFT_H__
+
+#include <math.h>
+#include <stdlib.h>
+#include "util.h"
+#ifdef HEAT_FFTW
+#include <fftw3.h>
+#endif
+
+//
+//  discrete sine transforms of lines of doubles
+//  dst_lines( ) takes the type I transform (FFTW's RODFT00)
+//
+//      X[p] = 2 sum over k < m of x[k] sin( pi (k+1) (p+1) / (m+1) )
+//
+//  of lines of m values in place; applied twice it multiplies a line by
+//  2 (m+1). Built with HEAT_FFTW it calls FFTW. Otherwise it takes a
+//  local complex FFT of length N = 2 (m+1) of the odd extension of two
+//  lines at once, one as the real and one as the imaginary part: the
+//  transform of an odd real line is imaginary, so the two come apart
+//  again as the imaginary and the real part of the result. The FFT is
+//  radix 2 when N is a power of two, and otherwise Bluestein's chirp
+//  z-transform through a radix 2 FFT of at least 2N - 1 points, so any
+//  m costs O(m log m). Complex values are (re, im) pairs of doubles.
+//  Every thread needs its own work buffer of dst_work( ) doubles.
+//
+struct fft_t
+{
+    int n;
+    int size;           // of the radix 2 FFT doing it
+    double *twiddle;    // exp( -2 pi i k / size ), k < size/2
+    double *chirp;      // Bluestein only: exp( i pi k^2 / n ), k < n
+    double *filter;     // and the FFT of the chirp, around 0
+};
+
+//
+//  Unscaled radix 2 FFT of fft.size points of x in place, forward or
+//  inverse
+//
+inline void fft_radix2( const fft_t &fft, double *x, bool inverse )
+{
+    const int size = fft.size;
+    for( int i = 1, j = 0; i < size; i++ )
+    {
+        int bit = size >> 1;
+        for( ; j & bit; bit >>= 1 )
+            j ^= bit;
+        j ^= bit;
+        if( i < j )
+        {
+            double re = x[2*i], im = x[2*i + 1];
+            x[2*i] = x[2*j];
+            x[2*i + 1] = x[2*j + 1];
+            x[2*j] = re;
+            x[2*j + 1] = im;
+        }
+    }
+    const double sign = inverse ? -1 : 1;
+    for( int len = 2; len <= size; len *= 2 )
+    {
+        const int stride = size / len;
+        for( int i = 0; i < size; i += len )
+            for( int k = 0; k < len/2; k++ )
+            {
+                double wr = fft.twiddle[2*k*stride];
+                double wi = sign * fft.twiddle[2*k*stride + 1];
+                double *a = &x[2*(i + k)];
+                double *b = &x[2*(i + k + len/2)];
+                double br = b[0]*wr - b[1]*wi;
+                double bi = b[0]*wi + b[1]*wr;
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+    }
+}
+
+inline void init_fft( fft_t &fft, int n )
+{
+    fft.n = n;
+    fft.size = 1;
+    while( fft.size < n )
+        fft.size *= 2;
+    fft.chirp = fft.filter = NULL;
+    if( fft.size != n )
+        while( fft.size < 2*n - 1 )
+            fft.size *= 2;
+
+    fft.twiddle = alloc_aligned<double>( fft.size );
+    for( int k = 0; k < fft.size/2; k++ )
+    {
+        fft.twiddle[2*k] = cos( 2 * M_PI * k / fft.size );
+        fft.twiddle[2*k + 1] = -sin( 2 * M_PI * k / fft.size );
+    }
+    if( fft.size == n )
+        return;
+
+    // k^2 is taken mod 2n to keep the angles small
+    fft.chirp = alloc_aligned<double>( 2*n );
+    for( int k = 0; k < n; k++ )
+    {
+        double angle = M_PI * (double) ((long long) k * k % (2*n)) / n;
+        fft.chirp[2*k] = cos( angle );
+        fft.chirp[2*k + 1] = sin( angle );
+    }
+    fft.filter = alloc_aligned<double>( 2*fft.size );
+    for( int k = 0; k < n; k++ )
+    {
+        int at[2] = { k, (fft.size - k) % fft.size };
+        for( int s = 0; s < 2; s++ )
+        {
+            fft.filter[2*at[s]] = fft.chirp[2*k];
+            fft.filter[2*at[s] + 1] = fft.chirp[2*k + 1];
+        }
+    }
+    fft_radix2( fft, fft.filter, false );
+}
+
+inline void free_fft( fft_t &fft )
+{
+    free_aligned( fft.twiddle );
+    free_aligned( fft.chirp );
+    free_aligned( fft.filter );
+}
+
+//
+//  Forward FFT of fft.n points of x in place; work holds 2*fft.size
+//  doubles
+//
+inline void fft_forward( const fft_t &fft, double *x, double *work )
+{
+    if( fft.size == fft.n )
+    {
+        fft_radix2( fft, x, false );
+        return;
+    }
+    const int n = fft.n;
+    const double *w = fft.chirp;
+    for( int k = 0; k < n; k++ )
+    {
+        work[2*k] = x[2*k]*w[2*k] + x[2*k + 1]*w[2*k + 1];
+        work[2*k + 1] = x[2*k + 1]*w[2*k] - x[2*k]*w[2*k + 1];
+    }
+    for( int k = 2*n; k < 2*fft.size; k++ )
+        work[k] = 0;
+    fft_radix2( fft, work, false );
+    for( int k = 0; k < fft.size; k++ )
+    {
+        double re = work[2*k]*fft.filter[2*k] - work[2*k + 1]*fft.filter[2*k + 1];
+        double im = work[2*k]*fft.filter[2*k + 1] + work[2*k + 1]*fft.filter[2*k];
+        work[2*k] = re;
+        work[2*k + 1] = im;
+    }
+    fft_radix2( fft, work, true );
+    const double scale = 1.0 / fft.size;
+    for( int k = 0; k < n; k++ )
+    {
+        x[2*k] = scale * (work[2*k]*w[2*k] + work[2*k + 1]*w[2*k + 1]);
+        x[2*k + 1] = scale * (work[2*k + 1]*w[2*k] - work[2*k]*w[2*k + 1]);
+    }
+}
+
+struct dst_t
+{
+    int m;
+    fft_t fft;
+#ifdef HEAT_FFTW
+    fftw_plan plan;
+#endif
+};
+
+inline void init_dst( dst_t &dst, int m )
+{
+    dst.m = m;
+#ifdef HEAT_FFTW
+    // lines start anywhere in a buffer, so the plan must not count on
+    // their alignment
+    double *line = (double *) fftw_malloc( m * sizeof(double) );
+    dst.plan = fftw_plan_r2r_1d( m, line, line, FFTW_RODFT00, FFTW_ESTIMATE | FFTW_UNALIGNED );
+    fftw_free( line );
+#else
+    init_fft( dst.fft, 2 * (m+1) );
+#endif
+}
+
+inline void free_dst( dst_t &dst )
+{
+#ifdef HEAT_FFTW
+    fftw_destroy_plan( dst.plan );
+#else
+    free_fft( dst.fft );
+#endif
+}
+
+inline int dst_work( const dst_t &dst )
+{
+#ifdef HEAT_FFTW
+    return 0;
+#else
+    return 2 * (dst.fft.n + dst.fft.size);
+#endif
+}
+
+//
+//  Transform the lines a and, unless it is NULL, b in place
+//
+inline void dst_lines( const dst_t &dst, double *a, double *b, double *work )
+{
+#ifdef HEAT_FFTW
+    fftw_execute_r2r( dst.plan, a, a );
+    if( b )
+        fftw_execute_r2r( dst.plan, b, b );
+#else
+    const int m = dst.m;
+    const int N = dst.fft.n;
+    double *y = work;
+    y[0] = y[1] = 0;
+    y[2*(m+1)] = y[2*(m+1) + 1] = 0;
+    for( int k = 1; k <= m; k++ )
+    {
+        y[2*k] = a[k-1];
+        y[2*k + 1] = b ? b[k-1] : 0;
+        y[2*(N-k)] = -y[2*k];
+        y[2*(N-k) + 1] = -y[2*k + 1];
+    }
+    fft_forward( dst.fft, y, &work[2*N] );
+    for( int p = 1; p <= m; p++ )
+    {
+        a[p-1] = -y[2*p + 1];
+        if( b )
+            b[p-1] = y[2*p];
+    }
+#endif
+}
+
+#endif
@@ -0,0 +1,852 @@
+#ifndef __HEAT_GRAPH_H__
+#define __HEAT_GRAPH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <float.h>
+#include "mesh.h"
+#include "converge.h"
+#include "implicit.h"
+
+//
+//  unstructured meshes as CSR graph Laplacians
+//  Node i exchanges heat with each of its neighbours j through an edge
+//  of weight w_ij, and holds heat in proportion to its mass m_i, so
+//
+//      dT_i/dt = 1/m_i sum over j of w_ij (T_j - T_i)
+//
+//  and an explicit step of length dt is one SpMV per node. Both
+//  directions of every edge are stored, the edges of node i at
+//  start[i] up to start[i+1] in increasing order of their other end;
+//  fixed nodes keep their temperature. With unit weights and masses on
+//  the nodes of a mesh, dt = 1/4 averages the neighbours as step_rows( )
+//  does, and init_graph( ) builds that graph from a 2D mesh set up by
+//  the scenario, its ghosts folded into half weights on the nodes they
+//  mirror. A scenario that reads its own mesh calls alloc_graph( ), sets
+//  the nodes and then calls connect_graph( ) with the edge list.
+//
+//  How fast a step runs depends on how far apart in memory the ends of
+//  an edge lie: rcm_order( ) (reverse Cuthill-McKee) and curve_order( )
+//  (along a Hilbert curve through the positions) number the nodes so
+//  that neighbours are close, and reorder_graph( ) applies either. The
+//  bandwidth left, the largest difference of the ends of an edge, also
+//  bounds the halo a process owning a range of nodes reads.
+//
+//  The routines work on nodes [begin, end), so threads and processes
+//  can each take a range; graph_solve( ) finds the steady state by
+//  conjugate gradients, with the Comm policy and the orphaned omp for
+//  loops of implicit.h.
+//
+const int GRAPH_CHUNK = 256;    // nodes per partial sum of a dot product
+
+template <typename real>
+struct graph_t
+{
+    typedef real real_t;
+
+    int nnodes;
+    int nedges;         // stored, so twice the undirected ones
+    int *start;
+    int *col;
+    double *weight;
+    double *degree;     // the sum of the weights of each node
+    double *mass;
+    double *scale;      // dt / mass, 0 at fixed nodes
+    unsigned char *flags;   // FIXED or 0
+    double *x;          // position, for curve_order( ) and the output
+    double *y;
+    int *id;            // the number of each node when the graph was set up
+    double dt;
+    real *T;
+    real *T_next;
+};
+
+//
+//  A graph of count nodes, unconnected, all of mass 1 and free, at the
+//  origin and numbered in order
+//
+template <typename real>
+void alloc_graph( graph_t<real> &g, int count )
+{
+    g.nnodes = count;
+    g.nedges = 0;
+    g.start = alloc_aligned<int>( count + 1 );
+    g.col = NULL;
+    g.weight = NULL;
+    g.degree = alloc_aligned<double>( count );
+    g.mass = alloc_aligned<double>( count );
+    g.scale = alloc_aligned<double>( count );
+    g.flags = alloc_aligned<unsigned char>( count );
+    g.x = alloc_aligned<double>( count );
+    g.y = alloc_aligned<double>( count );
+    g.id = alloc_aligned<int>( count );
+    g.T = alloc_aligned<real>( count );
+    g.T_next = alloc_aligned<real>( count );
+    g.dt = 0;
+    for( int i = 0; i < count; i++ )
+    {
+        g.start[i] = 0;
+        g.degree[i] = g.scale[i] = 0;
+        g.mass[i] = 1;
+        g.flags[i] = 0;
+        g.x[i] = g.y[i] = 0;
+        g.id[i] = i;
+        g.T[i] = g.T_next[i] = 0;
+    }
+    g.start[count] = 0;
+}
+
+template <typename real>
+void free_graph( graph_t<real> &g )
+{
+    free_aligned( g.start );
+    free_aligned( g.col );
+    free_aligned( g.weight );
+    free_aligned( g.degree );
+    free_aligned( g.mass );
+    free_aligned( g.scale );
+    free_aligned( g.flags );
+    free_aligned( g.x );
+    free_aligned( g.y );
+    free_aligned( g.id );
+    free_aligned( g.T );
+    free_aligned( g.T_next );
+}
+
+template <typename real>
+void swap_graph( graph_t<real> &g )
+{
+    real *tmp = g.T;
+    g.T = g.T_next;
+    g.T_next = tmp;
+}
+
+//
+//  Sort the edges of every node by their other end, adding up the
+//  weights of repeated edges, and total the degrees
+//
+template <typename real>
+void sort_edges( graph_t<real> &g )
+{
+    int kept = 0;
+    for( int i = 0; i < g.nnodes; i++ )
+    {
+        const int first = g.start[i], last = g.start[i+1];
+        g.start[i] = kept;
+        for( int e = first + 1; e < last; e++ )
+        {
+            int c = g.col[e];
+            double w = g.weight[e];
+            int k = e;
+            for( ; k > first && g.col[k-1] > c; k-- )
+            {
+                g.col[k] = g.col[k-1];
+                g.weight[k] = g.weight[k-1];
+            }
+            g.col[k] = c;
+            g.weight[k] = w;
+        }
+        g.degree[i] = 0;
+        for( int e = first; e < last; e++ )
+        {
+            g.degree[i] += g.weight[e];
+            if( kept > g.start[i] && g.col[kept-1] == g.col[e] )
+                g.weight[kept-1] += g.weight[e];
+            else
+            {
+                g.col[kept] = g.col[e];
+                g.weight[kept++] = g.weight[e];
+            }
+        }
+    }
+    g.start[g.nnodes] = kept;
+    g.nedges = kept;
+}
+
+//
+//  Connect the nodes by the count edges (ends[2k], ends[2k+1]) of
+//  weight w[k]; edges from a node to itself carry no heat and are
+//  dropped
+//
+template <typename real>
+void connect_graph( graph_t<real> &g, int count, const int *ends, const double *w )
+{
+    for( int i = 0; i <= g.nnodes; i++ )
+        g.start[i] = 0;
+    for( int k = 0; k < count; k++ )
+        if( ends[2*k] != ends[2*k + 1] )
+        {
+            g.start[ends[2*k] + 1]++;
+            g.start[ends[2*k + 1] + 1]++;
+        }
+    for( int i = 0; i < g.nnodes; i++ )
+        g.start[i+1] += g.start[i];
+
+    free_aligned( g.col );
+    free_aligned( g.weight );
+    g.col = alloc_aligned<int>( g.start[g.nnodes] );
+    g.weight = alloc_aligned<double>( g.start[g.nnodes] );
+    for( int k = 0; k < count; k++ )
+    {
+        const int a = ends[2*k], b = ends[2*k + 1];
+        if( a == b )
+            continue;
+        g.col[g.start[a]] = b;
+        g.weight[g.start[a]++] = w[k];
+        g.col[g.start[b]] = a;
+        g.weight[g.start[b]++] = w[k];
+    }
+    for( int i = g.nnodes; i > 0; i-- )
+        g.start[i] = g.start[i-1];
+    g.start[0] = 0;
+    sort_edges( g );
+}
+
+//
+//  Set the step length, or the longest stable one if dt <= 0
+//
+template <typename real>
+void graph_time_step( graph_t<real> &g, double dt )
+{
+    if( dt <= 0 )
+    {
+        dt = INFINITY;
+        for( int i = 0; i < g.nnodes; i++ )
+            if( !(g.flags[i] & FIXED) && g.degree[i] > 0 )
+                dt = fmin( dt, g.mass[i] / g.degree[i] );
+        if( isinf( dt ) )
+            dt = 1;
+    }
+    g.dt = dt;
+    for( int i = 0; i < g.nnodes; i++ )
+        g.scale[i] = g.flags[i] & FIXED ? 0 : dt / g.mass[i];
+}
+
+//
+//  The updated and fixed nodes of a 2D mesh, and the nodes holding a
+//  temperature next to them, as a graph with unit weights and masses
+//  and the step length of the mesh; a ghost becomes edges of half a
+//  weight between the nodes it mirrors. Node (i, j) of the mesh lies
+//  at (j h, i h).
+//
+template <class Mesh>
+void init_graph( graph_t<typename Mesh::real_t> &g, const Mesh &grid )
+{
+    assert( Mesh::dim == 2 );
+    const int ld = grid.ld;
+    const int offsets[4] = { -ld, ld, -1, 1 };
+
+    int *ghost_of = (int *) malloc( grid.size * sizeof(int) );
+    for( int idx = 0; idx < grid.size; idx++ )
+        ghost_of[idx] = -1;
+    for( int k = 0; k < grid.nghosts; k++ )
+        ghost_of[grid.ghosts[3*k]] = k;
+
+    // the nodes: updated, fixed, or read by an updated node
+    int *node_of = (int *) malloc( grid.size * sizeof(int) );
+    for( int idx = 0; idx < grid.size; idx++ )
+        node_of[idx] = -1;
+    int count = 0;
+    for( int idx = 0; idx < grid.size; idx++ )
+    {
+        bool kept = is_updated( grid, idx ) || ((grid.flags[idx] & FIXED) && idx % ld <= grid.n);
+        for( int d = 0; d < 4 && !kept; d++ )
+        {
+            int nb = idx + offsets[d];
+            kept = nb >= 0 && nb < grid.size && is_updated( grid, nb ) && ghost_of[idx] < 0;
+        }
+        if( kept )
+            node_of[idx] = count++;
+    }
+
+    alloc_graph( g, count );
+    int nedges = 0, capacity = 4 * count;
+    int *ends = (int *) malloc( 2 * capacity * sizeof(int) );
+    double *w = (double *) malloc( capacity * sizeof(double) );
+    for( int idx = 0; idx < grid.size; idx++ )
+    {
+        const int i = node_of[idx];
+        if( i < 0 )
+            continue;
+        g.T[i] = g.T_next[i] = grid.T[idx];
+        g.flags[i] = is_updated( grid, idx ) ? 0 : FIXED;
+        g.x[i] = (idx % ld - 1) * grid.h;
+        g.y[i] = (idx / ld - 1) * grid.h;
+        if( !is_updated( grid, idx ) )
+            continue;
+
+        // a node it reads straight is connected once, from the lower
+        // index; a ghost it reads connects it to the nodes the ghost
+        // mirrors by a quarter weight from each node reading it, so the
+        // edges stay symmetric even where a third node reads the ghost
+        for( int d = 0; d < 4; d++ )
+        {
+            const int nb = idx + offsets[d];
+            int to[2] = { nb, -1 };
+            double weight = 1;
+            if( ghost_of[nb] >= 0 )
+            {
+                to[0] = grid.ghosts[3*ghost_of[nb] + 1];
+                to[1] = grid.ghosts[3*ghost_of[nb] + 2];
+                weight = 0.25;
+            }
+            else if( is_updated( grid, nb ) && nb < idx )
+                continue;
+            for( int s = 0; s < 2 && to[s] >= 0; s++ )
+            {
+                if( nedges == capacity )
+                {
+                    capacity *= 2;
+                    ends = (int *) realloc( ends, 2 * capacity * sizeof(int) );
+                    w = (double *) realloc( w, capacity * sizeof(double) );
+                }
+                ends[2*nedges] = i;
+                ends[2*nedges + 1] = node_of[to[s]];
+                w[nedges++] = weight;
+            }
+        }
+    }
+    connect_graph( g, nedges, ends, w );
+    graph_time_step( g, grid.r );
+
+    free( ends );
+    free( w );
+    free( node_of );
+    free( ghost_of );
+}
+
+//
+//  The largest difference of the ends of an edge
+//
+template <typename real>
+int graph_bandwidth( const graph_t<real> &g )
+{
+    int bw = 0;
+    for( int i = 0; i < g.nnodes; i++ )
+        if( g.start[i+1] > g.start[i] )
+            bw = max( bw, max( i - g.col[g.start[i]], g.col[g.start[i+1] - 1] - i ) );
+    return bw;
+}
+
+//
+//  The nodes [lo, hi) that the nodes [begin, end) or their edges reach
+//
+template <typename real>
+void graph_reach( const graph_t<real> &g, int begin, int end, int &lo, int &hi )
+{
+    lo = begin;
+    hi = end;
+    for( int i = begin; i < end; i++ )
+        if( g.start[i+1] > g.start[i] )
+        {
+            lo = min( lo, g.col[g.start[i]] );
+            hi = max( hi, g.col[g.start[i+1] - 1] + 1 );
+        }
+}
+
+//
+//  Breadth first search from seed over the nodes not yet placed, into
+//  queue; returns the number of levels, and sets the number of nodes
+//  reached and where the last level starts in queue
+//
+template <typename real>
+int graph_levels( const graph_t<real> &g, int seed, const unsigned char *placed, int *queue, int *mark, int stamp,
+                  int &reached, int &last )
+{
+    int head = 0, tail = 0, levels = 0;
+    queue[tail++] = seed;
+    mark[seed] = stamp;
+    while( head < tail )
+    {
+        const int level_end = tail;
+        last = head;
+        levels++;
+        for( ; head < level_end; head++ )
+        {
+            const int i = queue[head];
+            for( int e = g.start[i]; e < g.start[i+1]; e++ )
+                if( !placed[g.col[e]] && mark[g.col[e]] != stamp )
+                {
+                    mark[g.col[e]] = stamp;
+                    queue[tail++] = g.col[e];
+                }
+        }
+    }
+    reached = tail;
+    return levels;
+}
+
+//
+//  Reverse Cuthill-McKee: each connected piece is numbered level by level
+//  from a node at the far end of it, the neighbours of a node in order
+//  of their number of edges, and the whole numbering is reversed; the
+//  node to be numbered k is perm[k]
+//
+template <typename real>
+void rcm_order( const graph_t<real> &g, int *perm )
+{
+    const int n = g.nnodes;
+    unsigned char *placed = (unsigned char *) calloc( n, sizeof(unsigned char) );
+    int *mark = (int *) calloc( n, sizeof(int) );
+    int *queue = (int *) malloc( n * sizeof(int) );
+    int stamp = 0;
+
+    int count = 0;
+    for( int first = 0; first < n; first++ )
+    {
+        if( placed[first] )
+            continue;
+
+        // a node of few edges at the far end of the piece: search again
+        // from the far end while that makes the piece deeper
+        int seed = first, reached, last;
+        int depth = graph_levels( g, seed, placed, queue, mark, ++stamp, reached, last );
+        for( int tries = 0; tries < 8; tries++ )
+        {
+            int far = queue[last];
+            for( int k = last; k < reached; k++ )
+                if( g.start[queue[k]+1] - g.start[queue[k]] < g.start[far+1] - g.start[far] )
+                    far = queue[k];
+            int d = graph_levels( g, far, placed, queue, mark, ++stamp, reached, last );
+            if( d <= depth )
+                break;
+            depth = d;
+            seed = far;
+        }
+
+        // number the piece level by level
+        const int begin = count;
+        perm[count++] = seed;
+        placed[seed] = 1;
+        for( int head = begin; head < count; head++ )
+        {
+            const int i = perm[head];
+            const int from = count;
+            for( int e = g.start[i]; e < g.start[i+1]; e++ )
+                if( !placed[g.col[e]] )
+                {
+                    placed[g.col[e]] = 1;
+                    perm[count++] = g.col[e];
+                }
+            for( int k = from + 1; k < count; k++ )
+            {
+                const int v = perm[k];
+                const int edges = g.start[v+1] - g.start[v];
+                int m = k;
+                for( ; m > from && g.start[perm[m-1]+1] - g.start[perm[m-1]] > edges; m-- )
+                    perm[m] = perm[m-1];
+                perm[m] = v;
+            }
+        }
+    }
+    for( int k = 0; k < n/2; k++ )
+    {
+        int tmp = perm[k];
+        perm[k] = perm[n-1-k];
+        perm[n-1-k] = tmp;
+    }
+
+    free( placed );
+    free( mark );
+    free( queue );
+}
+
+//
+//  Distance along a Hilbert curve through a 2^16 by 2^16 square of the
+//  cell (cx, cy)
+//
+inline uint32_t hilbert_distance( uint32_t cx, uint32_t cy )
+{
+    uint32_t d = 0;
+    for( uint32_t s = 1u << 15; s > 0; s >>= 1 )
+    {
+        uint32_t rx = (cx & s) > 0;
+        uint32_t ry = (cy & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if( ry == 0 )
+        {
+            if( rx == 1 )
+            {
+                cx = s - 1 - cx;
+                cy = s - 1 - cy;
+            }
+            uint32_t t = cx;
+            cx = cy;
+            cy = t;
+        }
+    }
+    return d;
+}
+
+//
+//  The nodes in the order a Hilbert curve through their bounding box
+//  passes them, as perm for rcm_order( )
+//
+template <typename real>
+void curve_order( const graph_t<real> &g, int *perm )
+{
+    const int n = g.nnodes;
+    double xlo = INFINITY, xhi = -INFINITY, ylo = INFINITY, yhi = -INFINITY;
+    for( int i = 0; i < n; i++ )
+    {
+        xlo = fmin( xlo, g.x[i] );
+        xhi = fmax( xhi, g.x[i] );
+        ylo = fmin( ylo, g.y[i] );
+        yhi = fmax( yhi, g.y[i] );
+    }
+    const double span = fmax( fmax( xhi - xlo, yhi - ylo ), DBL_MIN );
+    const double cells = 65535 / span;
+
+    unsigned long long *key = (unsigned long long *) malloc( n * sizeof(unsigned long long) );
+    for( int i = 0; i < n; i++ )
+    {
+        uint32_t cx = (uint32_t) ((g.x[i] - xlo) * cells);
+        uint32_t cy = (uint32_t) ((g.y[i] - ylo) * cells);
+        key[i] = (unsigned long long) hilbert_distance( cx, cy ) << 32 | (uint32_t) i;
+    }
+    qsort( key, n, sizeof(unsigned long long), compare_keys );
+    for( int k = 0; k < n; k++ )
+        perm[k] = (int) (key[k] & 0xffffffffu);
+    free( key );
+}
+
+template <typename value>
+void permute_nodes( value *&v, const int *perm, int n )
+{
+    value *moved = alloc_aligned<value>( n );
+    for( int k = 0; k < n; k++ )
+        moved[k] = v[perm[k]];
+    free_aligned( v );
+    v = moved;
+}
+
+//
+//  Renumber the nodes so that node perm[k] becomes node k
+//
+template <typename real>
+void reorder_graph( graph_t<real> &g, const int *perm )
+{
+    const int n = g.nnodes;
+    int *number = (int *) malloc( n * sizeof(int) );
+    for( int k = 0; k < n; k++ )
+        number[perm[k]] = k;
+
+    int *start = alloc_aligned<int>( n + 1 );
+    int *col = alloc_aligned<int>( g.nedges );
+    double *weight = alloc_aligned<double>( g.nedges );
+    start[0] = 0;
+    for( int k = 0; k < n; k++ )
+    {
+        const int i = perm[k];
+        int e = start[k];
+        for( int f = g.start[i]; f < g.start[i+1]; f++, e++ )
+        {
+            col[e] = number[g.col[f]];
+            weight[e] = g.weight[f];
+        }
+        start[k+1] = e;
+    }
+    free_aligned( g.start );
+    free_aligned( g.col );
+    free_aligned( g.weight );
+    g.start = start;
+    g.col = col;
+    g.weight = weight;
+
+    permute_nodes( g.mass, perm, n );
+    permute_nodes( g.scale, perm, n );
+    permute_nodes( g.flags, perm, n );
+    permute_nodes( g.x, perm, n );
+    permute_nodes( g.y, perm, n );
+    permute_nodes( g.id, perm, n );
+    permute_nodes( g.T, perm, n );
+    permute_nodes( g.T_next, perm, n );
+    sort_edges( g );
+    free( number );
+}
+
+template <typename acc, typename real>
+inline __attribute__((always_inline))
+void step_graph_any( const graph_t<real> &g, int begin, int end )
+{
+    const int * __restrict__ start = g.start;
+    const int * __restrict__ col = g.col;
+    const double * __restrict__ weight = g.weight;
+    const double * __restrict__ scale = g.scale;
+    const double * __restrict__ degree = g.degree;
+    const real * __restrict__ T = g.T;
+    real * __restrict__ T_next = g.T_next;
+    for( int i = begin; i < end; i++ )
+    {
+        acc sum = 0;
+        for( int e = start[i]; e < start[i+1]; e++ )
+            sum += (acc) weight[e] * T[col[e]];
+        T_next[i] = (real) (T[i] + (acc) scale[i] * (sum - (acc) degree[i] * T[i]));
+    }
+}
+
+template <typename acc, class Graph>
+void step_graph_scalar( const Graph &g, int begin, int end )
+{
+    step_graph_any<acc>( g, begin, end );
+}
+
+template <typename acc, class Graph>
+__attribute__((target("avx2,fma")))
+void step_graph_avx2( const Graph &g, int begin, int end )
+{
+    step_graph_any<acc>( g, begin, end );
+}
+
+template <typename acc, class Graph>
+__attribute__((target("avx512f")))
+void step_graph_avx512( const Graph &g, int begin, int end )
+{
+    step_graph_any<acc>( g, begin, end );
+}
+
+//
+//  hot kernel: advance nodes [begin, end) by one step of g.dt, reading
+//  g.T and writing g.T_next
+//
+template <class Graph>
+inline void step_graph( const Graph &g, int begin, int end )
+{
+    typedef typename Graph::real_t acc;
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        step_graph_avx512<acc>( g, begin, end );
+        break;
+    case KERNEL_AVX2:
+        step_graph_avx2<acc>( g, begin, end );
+        break;
+    default:
+        step_graph_scalar<acc>( g, begin, end );
+    }
+}
+
+//
+//  The change of the last step over the free nodes of [begin, end), as
+//  change_rows( ) for the mesh
+//
+template <typename real>
+void change_graph( const graph_t<real> &g, int begin, int end, double &largest, double &sq )
+{
+    double m = largest, s = sq;
+    for( int i = begin; i < end; i++ )
+    {
+        double d = (double) g.T[i] - g.T_next[i];
+        m = fmax( m, fabs( d ) );
+        s += d * d;
+    }
+    largest = m;
+    sq = s;
+}
+
+template <typename real>
+bool check_step( converge_t &conv, const graph_t<real> &g, int step )
+{
+    if( !check_due( conv, step ) )
+        return false;
+    double largest = 0, sq = 0;
+    change_graph( g, 0, g.nnodes, largest, sq );
+    end_check( conv, step, largest, sq );
+    return converged( conv );
+}
+
+//
+//  steady state by conjugate gradients
+//  The free nodes solve sum over j of w_ij (T_j - T_i) = 0, for the
+//  change e of T, preconditioned by the degrees; e is zero at fixed
+//  nodes. Dot products are summed in chunks of GRAPH_CHUNK nodes and the
+//  chunks in order, so a run gives the same result on any number of
+//  threads. The iteration stops once the residual has shrunk by tol.
+//
+struct graph_cg_t
+{
+    double tol;
+    int iterations;     // of the last solve
+    double *e;
+    double *res;
+    double *z;
+    double *p;
+    double *q;
+    double *inv_degree; // 0 at fixed nodes
+    double *partial;    // two per chunk terms of dot products
+    double dot[2];
+};
+
+template <typename real>
+void init_graph_cg( graph_cg_t &cg, const graph_t<real> &g, double tol )
+{
+    const int n = g.nnodes;
+    cg.tol = tol > 0 ? tol : 1e-8;
+    cg.iterations = 0;
+    cg.e = alloc_aligned<double>( n );
+    cg.res = alloc_aligned<double>( n );
+    cg.z = alloc_aligned<double>( n );
+    cg.p = alloc_aligned<double>( n );
+    cg.q = alloc_aligned<double>( n );
+    cg.inv_degree = alloc_aligned<double>( n );
+    cg.partial = alloc_aligned<double>( 2 * (n / GRAPH_CHUNK + 1) );
+    for( int i = 0; i < n; i++ )
+    {
+        cg.inv_degree[i] = (g.flags[i] & FIXED) || g.degree[i] <= 0 ? 0 : 1 / g.degree[i];
+        cg.e[i] = cg.p[i] = 0;
+    }
+}
+
+inline void free_graph_cg( graph_cg_t &cg )
+{
+    free_aligned( cg.e );
+    free_aligned( cg.res );
+    free_aligned( cg.z );
+    free_aligned( cg.p );
+    free_aligned( cg.q );
+    free_aligned( cg.inv_degree );
+    free_aligned( cg.partial );
+}
+
+//
+//  Add up the partial terms of the chunks of [begin, end) into cg.dot,
+//  over every thread and process
+//
+template <class Comm>
+void graph_reduce( graph_cg_t &cg, int begin, int end, const Comm &comm )
+{
+    #pragma omp single
+    {
+      double sum[2] = { 0, 0 };
+      for( int c = begin / GRAPH_CHUNK; c * GRAPH_CHUNK < end; c++ )
+      {
+          sum[0] += cg.partial[2*c];
+          sum[1] += cg.partial[2*c + 1];
+      }
+      comm.sum( sum, 2 );
+      cg.dot[0] = sum[0];
+      cg.dot[1] = sum[1];
+    }
+}
+
+//
+//  z = res / degree over nodes [lo, hi) of chunk c, returning res.z and
+//  res.res in its partial terms
+//
+inline void graph_precondition( graph_cg_t &cg, int c, int lo, int hi )
+{
+    double rz = 0, rr = 0;
+    for( int i = lo; i < hi; i++ )
+    {
+        cg.z[i] = cg.inv_degree[i] * cg.res[i];
+        rz += cg.res[i] * cg.z[i];
+        rr += cg.res[i] * cg.res[i];
+    }
+    cg.partial[2*c] = rz;
+    cg.partial[2*c + 1] = rr;
+}
+
+//
+//  Replace the free nodes of [begin, end) of g.T by the steady state, in
+//  at most CG_MAX_ITERATIONS iterations; g.T must be current on the
+//  nodes the range reaches, and is again afterwards
+//
+template <typename real, class Comm>
+void graph_solve( graph_t<real> &g, graph_cg_t &cg, int begin, int end, const Comm &comm )
+{
+    const int * __restrict__ start = g.start;
+    const int * __restrict__ col = g.col;
+    const double * __restrict__ weight = g.weight;
+    const int cbegin = begin / GRAPH_CHUNK;
+    const int cend = (end + GRAPH_CHUNK - 1) / GRAPH_CHUNK;
+
+    // residual of e = 0
+    #pragma omp for
+    for( int c = cbegin; c < cend; c++ )
+    {
+        const int lo = max( begin, c * GRAPH_CHUNK ), hi = min( end, (c+1) * GRAPH_CHUNK );
+        for( int i = lo; i < hi; i++ )
+        {
+            double sum = 0;
+            for( int e = start[i]; e < start[i+1]; e++ )
+                sum += weight[e] * g.T[col[e]];
+            cg.e[i] = 0;
+            cg.res[i] = cg.inv_degree[i] > 0 ? sum - g.degree[i] * g.T[i] : 0;
+        }
+        graph_precondition( cg, c, lo, hi );
+        for( int i = lo; i < hi; i++ )
+            cg.p[i] = cg.z[i];
+    }
+    graph_reduce( cg, begin, end, comm );
+    double rz = cg.dot[0];
+    double rr = cg.dot[1];
+    double stop = cg.tol * cg.tol * rr;
+
+    int it = 0;
+    while( rr > stop && it < CG_MAX_ITERATIONS )
+    {
+        #pragma omp single
+        comm.exchange( cg.p );
+
+        // q = L p on the free nodes
+        #pragma omp for
+        for( int c = cbegin; c < cend; c++ )
+        {
+            const int lo = max( begin, c * GRAPH_CHUNK ), hi = min( end, (c+1) * GRAPH_CHUNK );
+            double pq = 0;
+            for( int i = lo; i < hi; i++ )
+            {
+                double sum = 0;
+                for( int e = start[i]; e < start[i+1]; e++ )
+                    sum += weight[e] * cg.p[col[e]];
+                cg.q[i] = cg.inv_degree[i] > 0 ? g.degree[i] * cg.p[i] - sum : 0;
+                pq += cg.p[i] * cg.q[i];
+            }
+            cg.partial[2*c] = pq;
+            cg.partial[2*c + 1] = 0;
+        }
+        graph_reduce( cg, begin, end, comm );
+        double alpha = rz / cg.dot[0];
+
+        #pragma omp for
+        for( int c = cbegin; c < cend; c++ )
+        {
+            const int lo = max( begin, c * GRAPH_CHUNK ), hi = min( end, (c+1) * GRAPH_CHUNK );
+            for( int i = lo; i < hi; i++ )
+            {
+                cg.e[i] += alpha * cg.p[i];
+                cg.res[i] -= alpha * cg.q[i];
+            }
+            graph_precondition( cg, c, lo, hi );
+        }
+        graph_reduce( cg, begin, end, comm );
+        double beta = cg.dot[0] / rz;
+        rz = cg.dot[0];
+        rr = cg.dot[1];
+
+        #pragma omp for
+        for( int c = cbegin; c < cend; c++ )
+        {
+            const int lo = max( begin, c * GRAPH_CHUNK ), hi = min( end, (c+1) * GRAPH_CHUNK );
+            for( int i = lo; i < hi; i++ )
+                cg.p[i] = cg.z[i] + beta * cg.p[i];
+        }
+        it++;
+    }
+
+    #pragma omp for
+    for( int c = cbegin; c < cend; c++ )
+    {
+        const int lo = max( begin, c * GRAPH_CHUNK ), hi = min( end, (c+1) * GRAPH_CHUNK );
+        for( int i = lo; i < hi; i++ )
+            g.T[i] = g.T_next[i] = (real) (g.T[i] + cg.e[i]);
+    }
+    #pragma omp single
+    {
+      comm.exchange( g.T );
+      comm.exchange( g.T_next );
+      cg.iterations = it;
+    }
+}
+
+#endif
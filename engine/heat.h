@@ -0,0 +1,60 @@
+#ifndef __HEAT_H__
+#define __HEAT_H__
+
+//
+//  heat equation engine, shared by every scenario
+//
+//  A scenario picks a mesh_t< DIM, real, boundary, source > with DIM of
+//  1, 2 or 3, temperatures stored as double or float, a dirichlet or
+//  insulated boundary and no_source or point_sources. Its init_bar( )
+//  sets the temperatures and flags of the nodes (and the sources) and ends
+//  with init_boundary( ); its save( ) writes the field out. The drivers
+//  then advance the mesh with step_rows( ) or step_nodes( ), swap_grid( )
+//  and fill_ghosts( ), or with step_blocked( ) / step_tile( ) for
+//  spatial and temporal blocking; tiles.h schedules the tiles over an
+//  OpenMP team. For the steady state alone, relax_sweep( ) or
+//  relax_rows( ) run red-black SOR in place until converged( ), and on
+//  a 2D box with fixed edges mg_solve_cycle( ) runs multigrid cycles,
+//  and spectral_solve( ) jumps straight to the steady state or to the
+//  field at any time by sine transforms (fft.h).
+//  implicit_step( ) takes backward Euler or Crank-Nicolson steps of any
+//  length instead of explicit ones, and on a 2D mesh adi_step( ) takes
+//  ADI steps of any length by batched tridiagonal solves. check_step( ),
+//  or change_rows( ) and end_check( ) where the check is reduced over
+//  threads or processes (mpi_converge.h pipelines that for the MPI
+//  drivers), stop the time stepping early once the field has stopped
+//  changing. A step averages the neighbours unless grid.r is set lower;
+//  timestep.h picks grid.r for steps of a physical length, fixed or
+//  adapted to the transient. On a 2D shape with large holes,
+//  init_sparse( ) moves the field into block-sparse tiles that skip the
+//  holes, advanced by step_sparse( ), swap_sparse( ) and
+//  fill_sparse_ghosts( ). graph.h runs the same explicit steps, and
+//  conjugate gradients for the steady state, on unstructured meshes
+//  held as CSR graph Laplacians, read by the scenario or built from a
+//  mesh by init_graph( ) and renumbered for locality. init_morton( )
+//  moves a 2D field into tiles stored along a Z curve, advanced by
+//  step_morton( ), swap_morton( ) and fill_morton_ghosts( ), with
+//  morton_offset( ) to find node (i, j) for saves and halos.
+//  init_amr( ) moves a 2D field into quadtree leaves, fine only where
+//  the field is steep or heated, advanced by step_amr( ),
+//  step_amr_sources( ) and swap_amr( ) and adapted by regrid_amr( ).
+//
+//  Everything here is a template or inline, so there is nothing to link.
+//
+
+#include "util.h"
+#include "mesh.h"
+#include "stencil.h"
+#include "relax.h"
+#include "multigrid.h"
+#include "implicit.h"
+#include "adi.h"
+#include "spectral.h"
+#include "converge.h"
+#include "timestep.h"
+#include "sparse.h"
+#include "graph.h"
+#include "morton.h"
+#include "amr.h"
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef __HEAT_IMPLICIT_H__
+#define __HEAT_IMPLICIT_H__
+
+#include <math.h>
+#include "stencil.h"
+
+//
+//  implicit time stepping
+//
+//  With L T = 2*DIM T - (sum of the neighbours) and f the source term,
+//  the explicit update of stencil.h is the step dT = r (f - L T) with a
+//  diffusion number r = alpha dt / h^2 of 1 / (2*DIM). The theta scheme
+//
+//      (1 + theta r L) T' = (1 - (1-theta) r L) T + r f
+//
+//  is stable for any r when theta >= 1/2: theta = 1 is backward Euler,
+//  theta = 1/2 Crank-Nicolson. Each step solves for the change
+//  e = T' - T, (1 + theta r L) e = r (f - L T), by conjugate gradients
+//  preconditioned by the diagonal, without ever forming the matrix: the
+//  operator is applied with the stencil, e is zero at fixed nodes and
+//  its ghosts mirror it as the temperatures' do. The iteration stops
+//  once the residual has shrunk by tol.
+//
+//  The routines work on the updated nodes of rows [rbegin, rend) and
+//  leave communication to a Comm policy: comm.sum( x, count ) adds the
+//  count values of x up over every process, in place, and
+//  comm.exchange( v ) refreshes the rows of v that border
+//  [rbegin, rend) from the processes that own them; local_comm does
+//  neither. Their loops are orphaned omp for constructs, as in
+//  multigrid.h, and dot products are summed row by row in order, so a
+//  run gives the same result on any number of threads. The dot products
+//  are taken in the passes that produce their operands, and reduced in
+//  pairs.
+//
+struct local_comm
+{
+  void sum( double * /* x */, int /* count */ ) const { }
+  template <typename value> void exchange( value * /* v */ ) const { }
+};
+
+const int CG_MAX_ITERATIONS = 1000;
+
+struct implicit_t
+{
+    double r;
+    double theta;
+    double tol;
+    int iterations;     // of the last step
+    double *e;
+    double *res;
+    double *z;
+    double *p;
+    double *q;
+    double *inv_diag;
+    double *partial;    // two per row terms of dot products
+    double dot[2];
+};
+
+template <class Mesh>
+void init_implicit( implicit_t &imp, const Mesh &grid, double r, double theta, double tol )
+{
+    // the solver sweeps whole spans, so they may not have gaps
+    for( int rr = 0; rr < grid.rows; rr++ )
+        assert( !grid.row_gaps[rr] );
+
+    imp.r = r;
+    imp.theta = theta;
+    imp.tol = tol > 0 ? tol : 1e-8;
+    imp.iterations = 0;
+    imp.e = alloc_aligned<double>( grid.size );
+    imp.res = alloc_aligned<double>( grid.size );
+    imp.z = alloc_aligned<double>( grid.size );
+    imp.p = alloc_aligned<double>( grid.size );
+    imp.q = alloc_aligned<double>( grid.size );
+    imp.partial = alloc_aligned<double>( 2 * grid.rows );
+
+    // a node's own ghosts take their weight off its diagonal
+    imp.inv_diag = alloc_aligned<double>( grid.size );
+    add_self_weights( grid, imp.inv_diag );
+    for( int idx = 0; idx < grid.size; idx++ )
+        imp.inv_diag[idx] = 1 / (1 + theta * r * (2*Mesh::dim - imp.inv_diag[idx]));
+}
+
+inline void free_implicit( implicit_t &imp )
+{
+    free_aligned( imp.e );
+    free_aligned( imp.res );
+    free_aligned( imp.z );
+    free_aligned( imp.p );
+    free_aligned( imp.q );
+    free_aligned( imp.inv_diag );
+    free_aligned( imp.partial );
+}
+
+//
+//  L v at node idx = row + j
+//
+template <class Mesh, typename value>
+inline double laplacian( const Mesh &grid, const value *v, int row, int j )
+{
+    return 2*Mesh::dim * (double) v[row + j] - neighbour_sum<double, Mesh::dim>( &v[row], j, grid.ld, grid.plane );
+}
+
+//
+//  Add up the two per row terms imp.partial[2r], imp.partial[2r+1] of
+//  rows [rbegin, rend) into imp.dot[0] and imp.dot[1], over every thread
+//  and process
+//
+template <class Comm>
+void implicit_reduce( implicit_t &imp, int rbegin, int rend, const Comm &comm )
+{
+    #pragma omp single
+    {
+      double sum[2] = { 0, 0 };
+      for( int r = rbegin; r < rend; r++ )
+      {
+          sum[0] += imp.partial[2*r];
+          sum[1] += imp.partial[2*r + 1];
+      }
+      comm.sum( sum, 2 );
+      imp.dot[0] = sum[0];
+      imp.dot[1] = sum[1];
+    }
+}
+
+//
+//  z = res / diag over row r, returning res.z and res.res in the
+//  partial terms of the row
+//
+template <class Mesh>
+inline void implicit_precondition( const Mesh &grid, implicit_t &imp, int r, int row )
+{
+    const double * __restrict__ res = &imp.res[row];
+    const double * __restrict__ inv_diag = &imp.inv_diag[row];
+    double * __restrict__ z = &imp.z[row];
+    double rz = 0, rr = 0;
+    for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+    {
+        z[j] = inv_diag[j] * res[j];
+        rz += res[j] * z[j];
+        rr += res[j] * res[j];
+    }
+    imp.partial[2*r] = rz;
+    imp.partial[2*r + 1] = rr;
+}
+
+//
+//  Advance grid.T by one step of the theta scheme
+//
+template <class Mesh, class Comm>
+void implicit_step( Mesh &grid, implicit_t &imp, int rbegin, int rend, const Comm &comm )
+{
+    const double a = imp.theta * imp.r;
+    const int ld = grid.ld;
+    const int plane = grid.plane;
+
+    // residual of e = 0
+    #pragma omp for
+    for( int r = rbegin; r < rend; r++ )
+    {
+        int row = row_index( grid, r );
+        double * __restrict__ e = &imp.e[row];
+        double * __restrict__ res = &imp.res[row];
+        for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+        {
+            e[j] = 0;
+            res[j] = imp.r * (grid.source.add( 0.0, row + j ) - laplacian( grid, grid.T, row, j ));
+        }
+        for( int k = first_point( grid.source, row + grid.row_begin[r] ); k < grid.source.points( ) && grid.source.point( k ) < row + grid.row_end[r]; k++ )
+            imp.res[grid.source.point( k )] += imp.r * grid.source.point_term( k );
+        implicit_precondition( grid, imp, r, row );
+        for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+            imp.p[row + j] = imp.z[row + j];
+    }
+    implicit_reduce( imp, rbegin, rend, comm );
+    double rz = imp.dot[0];
+    double rr = imp.dot[1];
+    double stop = imp.tol * imp.tol * rr;
+
+    int it = 0;
+    while( rr > stop && it < CG_MAX_ITERATIONS )
+    {
+        #pragma omp single
+        {
+          comm.exchange( imp.p );
+          fill_ghosts( grid, imp.p, rbegin, rend );
+        }
+
+        // q = (1 + theta r L) p
+        #pragma omp for
+        for( int r = rbegin; r < rend; r++ )
+        {
+            int row = row_index( grid, r );
+            const double * __restrict__ p = &imp.p[row];
+            double * __restrict__ q = &imp.q[row];
+            double pq = 0;
+            for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+            {
+                q[j] = p[j] + a * (2*Mesh::dim * p[j] - neighbour_sum<double, Mesh::dim>( p, j, ld, plane ));
+                pq += p[j] * q[j];
+            }
+            imp.partial[2*r] = pq;
+            imp.partial[2*r + 1] = 0;
+        }
+        implicit_reduce( imp, rbegin, rend, comm );
+        double alpha = rz / imp.dot[0];
+
+        #pragma omp for
+        for( int r = rbegin; r < rend; r++ )
+        {
+            int row = row_index( grid, r );
+            const double * __restrict__ p = &imp.p[row];
+            const double * __restrict__ q = &imp.q[row];
+            double * __restrict__ e = &imp.e[row];
+            double * __restrict__ res = &imp.res[row];
+            for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+            {
+                e[j] += alpha * p[j];
+                res[j] -= alpha * q[j];
+            }
+            implicit_precondition( grid, imp, r, row );
+        }
+        implicit_reduce( imp, rbegin, rend, comm );
+        double beta = imp.dot[0] / rz;
+        rz = imp.dot[0];
+        rr = imp.dot[1];
+
+        #pragma omp for
+        for( int r = rbegin; r < rend; r++ )
+        {
+            int row = row_index( grid, r );
+            const double * __restrict__ z = &imp.z[row];
+            double * __restrict__ p = &imp.p[row];
+            for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+                p[j] = z[j] + beta * p[j];
+        }
+        it++;
+    }
+
+    #pragma omp for
+    for( int r = rbegin; r < rend; r++ )
+    {
+        int row = row_index( grid, r );
+        for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+            grid.T[row + j] += imp.e[row + j];
+    }
+    #pragma omp single
+    {
+      comm.exchange( grid.T );
+      fill_ghosts( grid, rbegin, rend );
+      imp.iterations = it;
+    }
+}
+
+#endif
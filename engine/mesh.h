@@ -0,0 +1,447 @@
+#ifndef __HEAT_MESH_H__
+#define __HEAT_MESH_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "util.h"
+
+//
+// node flags
+// a node is updated unless it is fixed or a hole
+//
+const unsigned char FIXED = 1;
+const unsigned char HOLE  = 2;
+const unsigned char NOT_UPDATED = FIXED | HOLE;
+
+//
+// boundary policies: what a node that is not updated holds when it
+// borders an updated one. Under dirichlet it keeps the temperature it
+// was given. Under insulated it becomes a ghost holding the mean of its
+// updated neighbours, so no heat flows across that face; fixed nodes
+// keep their temperature either way.
+//
+struct dirichlet { static const bool ghosts = false; };
+struct insulated { static const bool ghosts = true; };
+
+//
+// source policies: a term added to the neighbour sum of every node by
+// add( ), and point sources, listed by points( ), point( k ) and
+// point_term( k ), whose terms a pass after the stencil adds to the
+// few nodes they sit on
+//
+struct no_source
+{
+  void alloc( int /* size */ ) { }
+  void release( ) { }
+  template <typename acc> acc add( acc sum, int /* idx */ ) const { return sum; }
+  int points( ) const { return 0; }
+  int point( int /* k */ ) const { return 0; }
+  double point_term( int /* k */ ) const { return 0; }
+};
+
+//
+// volumetric heat generation at a few nodes, in ascending order of
+// their index, each with its term qdot*h*h/k worked out once by
+// add_point( ); gain scales every term, so a schedule can switch or
+// ramp the sources between steps
+//
+struct point_sources
+{
+  int count;
+  int capacity;
+  int *node;
+  double *term;
+  double gain;
+  void alloc( int /* size */ ) { count = capacity = 0; node = NULL; term = NULL; gain = 1; }
+  void release( ) { free( node ); free( term ); }
+  template <typename acc> acc add( acc sum, int /* idx */ ) const { return sum; }
+  int points( ) const { return count; }
+  int point( int k ) const { return node[k]; }
+  double point_term( int k ) const { return gain * term[k]; }
+
+  void add_point( int idx, double t )
+  {
+    int k = count;
+    while( k > 0 && node[k-1] > idx )
+      k--;
+    if( k > 0 && node[k-1] == idx )
+    {
+      term[k-1] += t;
+      return;
+    }
+    if( count == capacity )
+    {
+      capacity = max( 2*capacity, 16 );
+      node = (int *) realloc( node, capacity * sizeof(int) );
+      term = (double *) realloc( term, capacity * sizeof(double) );
+    }
+    memmove( &node[k+1], &node[k], (count - k) * sizeof(int) );
+    memmove( &term[k+1], &term[k], (count - k) * sizeof(double) );
+    node[k] = idx;
+    term[k] = t;
+    count++;
+  }
+};
+
+//
+// first point source at or after node idx
+//
+template <class Source>
+inline int first_point( const Source &source, int idx )
+{
+  int lo = 0, hi = source.points( );
+  while( lo < hi )
+  {
+    int mid = (lo + hi) / 2;
+    if( source.point( mid ) < idx )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//
+// mesh data structure, a DIM-dimensional cube of n nodes a side
+// temperatures live in two contiguous buffers (current and next step)
+// that are swapped after every step; flags are kept apart from the
+// temperatures and positions are derived from the node index.
+//
+// Every buffer is padded with a one-node halo on each face, so the
+// stencil never needs a bounds check. The last axis is contiguous and
+// a line of nodes along it is a row: the only row in 1D, row i holds
+// nodes (i, *) in 2D and row i*n + j holds nodes (i, j, *) in 3D. Rows
+// are padded to ld, a multiple of 64 bytes, and the buffers are 64-byte
+// aligned, so a vector of nodes is equally aligned in every row. The
+// updated nodes of row r lie in [row_begin[r], row_end[r]); all other
+// nodes hold the boundary condition. Unless row_gaps[r] is set, every
+// node of that span is updated; otherwise fixed nodes or holes lie
+// between them too, and the kernels mask them out by their flags, so
+// a shape of any form runs through the same vector loops. The rows of a plane (fixed
+// i) are consecutive; 1D has one plane and 2D one row per plane.
+// Ghosts are (ghost, source, source) triples ordered by the last row
+// that feeds them; those fed last by row r are ghosts[ghost_start[r]]
+// up to ghosts[ghost_start[r+1]].
+//
+// Temperatures are stored as real, which is double or float. A step
+// has the diffusion number r = alpha dt / h^2; it defaults to the
+// largest stable one, 1 / (2*DIM), which turns a step into the mean of
+// the neighbours.
+//
+template <int DIM, typename real, typename Boundary, typename Source>
+struct mesh_t
+{
+  typedef real real_t;
+  static const int dim = DIM;
+
+  int n;
+  int ld;
+  int plane;
+  int size;
+  int rows;
+  int planes;
+  double h;
+  double r;
+  real *T;
+  real *T_next;
+  unsigned char *flags;
+  int *row_begin;
+  int *row_end;
+  unsigned char *row_gaps;
+  int nghosts;
+  int *ghosts;
+  int *ghost_start;
+  Source source;
+};
+
+template <typename real>
+inline int padded_len( int n ) { return (n + 2 + 64/sizeof(real) - 1) & ~(64/sizeof(real) - 1); }
+
+template <typename real, class B, class S>
+inline int node_index( const mesh_t<1, real, B, S> & /* grid */, int i ) { return i+1; }
+template <typename real, class B, class S>
+inline int node_index( const mesh_t<2, real, B, S> &grid, int i, int j ) { return (i+1)*grid.ld + j+1; }
+template <typename real, class B, class S>
+inline int node_index( const mesh_t<3, real, B, S> &grid, int i, int j, int l ) { return (i+1)*grid.plane + (j+1)*grid.ld + l+1; }
+
+//
+//  index of the first node of row r
+//
+template <int DIM, typename real, class B, class S>
+inline int row_index( const mesh_t<DIM, real, B, S> &grid, int r )
+{
+    if( DIM == 1 )
+        return 1;
+    if( DIM == 2 )
+        return (r+1)*grid.ld + 1;
+    return (r/grid.n + 1)*grid.plane + (r%grid.n + 1)*grid.ld + 1;
+}
+
+//
+//  row holding the node at idx, or -1 for the halo
+//
+template <int DIM, typename real, class B, class S>
+inline int row_of( const mesh_t<DIM, real, B, S> &grid, int idx )
+{
+    int n = grid.n;
+    if( DIM == 1 )
+        return 0;
+    if( DIM == 2 )
+    {
+        int i = idx / grid.ld - 1;
+        return i >= 0 && i < n ? i : -1;
+    }
+    int i = idx / grid.plane - 1;
+    int j = idx % grid.plane / grid.ld - 1;
+    return i >= 0 && i < n && j >= 0 && j < n ? i*n + j : -1;
+}
+
+template <int DIM, typename real, class B, class S>
+inline bool is_updated( const mesh_t<DIM, real, B, S> &grid, int idx )
+{
+    int r = row_of( grid, idx );
+    int j = idx % grid.ld - 1;
+    return r >= 0 && j >= grid.row_begin[r] && j < grid.row_end[r] && !(grid.flags[idx] & NOT_UPDATED);
+}
+
+//
+//  Zero the temperatures and flags in parallel, with the static split
+//  of rows (in 1D, of nodes) [0, n) that the omp for loops of the
+//  drivers use, so first touch places the pages a thread steps on its
+//  own NUMA node; the halo goes with the first and last rows. Built
+//  without OpenMP, it is a plain loop.
+//
+template <int DIM, typename real, class B, class S>
+void first_touch( mesh_t<DIM, real, B, S> &grid )
+{
+    const int n = grid.n;
+    const int len = DIM == 1 ? 1 : grid.size / (n+2);
+    #pragma omp parallel for schedule(static)
+    for( int i = 0; i < n; i++ )
+    {
+        int begin = i == 0 ? 0 : (i+1) * len;
+        int end = i == n-1 ? grid.size : (i+2) * len;
+        for( int k = begin; k < end; k++ )
+        {
+            grid.T[k] = 0;
+            grid.T_next[k] = 0;
+            grid.flags[k] = 0;
+        }
+    }
+}
+
+//
+//  Allocate the padded temperature buffers, flags and source
+//
+template <int DIM, typename real, class B, class S>
+void alloc_grid( mesh_t<DIM, real, B, S> &grid, int n )
+{
+    grid.n = n;
+    grid.ld = padded_len<real>( n );
+    grid.plane = (n+2) * grid.ld;
+    grid.size = grid.ld;
+    grid.rows = 1;
+    for( int d = 1; d < DIM; d++ )
+    {
+        grid.size *= n+2;
+        grid.rows *= n;
+    }
+    grid.planes = DIM == 1 ? 1 : n;
+    grid.r = 1.0 / (2*DIM);
+    grid.T = alloc_untouched<real>( grid.size );
+    grid.T_next = alloc_untouched<real>( grid.size );
+    grid.flags = alloc_untouched<unsigned char>( grid.size );
+    first_touch( grid );
+    grid.row_begin = (int *) malloc( grid.rows * sizeof(int) );
+    grid.row_end = (int *) malloc( grid.rows * sizeof(int) );
+    grid.row_gaps = (unsigned char *) calloc( grid.rows, sizeof(unsigned char) );
+    grid.nghosts = 0;
+    grid.ghosts = NULL;
+    grid.ghost_start = (int *) calloc( grid.rows + 1, sizeof(int) );
+    grid.source.alloc( grid.size );
+}
+
+template <int DIM, typename real, class B, class S>
+void free_grid( mesh_t<DIM, real, B, S> &grid )
+{
+    free_aligned( grid.T );
+    free_aligned( grid.T_next );
+    free_aligned( grid.flags );
+    free( grid.row_begin );
+    free( grid.row_end );
+    free( grid.row_gaps );
+    free( grid.ghosts );
+    free( grid.ghost_start );
+    grid.source.release( );
+}
+
+//
+//  Make the next step the current one
+//
+template <int DIM, typename real, class B, class S>
+void swap_grid( mesh_t<DIM, real, B, S> &grid )
+{
+    real *tmp = grid.T;
+    grid.T = grid.T_next;
+    grid.T_next = tmp;
+}
+
+//
+//  the last row a step writes a ghost in
+//
+template <int DIM, typename real, class B, class S>
+int last_row( const mesh_t<DIM, real, B, S> &grid, const int *ghost )
+{
+    int last = row_of( grid, max( ghost[1], ghost[2] ) );
+    int r = row_of( grid, ghost[0] );
+    int j = ghost[0] % grid.ld - 1;
+    if (r > last && grid.row_gaps[r] && j >= grid.row_begin[r] && j < grid.row_end[r])
+        last = r;
+    return last;
+}
+
+//
+//  Every node that is neither fixed nor updated but borders an updated
+//  node becomes a ghost holding the mean of (up to two of) its updated
+//  neighbours
+//
+template <int DIM, typename real, class B, class S>
+void find_ghosts( mesh_t<DIM, real, B, S> &grid )
+{
+    int n = grid.n;
+    int ld = grid.ld;
+    int offsets[6] = { -grid.plane, grid.plane, -ld, ld, -1, 1 };
+    const int *offset = &offsets[6 - 2*DIM];
+
+    int capacity = 2 * DIM * (grid.size / ld);
+    free( grid.ghosts );
+    grid.ghosts = (int *) malloc( 3 * capacity * sizeof(int) );
+    grid.nghosts = 0;
+    for (int idx = 0; idx < grid.size; idx++) {
+        if (idx % ld > n+1 || (grid.flags[idx] & FIXED) || is_updated( grid, idx ))
+            continue;
+        int nsrc = 0;
+        int src[6];
+        for (int d = 0; d < 2*DIM; d++) {
+            int nb = idx + offset[d];
+            if (nb >= 0 && nb < grid.size && is_updated( grid, nb ))
+                src[nsrc++] = nb;
+        }
+        if (nsrc == 0)
+            continue;
+        if (grid.nghosts == capacity) {
+            capacity *= 2;
+            grid.ghosts = (int *) realloc( grid.ghosts, 3 * capacity * sizeof(int) );
+        }
+        grid.ghosts[3*grid.nghosts] = idx;
+        grid.ghosts[3*grid.nghosts + 1] = src[0];
+        grid.ghosts[3*grid.nghosts + 2] = src[nsrc > 1 ? 1 : 0];
+        grid.nghosts++;
+    }
+
+    // order the ghosts by the last row feeding them, or by their own
+    // row if a step rewrites them there, in the gaps of its span
+    int *sorted = (int *) malloc( 3 * grid.nghosts * sizeof(int) );
+    for (int r = 0; r <= grid.rows; r++)
+        grid.ghost_start[r] = 0;
+    for (int g = 0; g < grid.nghosts; g++)
+        grid.ghost_start[last_row( grid, &grid.ghosts[3*g] ) + 1]++;
+    for (int r = 0; r < grid.rows; r++)
+        grid.ghost_start[r + 1] += grid.ghost_start[r];
+    for (int g = 0; g < grid.nghosts; g++) {
+        int last = last_row( grid, &grid.ghosts[3*g] );
+        memcpy( &sorted[3 * grid.ghost_start[last]++], &grid.ghosts[3*g], 3 * sizeof(int) );
+    }
+    for (int r = grid.rows; r > 0; r--)
+        grid.ghost_start[r] = grid.ghost_start[r - 1];
+    grid.ghost_start[0] = 0;
+    free( grid.ghosts );
+    grid.ghosts = sorted;
+}
+
+//
+//  Refresh the ghosts fed by updated nodes in rows [rbegin, rend), of
+//  the temperatures or of any other field v laid out like them
+//
+template <int DIM, typename real, class Boundary, class S, typename value>
+void fill_ghosts( const mesh_t<DIM, real, Boundary, S> &grid, value *v, int rbegin, int rend )
+{
+    if (!Boundary::ghosts || rbegin >= rend)
+        return;
+    int lo = row_index( grid, rbegin ) - 1;
+    int hi = row_index( grid, rend - 1 ) - 1 + grid.ld;
+    for (int g = 0; g < grid.nghosts; g++) {
+        int *ghost = &grid.ghosts[3*g];
+        if ((ghost[1] >= lo && ghost[1] < hi) || (ghost[2] >= lo && ghost[2] < hi))
+            v[ghost[0]] = 0.5 * (v[ghost[1]] + v[ghost[2]]);
+    }
+}
+
+template <int DIM, typename real, class Boundary, class S>
+void fill_ghosts( mesh_t<DIM, real, Boundary, S> &grid, int rbegin, int rend )
+{
+    fill_ghosts( grid, grid.T, rbegin, rend );
+}
+
+//
+//  Add to c[idx] the weight node idx has in the ghosts next to it, which
+//  hold (part of) its own temperature
+//
+template <int DIM, typename real, class B, class S>
+void add_self_weights( const mesh_t<DIM, real, B, S> &grid, double *c )
+{
+    for (int g = 0; g < grid.nghosts; g++) {
+        c[grid.ghosts[3*g + 1]] += 0.5;
+        c[grid.ghosts[3*g + 2]] += 0.5;
+    }
+}
+
+//
+//  Derive the updated span of every row and whether it has gaps, and
+//  the ghosts if the boundary policy has them, from the flags set by
+//  the scenario
+//
+template <int DIM, typename real, class Boundary, class S>
+void init_boundary( mesh_t<DIM, real, Boundary, S> &grid )
+{
+    for (int r = 0; r < grid.rows; r++) {
+        const unsigned char *flags = &grid.flags[row_index( grid, r )];
+        grid.row_begin[r] = 0;
+        grid.row_end[r] = 0;
+        grid.row_gaps[r] = 0;
+        for (int j = 0; j < grid.n; j++) {
+            if (flags[j] & NOT_UPDATED)
+                continue;
+            if (grid.row_end[r] == 0)
+                grid.row_begin[r] = j;
+            else if (grid.row_end[r] < j)
+                grid.row_gaps[r] = 1;
+            grid.row_end[r] = j+1;
+        }
+    }
+
+    if (Boundary::ghosts)
+        find_ghosts( grid );
+
+    // fixed nodes are never written, so both buffers must hold them
+    fill_ghosts( grid, 0, grid.rows );
+    memcpy( grid.T_next, grid.T, grid.size * sizeof(real) );
+}
+
+//
+//  Largest difference between the temperatures of two meshes of the
+//  same shape in rows [rbegin, rend)
+//
+template <class MeshA, class MeshB>
+double max_diff( const MeshA &a, const MeshB &b, int rbegin, int rend )
+{
+    double diff = 0;
+    for (int r = rbegin; r < rend; r++)
+        for (int j = 0; j < a.n; j++)
+            diff = fmax( diff, fabs( a.T[row_index( a, r ) + j] - b.T[row_index( b, r ) + j] ) );
+    return diff;
+}
+
+#endif
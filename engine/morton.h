@@ -0,0 +1,345 @@
+#ifndef __HEAT_MORTON_H__
+#define __HEAT_MORTON_H__
+
+#include "mesh.h"
+#include "stencil.h"
+#include "converge.h"
+
+//
+//  tiled Morton (Z-order) layout of a 2D field
+//  The n by n nodes are cut into square tiles of MORTON_TILE nodes a
+//  side, each stored row by row inside a frame of halo nodes, and the
+//  tiles are stored one after the other in the order a Z curve passes
+//  them: the four quarters of the field, each in turn cut in four, and
+//  so on down to the tiles. Nodes that are close in both directions
+//  then stay close in memory at every scale, so a tile, a few tiles and
+//  a quarter of the field each fit a level of cache, and a range of
+//  tiles is a compact block of the field, for a thread or a process.
+//
+//  morton_offset( ) translates node (i, j), halo included, to its place
+//  in T; a node of the halo of the mesh lives in the frame of the tile
+//  next to it. morton_edge( ) finds the edges a tile lends to the tiles
+//  next to it, for a halo exchange between processes owning runs of
+//  tiles. The frames of a tile are copied from the tiles next to
+//  it just before it is stepped, which do not write those nodes in a
+//  step, and the stencil of stencil.h then sweeps the tile as a small
+//  mesh of ld MORTON_LD, summing in the same order, so a Morton run
+//  gives the field of the row-major one. init_morton( ) builds the
+//  tiles from a 2D mesh set up by the scenario, without a source term
+//  or gaps in its spans.
+//
+//  Rows of MORTON_TILE nodes leave the stores of the row above in
+//  flight while it is read, and with T and T_next a whole number of
+//  pages apart every such load of T would wait on the store to the
+//  same place of T_next (4K aliasing), several times slower; both
+//  fields are cut from one block, half a page out of step.
+//
+const int MORTON_TILE = 32;
+const int MORTON_LD = MORTON_TILE + 2;
+const int MORTON_SIZE = MORTON_LD * MORTON_LD;
+
+template <typename real>
+struct morton_t
+{
+    typedef real real_t;
+
+    int n;
+    int tiles;          // along each axis
+    int ntiles;
+    int *tile_of;       // tiles * tiles: the place of tile (ti, tj) along the curve
+    int *neighbours;    // 4 per tile: above, below, left and right, or -1
+    int *row_begin;     // MORTON_TILE per tile: the updated span of each of its rows
+    int *row_end;
+    double r;
+    real *field;        // T and T_next
+    real *T;
+    real *T_next;
+    int nghosts;
+    int *ghosts;        // (ghost, source, source), as offsets into T
+};
+
+inline void morton_source( const no_source & /* source */ ) { }
+
+//
+//  The bits of i and j interleaved, j in the even ones
+//
+inline unsigned long long morton_key( unsigned int i, unsigned int j )
+{
+    unsigned long long key = 0;
+    for( int b = 0; b < 32; b++ )
+        key |= (unsigned long long) (j >> b & 1) << (2*b) | (unsigned long long) (i >> b & 1) << (2*b + 1);
+    return key;
+}
+
+//
+//  Offset into T of node (i, j), for -1 <= i, j <= n
+//
+template <typename real>
+inline int morton_offset( const morton_t<real> &m, int i, int j )
+{
+    const int ti = min( max( i, 0 ), m.n-1 ) / MORTON_TILE;
+    const int tj = min( max( j, 0 ), m.n-1 ) / MORTON_TILE;
+    const int t = m.tile_of[ti * m.tiles + tj];
+    return t * MORTON_SIZE + (i - ti * MORTON_TILE + 1) * MORTON_LD + j - tj * MORTON_TILE + 1;
+}
+
+//
+//  The place of tile (ti, tj) along the curve, or -1 past the edges
+//
+template <typename real>
+inline int morton_tile( const morton_t<real> &m, int ti, int tj )
+{
+    return ti >= 0 && ti < m.tiles && tj >= 0 && tj < m.tiles ? m.tile_of[ti * m.tiles + tj] : -1;
+}
+
+//
+//  Offset into T of the first of the MORTON_TILE nodes of tile t that
+//  the tile next to it on side s (0 to 3: above, below, left and right)
+//  copies into its frame, with stride set to the step between them
+//
+inline int morton_edge( int t, int s, int &stride )
+{
+    static const int first[4] = { MORTON_LD + 1, MORTON_TILE * MORTON_LD + 1, MORTON_LD + 1, MORTON_LD + MORTON_TILE };
+    stride = s < 2 ? 1 : MORTON_LD;
+    return t * MORTON_SIZE + first[s];
+}
+
+//
+//  Copy the field of grid into tiles along the Z curve
+//
+template <class Mesh>
+void init_morton( morton_t<typename Mesh::real_t> &m, const Mesh &grid )
+{
+    typedef typename Mesh::real_t real;
+    assert( Mesh::dim == 2 );
+    morton_source( grid.source );
+
+    const int n = grid.n;
+    m.n = n;
+    m.r = grid.r;
+    m.tiles = (n + MORTON_TILE - 1) / MORTON_TILE;
+    m.ntiles = m.tiles * m.tiles;
+
+    // number the tiles by their keys
+    unsigned long long *keys = (unsigned long long *) malloc( m.ntiles * sizeof(unsigned long long) );
+    for( int ti = 0; ti < m.tiles; ti++ )
+        for( int tj = 0; tj < m.tiles; tj++ )
+            keys[ti * m.tiles + tj] = morton_key( ti, tj ) << 32 | (unsigned) (ti * m.tiles + tj);
+    qsort( keys, m.ntiles, sizeof(unsigned long long), compare_keys );
+    m.tile_of = (int *) malloc( m.ntiles * sizeof(int) );
+    for( int t = 0; t < m.ntiles; t++ )
+        m.tile_of[keys[t] & 0xffffffffu] = t;
+    free( keys );
+
+    m.neighbours = (int *) malloc( 4 * m.ntiles * sizeof(int) );
+    m.row_begin = (int *) malloc( m.ntiles * MORTON_TILE * sizeof(int) );
+    m.row_end = (int *) malloc( m.ntiles * MORTON_TILE * sizeof(int) );
+    const int page = 4096 / sizeof(real);
+    const int stride = (m.ntiles * MORTON_SIZE + page-1) / page * page + page/2;
+    m.field = alloc_aligned<real>( 2 * stride );
+    m.T = m.field;
+    m.T_next = m.field + stride;
+    for( int ti = 0; ti < m.tiles; ti++ )
+        for( int tj = 0; tj < m.tiles; tj++ )
+        {
+            const int t = m.tile_of[ti * m.tiles + tj];
+            int *nb = &m.neighbours[4*t];
+            nb[0] = morton_tile( m, ti-1, tj );
+            nb[1] = morton_tile( m, ti+1, tj );
+            nb[2] = morton_tile( m, ti, tj-1 );
+            nb[3] = morton_tile( m, ti, tj+1 );
+
+            // the spans of the rows, cut to the tile
+            for( int li = 0; li < MORTON_TILE; li++ )
+            {
+                const int i = ti * MORTON_TILE + li;
+                const int jlo = tj * MORTON_TILE, jhi = min( jlo + MORTON_TILE, n );
+                int begin = 0, end = 0;
+                if( i < n )
+                {
+                    assert( !grid.row_gaps[i] );
+                    begin = max( grid.row_begin[i], jlo ) - jlo;
+                    end = min( grid.row_end[i], jhi ) - jlo;
+                }
+                m.row_begin[t * MORTON_TILE + li] = begin;
+                m.row_end[t * MORTON_TILE + li] = max( begin, end );
+            }
+        }
+
+    // every node, the halo of the mesh included, from the tile owning it
+    for( int i = -1; i <= n; i++ )
+        for( int j = -1; j <= n; j++ )
+        {
+            m.T[morton_offset( m, i, j )] = grid.T[node_index( grid, i, j )];
+            m.T_next[morton_offset( m, i, j )] = grid.T_next[node_index( grid, i, j )];
+        }
+
+    m.nghosts = grid.nghosts;
+    m.ghosts = (int *) malloc( 3 * max( grid.nghosts, 1 ) * sizeof(int) );
+    for( int g = 0; g < 3 * grid.nghosts; g++ )
+        m.ghosts[g] = morton_offset( m, grid.ghosts[g] / grid.ld - 1, grid.ghosts[g] % grid.ld - 1 );
+}
+
+template <typename real>
+void free_morton( morton_t<real> &m )
+{
+    free( m.tile_of );
+    free( m.neighbours );
+    free( m.row_begin );
+    free( m.row_end );
+    free_aligned( m.field );
+    free( m.ghosts );
+}
+
+template <typename real>
+void swap_morton( morton_t<real> &m )
+{
+    real *tmp = m.T;
+    m.T = m.T_next;
+    m.T_next = tmp;
+}
+
+template <typename real>
+void fill_morton_ghosts( const morton_t<real> &m )
+{
+    for( int g = 0; g < m.nghosts; g++ )
+    {
+        const int *ghost = &m.ghosts[3*g];
+        m.T[ghost[0]] = 0.5 * (m.T[ghost[1]] + m.T[ghost[2]]);
+    }
+}
+
+//
+//  Copy the frame of tile t of T from the edges of the tiles next to it
+//
+template <typename real>
+inline __attribute__((always_inline))
+void morton_halo( const morton_t<real> &m, int t )
+{
+    real *T = &m.T[t * MORTON_SIZE];
+    const int *nb = &m.neighbours[4*t];
+    if( nb[0] >= 0 )
+        memcpy( &T[1], &m.T[nb[0] * MORTON_SIZE + MORTON_TILE * MORTON_LD + 1], MORTON_TILE * sizeof(real) );
+    if( nb[1] >= 0 )
+        memcpy( &T[(MORTON_TILE+1) * MORTON_LD + 1], &m.T[nb[1] * MORTON_SIZE + MORTON_LD + 1], MORTON_TILE * sizeof(real) );
+    if( nb[2] >= 0 )
+    {
+        const real *left = &m.T[nb[2] * MORTON_SIZE + MORTON_TILE];
+        for( int i = MORTON_LD; i < MORTON_SIZE - MORTON_LD; i += MORTON_LD )
+            T[i] = left[i];
+    }
+    if( nb[3] >= 0 )
+    {
+        const real *right = &m.T[nb[3] * MORTON_SIZE + 1];
+        for( int i = MORTON_LD; i < MORTON_SIZE - MORTON_LD; i += MORTON_LD )
+            T[i + MORTON_TILE+1] = right[i];
+    }
+}
+
+template <typename acc, typename real>
+inline __attribute__((always_inline))
+void step_morton_any( const morton_t<real> &m, int tbegin, int tend )
+{
+    const bool mean = m.r == 0.25;
+    const acc d = (acc) m.r;
+    for( int t = tbegin; t < tend; t++ )
+    {
+        morton_halo( m, t );
+        for( int li = 0; li < MORTON_TILE; li++ )
+        {
+            const int row = t * MORTON_SIZE + (li+1) * MORTON_LD + 1;
+            const real * __restrict__ T = &m.T[row];
+            real * __restrict__ T_next = &m.T_next[row];
+            const int jbegin = m.row_begin[t * MORTON_TILE + li];
+            const int jend = m.row_end[t * MORTON_TILE + li];
+            if( mean )
+                for( int j = jbegin; j < jend; j++ )
+                    T_next[j] = (real) (neighbour_sum<acc, 2>( T, j, MORTON_LD, 0 ) / 4);
+            else
+                for( int j = jbegin; j < jend; j++ )
+                    T_next[j] = (real) (T[j] + d * (neighbour_sum<acc, 2>( T, j, MORTON_LD, 0 ) - 4 * (acc) T[j]));
+        }
+    }
+}
+
+template <typename acc, class Morton>
+void step_morton_scalar( const Morton &m, int tbegin, int tend )
+{
+    step_morton_any<acc>( m, tbegin, tend );
+}
+
+template <typename acc, class Morton>
+__attribute__((target("avx2,fma")))
+void step_morton_avx2( const Morton &m, int tbegin, int tend )
+{
+    step_morton_any<acc>( m, tbegin, tend );
+}
+
+template <typename acc, class Morton>
+__attribute__((target("avx512f")))
+void step_morton_avx512( const Morton &m, int tbegin, int tend )
+{
+    step_morton_any<acc>( m, tbegin, tend );
+}
+
+//
+//  hot kernel: advance tiles [tbegin, tend) by one step, reading m.T
+//  and writing m.T_next; the ghosts of m.T must be filled
+//
+template <typename acc, class Morton>
+inline void step_morton( const Morton &m, int tbegin, int tend )
+{
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        step_morton_avx512<acc>( m, tbegin, tend );
+        break;
+    case KERNEL_AVX2:
+        step_morton_avx2<acc>( m, tbegin, tend );
+        break;
+    default:
+        step_morton_scalar<acc>( m, tbegin, tend );
+    }
+}
+
+template <class Morton>
+inline void step_morton( const Morton &m, int tbegin, int tend )
+{
+    step_morton<typename Morton::real_t>( m, tbegin, tend );
+}
+
+//
+//  The change of the last step over the updated nodes of tiles
+//  [tbegin, tend), as change_rows( ) for the mesh
+//
+template <typename real>
+void change_morton( const morton_t<real> &m, int tbegin, int tend, double &largest, double &sq )
+{
+    double mx = largest, s = sq;
+    for( int t = tbegin; t < tend; t++ )
+        for( int li = 0; li < MORTON_TILE; li++ )
+        {
+            const int row = t * MORTON_SIZE + (li+1) * MORTON_LD + 1;
+            for( int j = m.row_begin[t * MORTON_TILE + li]; j < m.row_end[t * MORTON_TILE + li]; j++ )
+            {
+                double d = (double) m.T[row + j] - m.T_next[row + j];
+                mx = fmax( mx, fabs( d ) );
+                s += d * d;
+            }
+        }
+    largest = mx;
+    sq = s;
+}
+
+template <typename real>
+bool check_step( converge_t &conv, const morton_t<real> &m, int step )
+{
+    if( !check_due( conv, step ) )
+        return false;
+    double largest = 0, sq = 0;
+    change_morton( m, 0, m.ntiles, largest, sq );
+    end_check( conv, step, largest, sq );
+    return converged( conv );
+}
+
+#endif
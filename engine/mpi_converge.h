@@ -0,0 +1,57 @@
+#ifndef __HEAT_MPI_CONVERGE_H__
+#define __HEAT_MPI_CONVERGE_H__
+
+#include <mpi.h>
+#include "converge.h"
+
+//
+//  pipelined convergence checks for the MPI drivers
+//  The largest change and the sum of squares of a checked step are
+//  reduced over all processes by non-blocking MPI_Iallreduce calls
+//  started right after the step, and only waited for after the next
+//  one, so the reduction overlaps a step instead of adding a
+//  synchronization point to it. Every process gets the same totals, so
+//  all of them stop after the same step, one step after the one that
+//  converged.
+//
+struct pending_check_t
+{
+    MPI_Request request[2];
+    double local[2];
+    double global[2];
+    int step;           // being reduced, or -1
+};
+
+inline void init_pending( pending_check_t &pending )
+{
+    pending.step = -1;
+}
+
+//
+//  Start reducing the change of step, measured by this process as
+//  largest and sq
+//
+inline void start_check( pending_check_t &pending, int step, double largest, double sq )
+{
+    pending.local[0] = largest;
+    pending.local[1] = sq;
+    MPI_Iallreduce( &pending.local[0], &pending.global[0], 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD, &pending.request[0] );
+    MPI_Iallreduce( &pending.local[1], &pending.global[1], 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &pending.request[1] );
+    pending.step = step;
+}
+
+//
+//  Wait for the check in flight, if any, and record it; returns whether
+//  the run has converged
+//
+inline bool finish_check( pending_check_t &pending, converge_t &conv )
+{
+    if( pending.step < 0 )
+        return false;
+    MPI_Waitall( 2, pending.request, MPI_STATUSES_IGNORE );
+    end_check( conv, pending.step, pending.global[0], pending.global[1] );
+    pending.step = -1;
+    return converged( conv );
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef __HEAT_MULTIGRID_H__
+#define __HEAT_MULTIGRID_H__
+
+#include <math.h>
+#include "mesh.h"
+
+//
+//  geometric multigrid for a 2D box whose edges are all fixed
+//
+//  It solves (4 + shift) u - (sum of the 4 neighbours) = f at every
+//  updated node. With shift 0 and f the source term of the mesh that is
+//  the steady state. With the L and r of implicit.h, dividing a step of
+//  the theta scheme by theta r gives shift = 1 / (theta r) and
+//  f = shift T - (1-theta)/theta L T + f_source / theta, which
+//  mg_load( ) sets up from the old field T. Each coarser level keeps
+//  every other node of the level above, and its last node, so any n
+//  can be coarsened, down to a single updated node. Nodes are spaced
+//  unevenly where a level keeps its last node, so every level uses the
+//  finite volume form of the operator on its own spacing: in index
+//  units it is the equation above on the finest level and the
+//  Galerkin-consistent rediscretization on the others. Corrections are
+//  prolongated bilinearly and residuals restricted by the transpose.
+//  The smoother is red-black Gauss-Seidel.
+//
+//  Every level is held in doubles, in the padded layout of the mesh
+//  (node (i,j) at (i+1)*ld + j+1). The loops are orphaned omp for
+//  constructs: called by every thread of a team they are shared across
+//  it, called outside of a parallel region they run serially.
+//
+const int MG_MAX_LEVELS = 32;
+const int MG_MAX_CYCLES = 100;     // for one implicit step
+
+enum mg_cycle_t { MG_V, MG_F };
+
+struct mg_level_t
+{
+    int m;
+    int ld;
+    double *cl;     // 1 / spacing to the previous node along an axis
+    double *cr;     // 1 / spacing to the next node
+    double *w;      // width of the cell around a node
+    int *lo;        // coarse nodes either side of each node,
+    int *hi;        // and their bilinear weights
+    double *wlo;
+    double *whi;
+    double *u;
+    double *f;
+    double *r;
+};
+
+struct multigrid_t
+{
+    int nlevels;
+    mg_level_t level[MG_MAX_LEVELS];
+    double shift;
+    int pre;
+    int post;
+    int cycles;
+    double residual;
+};
+
+//
+//  Start the finest level from the field of grid, with the right hand
+//  side of a step of the theta scheme from that field; with mg.shift 0
+//  and theta 1 it is the source of the mesh, for the steady state
+//
+template <class Mesh>
+void mg_load( multigrid_t &mg, const Mesh &grid, double theta )
+{
+    mg_level_t &fine = mg.level[0];
+    int n = grid.n;
+    double explicit_part = (1 - theta) / theta;
+    #pragma omp for
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+        {
+            int idx = node_index( grid, i, j );
+            double T = grid.T[idx];
+            fine.u[(i+1)*fine.ld + j+1] = T;
+            double f = grid.source.add( 0.0, idx ) / theta;
+            if( mg.shift != 0 && i > 0 && i < n-1 && j > 0 && j < n-1 )
+                f += mg.shift * T - explicit_part * (4*T - grid.T[idx - 1] - grid.T[idx + 1]
+                                                        - grid.T[idx - grid.ld] - grid.T[idx + grid.ld]);
+            fine.f[(i+1)*fine.ld + j+1] = f;
+        }
+    #pragma omp single
+    for( int k = 0; k < grid.source.points( ); k++ )
+    {
+        int idx = grid.source.point( k );
+        fine.f[idx / grid.ld * fine.ld + idx % grid.ld] += grid.source.point_term( k ) / theta;
+    }
+}
+
+//
+//  Set up the levels for grid, which must be a box with fixed edges,
+//  starting from its current field
+//
+template <class Mesh>
+void init_multigrid( multigrid_t &mg, const Mesh &grid, double shift )
+{
+    int n = grid.n;
+    assert( Mesh::dim == 2 && grid.nghosts == 0 );
+    for( int i = 1; i < n-1; i++ )
+        assert( grid.row_begin[i] == 1 && grid.row_end[i] == n-1 && !grid.row_gaps[i] );
+
+    mg.shift = shift;
+    mg.pre = 2;
+    mg.post = 2;
+    mg.cycles = 0;
+    mg.residual = 0;
+
+    // positions of the nodes of each level, in nodes of the finest one
+    int *pos = (int *) malloc( n * sizeof(int) );
+    for( int k = 0; k < n; k++ )
+        pos[k] = k;
+
+    int m = n;
+    mg.nlevels = 0;
+    while( true )
+    {
+        mg_level_t &level = mg.level[mg.nlevels++];
+        level.m = m;
+        level.ld = padded_len<double>( m );
+        level.cl = alloc_aligned<double>( m );
+        level.cr = alloc_aligned<double>( m );
+        level.w = alloc_aligned<double>( m );
+        for( int k = 1; k < m-1; k++ )
+        {
+            level.cl[k] = 1.0 / (pos[k] - pos[k-1]);
+            level.cr[k] = 1.0 / (pos[k+1] - pos[k]);
+            level.w[k] = 0.5 * (pos[k+1] - pos[k-1]);
+        }
+        int size = (m+2) * level.ld;
+        level.u = alloc_aligned<double>( size );
+        level.f = alloc_aligned<double>( size );
+        level.r = alloc_aligned<double>( size );
+
+        int mc = (m-1)/2 + 1 + (m-1)%2;
+        bool coarsest = m <= 3 || mg.nlevels == MG_MAX_LEVELS;
+        level.lo = (int *) malloc( m * sizeof(int) );
+        level.hi = (int *) malloc( m * sizeof(int) );
+        level.wlo = alloc_aligned<double>( m );
+        level.whi = alloc_aligned<double>( m );
+        for( int k = 0; !coarsest && k < m; k++ )
+        {
+            level.lo[k] = k/2;
+            level.hi[k] = min( k/2 + 1, mc-1 );
+            if( k % 2 == 0 || k == m-1 )
+            {
+                level.lo[k] = level.hi[k] = (k+1)/2;
+                level.wlo[k] = 1;
+                level.whi[k] = 0;
+            }
+            else
+            {
+                int a = pos[k-1], b = pos[k+1];
+                level.wlo[k] = (double) (b - pos[k]) / (b - a);
+                level.whi[k] = (double) (pos[k] - a) / (b - a);
+            }
+        }
+        if( coarsest )
+            break;
+
+        for( int k = 0; k < mc; k++ )
+            pos[k] = pos[min( 2*k, m-1 )];
+        m = mc;
+    }
+    free( pos );
+
+    mg_load( mg, grid, 1 );
+}
+
+template <class Mesh>
+void finish_multigrid( const multigrid_t &mg, Mesh &grid )
+{
+    const mg_level_t &fine = mg.level[0];
+    for( int i = 1; i < grid.n-1; i++ )
+        for( int j = 1; j < grid.n-1; j++ )
+        {
+            int idx = node_index( grid, i, j );
+            grid.T[idx] = grid.T_next[idx] = fine.u[(i+1)*fine.ld + j+1];
+        }
+}
+
+inline void free_multigrid( multigrid_t &mg )
+{
+    for( int l = 0; l < mg.nlevels; l++ )
+    {
+        mg_level_t &level = mg.level[l];
+        free_aligned( level.cl );
+        free_aligned( level.cr );
+        free_aligned( level.w );
+        free( level.lo );
+        free( level.hi );
+        free_aligned( level.wlo );
+        free_aligned( level.whi );
+        free_aligned( level.u );
+        free_aligned( level.f );
+        free_aligned( level.r );
+    }
+}
+
+//
+//  diagonal of the operator at node (i,j) of a level
+//
+inline double mg_diag( const multigrid_t &mg, const mg_level_t &level, int i, int j )
+{
+    return level.w[j] * (level.cl[i] + level.cr[i]) + level.w[i] * (level.cl[j] + level.cr[j])
+         + mg.shift * level.w[i] * level.w[j];
+}
+
+//
+//  off-diagonal part of the operator at node idx = (i,j), negated
+//
+inline double mg_neighbours( const mg_level_t &level, const double *u, int i, int j, int idx )
+{
+    return level.w[j] * (level.cl[i] * u[idx - level.ld] + level.cr[i] * u[idx + level.ld])
+         + level.w[i] * (level.cl[j] * u[idx - 1] + level.cr[j] * u[idx + 1]);
+}
+
+inline void mg_smooth( multigrid_t &mg, int l, int sweeps )
+{
+    mg_level_t &level = mg.level[l];
+    for( int s = 0; s < sweeps; s++ )
+        for( int color = 0; color < 2; color++ )
+        {
+            #pragma omp for
+            for( int i = 1; i < level.m-1; i++ )
+                for( int j = 2 - ((i + color) & 1); j < level.m-1; j += 2 )
+                {
+                    int idx = (i+1)*level.ld + j+1;
+                    level.u[idx] = (level.f[idx] + mg_neighbours( level, level.u, i, j, idx ))
+                                 / mg_diag( mg, level, i, j );
+                }
+        }
+}
+
+//
+//  r = f - A u on a level
+//
+inline void mg_residual( multigrid_t &mg, int l )
+{
+    mg_level_t &level = mg.level[l];
+    #pragma omp for
+    for( int i = 1; i < level.m-1; i++ )
+        for( int j = 1; j < level.m-1; j++ )
+        {
+            int idx = (i+1)*level.ld + j+1;
+            level.r[idx] = level.f[idx] + mg_neighbours( level, level.u, i, j, idx )
+                         - mg_diag( mg, level, i, j ) * level.u[idx];
+        }
+}
+
+//
+//  Restrict the residual of level l to the right hand side of level
+//  l+1, and start that level from a zero correction
+//
+inline void mg_restrict( multigrid_t &mg, int l )
+{
+    mg_level_t &fine = mg.level[l];
+    mg_level_t &coarse = mg.level[l+1];
+    #pragma omp for
+    for( int I = 1; I < coarse.m-1; I++ )
+        for( int J = 1; J < coarse.m-1; J++ )
+        {
+            double sum = 0;
+            for( int i = max( 2*I - 1, 1 ); i <= min( 2*I + 1, fine.m-2 ); i++ )
+            {
+                double wi = (fine.lo[i] == I ? fine.wlo[i] : 0) + (fine.hi[i] == I ? fine.whi[i] : 0);
+                for( int j = max( 2*J - 1, 1 ); j <= min( 2*J + 1, fine.m-2 ); j++ )
+                {
+                    double wj = (fine.lo[j] == J ? fine.wlo[j] : 0) + (fine.hi[j] == J ? fine.whi[j] : 0);
+                    sum += wi * wj * fine.r[(i+1)*fine.ld + j+1];
+                }
+            }
+            int idx = (I+1)*coarse.ld + J+1;
+            coarse.f[idx] = sum;
+            coarse.u[idx] = 0;
+        }
+}
+
+//
+//  Add the correction of level l+1 to level l
+//
+inline void mg_prolong( multigrid_t &mg, int l )
+{
+    mg_level_t &fine = mg.level[l];
+    mg_level_t &coarse = mg.level[l+1];
+    const double *e = coarse.u;
+    #pragma omp for
+    for( int i = 1; i < fine.m-1; i++ )
+    {
+        int a = (fine.lo[i]+1)*coarse.ld + 1, b = (fine.hi[i]+1)*coarse.ld + 1;
+        for( int j = 1; j < fine.m-1; j++ )
+        {
+            int c = fine.lo[j], d = fine.hi[j];
+            fine.u[(i+1)*fine.ld + j+1] +=
+                fine.wlo[i] * (fine.wlo[j] * e[a + c] + fine.whi[j] * e[a + d]) +
+                fine.whi[i] * (fine.wlo[j] * e[b + c] + fine.whi[j] * e[b + d]);
+        }
+    }
+}
+
+//
+//  One V- or F-cycle from level l down
+//
+inline void mg_cycle( multigrid_t &mg, int l, mg_cycle_t kind )
+{
+    if( l == mg.nlevels - 1 )
+    {
+        // a level of at most three nodes a side holds one updated node
+        mg_smooth( mg, l, 2 );
+        return;
+    }
+    mg_smooth( mg, l, mg.pre );
+    mg_residual( mg, l );
+    mg_restrict( mg, l );
+    mg_cycle( mg, l+1, kind );
+    if( kind == MG_F )
+        mg_cycle( mg, l+1, MG_V );
+    mg_prolong( mg, l );
+    mg_smooth( mg, l, mg.post );
+}
+
+//
+//  One cycle over the whole hierarchy; afterwards mg.residual holds the
+//  largest change a Jacobi step would now make to the finest level,
+//  comparable to the change per sweep of relax.h
+//
+inline void mg_solve_cycle( multigrid_t &mg, mg_cycle_t kind )
+{
+    mg_cycle( mg, 0, kind );
+    mg_residual( mg, 0 );
+
+    mg_level_t &fine = mg.level[0];
+    double residual = 0;
+    #pragma omp single
+    mg.residual = 0;
+    #pragma omp for nowait
+    for( int i = 1; i < fine.m-1; i++ )
+        for( int j = 1; j < fine.m-1; j++ )
+            residual = fmax( residual, fabs( fine.r[(i+1)*fine.ld + j+1] ) / mg_diag( mg, fine, i, j ) );
+    #pragma omp critical
+    mg.residual = fmax( mg.residual, residual );
+    #pragma omp barrier
+    #pragma omp single
+    mg.cycles++;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __HEAT_NUMA_H__
+#define __HEAT_NUMA_H__
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <omp.h>
+#include "mesh.h"
+
+//
+//  NUMA placement, for the threaded drivers on Linux
+//  alloc_grid( ) places every page of the field on the node of the
+//  thread that steps it (see first_touch( )), which only holds while the
+//  threads stay where they are: pin_threads( ) pins thread t of the team
+//  to the t-th CPU the process may run on, and must run before the grid
+//  is allocated (OMP_PROC_BIND=close OMP_PLACES=cores does the same).
+//  numa_placement( ) asks the kernel where the pages of the field lie,
+//  and counts those on the node of the thread that steps them.
+//
+struct numa_t
+{
+    bool known;         // false if the kernel would not say
+    int nodes;
+    long pages;
+    long local;
+};
+
+inline void pin_threads( )
+{
+    cpu_set_t allowed;
+    if( sched_getaffinity( 0, sizeof(allowed), &allowed ) != 0 )
+        return;
+    int ncpus = CPU_COUNT( &allowed );
+
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num( ) % ncpus;
+        for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+            if( CPU_ISSET( cpu, &allowed ) && t-- == 0 )
+            {
+                cpu_set_t one;
+                CPU_ZERO( &one );
+                CPU_SET( cpu, &one );
+                sched_setaffinity( 0, sizeof(one), &one );
+                break;
+            }
+    }
+}
+
+//
+//  Node of each of the count pages at page[ ], into node[ ]; false if
+//  the kernel would not say
+//
+inline bool page_nodes( void **page, int count, int *node )
+{
+    return syscall( SYS_move_pages, 0, (unsigned long) count, page, NULL, node, 0 ) == 0;
+}
+
+template <class Mesh>
+numa_t numa_placement( const Mesh &grid )
+{
+    typedef typename Mesh::real_t real;
+    const int n = grid.n;
+    const int len = Mesh::dim == 1 ? 1 : grid.size / (n+2);
+    const uintptr_t page = sysconf( _SC_PAGESIZE );
+    const int BATCH = 64;
+
+    bool known = true;
+    int nodes = 0;
+    long pages = 0, local = 0;
+    #pragma omp parallel for schedule(static) reduction(&&:known) reduction(max:nodes) reduction(+:pages,local)
+    for( int i = 0; i < n; i++ )
+    {
+        unsigned cpu, mine;
+        syscall( SYS_getcpu, &cpu, &mine, NULL );
+        nodes = max( nodes, (int) mine + 1 );
+
+        // the pages that start in the nodes first_touch( ) gives row i
+        int begin = i == 0 ? 0 : (i+1) * len;
+        int end = i == n-1 ? grid.size : (i+2) * len;
+        const real *buffers[2] = { grid.T, grid.T_next };
+        for( int b = 0; b < 2; b++ )
+        {
+            uintptr_t from = ((uintptr_t) &buffers[b][begin] + page - 1) & ~(page - 1);
+            uintptr_t to = (uintptr_t) &buffers[b][end];
+            while( known && from < to )
+            {
+                void *addr[BATCH];
+                int node[BATCH];
+                int count = 0;
+                for( ; count < BATCH && from < to; from += page )
+                    addr[count++] = (void *) from;
+                known = page_nodes( addr, count, node );
+                for( int k = 0; known && k < count; k++ )
+                    if( node[k] >= 0 )
+                    {
+                        pages++;
+                        local += node[k] == (int) mine;
+                        nodes = max( nodes, node[k] + 1 );
+                    }
+            }
+        }
+    }
+
+    numa_t numa = { known, nodes, pages, local };
+    return numa;
+}
+
+//
+//  One line for the run summary
+//
+inline void print_numa( const numa_t &numa )
+{
+    if( numa.known )
+        printf( "numa nodes = %d, pages of the field on the node of the thread stepping them = %ld of %ld (%.1f%%)\n",
+                numa.nodes, numa.local, numa.pages, 100.0 * numa.local / (numa.pages > 0 ? numa.pages : 1) );
+    else
+        printf( "numa placement unknown\n" );
+}
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef __HEAT_RELAX_H__
+#define __HEAT_RELAX_H__
+
+#include <math.h>
+#include "stencil.h"
+
+//
+//  steady state by red-black successive over-relaxation (SOR)
+//  Nodes are coloured by the parity of the sum of their coordinates, so
+//  the 2*DIM neighbours of a node all have the other colour and one
+//  colour can be relaxed in place, in any order and in parallel. A ghost
+//  fed by two nodes ties them (and every other node reading it) together
+//  although they have the same colour, so such nodes are split further
+//  into passes: colour c relaxes the nodes of parity c % 2 in pass c / 2.
+//  A sweep relaxes the sor.colors colours in turn, refreshing the ghosts
+//  after each; its fixed point is the field the time stepping of
+//  stencil.h converges to. Only grid.T is used.
+//
+template <int DIM, typename real, class B, class S>
+inline int row_parity( const mesh_t<DIM, real, B, S> &grid, int r )
+{
+    if( DIM == 1 )
+        return 0;
+    if( DIM == 2 )
+        return r & 1;
+    return (r/grid.n + r%grid.n) & 1;
+}
+
+//
+//  over-relaxation factor that is optimal when Jacobi iteration
+//  converges at rate rho
+//
+inline double sor_omega( double rho )
+{
+    return 2 / (1 + sqrt( 1 - rho*rho ));
+}
+
+//
+//  Largest number of steps from an updated node to the nearest fixed
+//  node, through updated nodes; the slowest mode of the mesh cannot
+//  vary more slowly than the one of a 1D bar that long with one end
+//  fixed and the other insulated
+//
+template <class Mesh>
+int fixed_distance( const Mesh &grid )
+{
+    int offsets[6] = { -grid.plane, grid.plane, -grid.ld, grid.ld, -1, 1 };
+    const int *offset = &offsets[6 - 2*Mesh::dim];
+
+    int *dist = alloc_aligned<int>( grid.size );
+    int *queue = alloc_aligned<int>( grid.size );
+    int head = 0, tail = 0;
+    for( int idx = 0; idx < grid.size; idx++ )
+    {
+        dist[idx] = -1;
+        if( grid.flags[idx] & FIXED )
+        {
+            dist[idx] = 0;
+            queue[tail++] = idx;
+        }
+    }
+    int far = 0;
+    while( head < tail )
+    {
+        int idx = queue[head++];
+        for( int d = 0; d < 2*Mesh::dim; d++ )
+        {
+            int nb = idx + offset[d];
+            if( nb >= 0 && nb < grid.size && dist[nb] < 0 && is_updated( grid, nb ) )
+            {
+                dist[nb] = dist[idx] + 1;
+                far = max( far, dist[nb] );
+                queue[tail++] = nb;
+            }
+        }
+    }
+    free_aligned( dist );
+    free_aligned( queue );
+    return far;
+}
+
+//
+//  Give every updated node the lowest pass no node it is tied to through
+//  a ghost has, raising the later node of a tie until no two share one;
+//  return the number of passes, and in row_passes[r] the number row r
+//  needs
+//
+template <class Mesh>
+int split_passes( const Mesh &grid, unsigned char *pass, int *row_passes )
+{
+    int offsets[6] = { -grid.plane, grid.plane, -grid.ld, grid.ld, -1, 1 };
+    const int *offset = &offsets[6 - 2*Mesh::dim];
+
+    for( int idx = 0; idx < grid.size; idx++ )
+        pass[idx] = 0;
+    bool tied = true;
+    while( tied )
+    {
+        tied = false;
+        for( int g = 0; g < grid.nghosts; g++ )
+        {
+            const int *ghost = &grid.ghosts[3*g];
+            if( ghost[1] == ghost[2] )
+                continue;
+            for( int d = 0; d < 2*Mesh::dim; d++ )
+            {
+                int nb = ghost[0] + offset[d];
+                if( nb < 0 || nb >= grid.size || !is_updated( grid, nb ) )
+                    continue;
+                for( int s = 1; s <= 2; s++ )
+                    if( nb != ghost[s] && pass[nb] == pass[ghost[s]] )
+                    {
+                        pass[max( nb, ghost[s] )]++;
+                        tied = true;
+                    }
+            }
+        }
+    }
+
+    int passes = 1;
+    for( int r = 0; r < grid.rows; r++ )
+    {
+        const int row = row_index( grid, r );
+        row_passes[r] = 1;
+        for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+            row_passes[r] = max( row_passes[r], pass[row + j] + 1 );
+        passes = max( passes, row_passes[r] );
+    }
+    return passes;
+}
+
+//
+//  SOR state shared by the drivers. Unless it is given, omega starts at
+//  the optimum for a box with fixed faces, and every SOR_WINDOW sweeps
+//  is raised towards Carre's estimate from the rate lambda at which the
+//  changes shrank: while omega is below the optimum, the Jacobi rate is
+//  rho = (lambda + omega - 1) / (omega sqrt(lambda)). The estimate is
+//  only trusted once two windows agree on lambda, and is taken
+//  conservatively, as overshooting the optimum costs more than falling
+//  short of it, and never above omega_max, the optimum for a bar as long
+//  as the mesh is far from its fixed nodes: on long thin shapes the
+//  estimate otherwise drifts towards 2 and the sweeps stop converging.
+//  The run has converged once a sweep changes no node by tol or more;
+//  tol defaults to a level float temperatures can still resolve, and
+//  limit is about twice the sweeps omega_max needs to get there.
+//
+//  A ghost next to a node holds (part of) that node's own temperature,
+//  so relaxing the node towards the plain mean of its neighbours would
+//  under-relax it. scale[idx] = 2*DIM / (2*DIM - c), where c is the
+//  weight node idx has in its own ghosts, turns the step into an exact
+//  Gauss-Seidel step for that node, as the nodes it shares the ghost
+//  with are relaxed in other passes.
+//
+const int SOR_WINDOW = 20;
+
+struct sor_t
+{
+    double omega;
+    double omega_max;
+    double tol;
+    int limit;
+    bool adaptive;
+    int sweeps;
+    double change;
+    double window_change;
+    double lambda;
+    double *scale;
+    int colors;
+    unsigned char *pass;
+    int *row_passes;
+};
+
+template <class Mesh>
+void init_sor( sor_t &sor, const Mesh &grid, double omega, double tol )
+{
+    int far = max( fixed_distance( grid ), 1 );
+    sor.omega_max = sor_omega( 1 - (1 - cos( M_PI / (2*far + 1) )) / Mesh::dim );
+    sor.limit = SOR_WINDOW * far;
+    sor.adaptive = omega <= 0;
+    sor.omega = sor.adaptive ? fmin( sor_omega( cos( M_PI / (grid.n-1) ) ), sor.omega_max ) : omega;
+    if( tol > 0 )
+        sor.tol = tol;
+    else
+        sor.tol = sizeof(typename Mesh::real_t) == sizeof(double) ? 1e-6 : 1e-2;
+    sor.sweeps = 0;
+    sor.change = 0;
+    sor.window_change = 0;
+    sor.lambda = 0;
+
+    sor.scale = alloc_aligned<double>( grid.size );
+    add_self_weights( grid, sor.scale );
+    for( int idx = 0; idx < grid.size; idx++ )
+    {
+        double c = sor.scale[idx];
+        sor.scale[idx] = c < 2*Mesh::dim ? 2*Mesh::dim / (2*Mesh::dim - c) : 1;
+    }
+
+    sor.pass = alloc_aligned<unsigned char>( grid.size );
+    sor.row_passes = alloc_aligned<int>( grid.rows );
+    sor.colors = 2 * split_passes( grid, sor.pass, sor.row_passes );
+}
+
+inline void free_sor( sor_t &sor )
+{
+    free_aligned( sor.scale );
+    free_aligned( sor.pass );
+    free_aligned( sor.row_passes );
+}
+
+//
+//  Record the largest change of the sweep just done, over every process
+//
+inline void end_sweep( sor_t &sor, double change )
+{
+    sor.sweeps++;
+    sor.change = change;
+    if( !sor.adaptive || sor.sweeps % SOR_WINDOW )
+        return;
+    double lambda = 0;
+    if( sor.window_change > 0 && change > 0 && change < sor.window_change )
+        lambda = pow( change / sor.window_change, 1.0 / SOR_WINDOW );
+    if( lambda > 0 && fabs( lambda - sor.lambda ) < 0.1 * (1 - lambda) )
+    {
+        double rho = (lambda + sor.omega - 1) / (sor.omega * sqrt( lambda ));
+        if( rho < 1 )
+        {
+            double omega = sor_omega( rho );
+            sor.omega = fmin( fmax( sor.omega, omega - (2 - omega) / 4 ), sor.omega_max );
+        }
+    }
+    sor.lambda = lambda;
+    sor.window_change = change;
+}
+
+inline bool converged( const sor_t &sor )
+{
+    return sor.sweeps > 0 && sor.change < sor.tol;
+}
+
+//
+//  Relax the nodes of one of the sor.colors colours in rows [rbegin,
+//  rend) towards the mean of their neighbours, summed as acc, by
+//  sor.omega; return the largest change
+//
+template <typename acc, class Mesh>
+double relax_rows( const Mesh &grid, const sor_t &sor, int color, int rbegin, int rend )
+{
+    typedef typename Mesh::real_t real;
+    const int dim = Mesh::dim;
+    const int pass = color / 2;
+    double change = 0;
+    for( int r = rbegin; r < rend; r++ )
+    {
+        if( sor.row_passes[r] <= pass )
+            continue;
+        const int row = row_index( grid, r );
+        real *T = &grid.T[row];
+        const double *scale = &sor.scale[row];
+        const unsigned char *passes = sor.row_passes[r] > 1 ? &sor.pass[row] : NULL;
+        int jbegin = grid.row_begin[r];
+        jbegin += (row_parity( grid, r ) + jbegin + color) & 1;
+        int k = first_point( grid.source, row + jbegin );
+        for( int j = jbegin; j < grid.row_end[r]; j += 2 )
+        {
+            if( grid.row_gaps[r] && (grid.flags[row + j] & NOT_UPDATED) )
+                continue;
+            if( passes && passes[j] != pass )
+                continue;
+            acc sum = neighbour_sum<acc, dim>( T, j, grid.ld, grid.plane );
+            for( ; k < grid.source.points( ) && grid.source.point( k ) <= row + j; k++ )
+                if( grid.source.point( k ) == row + j )
+                    sum += grid.source.point_term( k );
+            acc mean = grid.source.add( sum, row + j ) / (2*dim);
+            real next = (real) (T[j] + sor.omega * scale[j] * (mean - T[j]));
+            change = fmax( change, fabs( next - T[j] ) );
+            T[j] = next;
+        }
+    }
+    return change;
+}
+
+template <class Mesh>
+double relax_rows( const Mesh &grid, const sor_t &sor, int color, int rbegin, int rend )
+{
+    return relax_rows<typename Mesh::real_t>( grid, sor, color, rbegin, rend );
+}
+
+//
+//  One sweep of every colour over the whole mesh; returns the largest
+//  change
+//
+template <typename acc, class Mesh>
+double relax_sweep( Mesh &grid, const sor_t &sor )
+{
+    double change = 0;
+    for( int color = 0; color < sor.colors; color++ )
+    {
+        change = fmax( change, relax_rows<acc>( grid, sor, color, 0, grid.rows ) );
+        fill_ghosts( grid, 0, grid.rows );
+    }
+    return change;
+}
+
+template <class Mesh>
+double relax_sweep( Mesh &grid, const sor_t &sor )
+{
+    return relax_sweep<typename Mesh::real_t>( grid, sor );
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef __HEAT_SPARSE_H__
+#define __HEAT_SPARSE_H__
+
+#include <string.h>
+#include "mesh.h"
+#include "stencil.h"
+#include "converge.h"
+
+//
+//  block-sparse 2D mesh
+//  The padded mesh, halo included, is cut into tiles of SPARSE_ROWS rows
+//  of SPARSE_COLS nodes, and only the tiles holding a node of the shape
+//  (updated or fixed) or a neighbour of an updated node (a ghost, or a
+//  hole holding its temperature under dirichlet) are kept; the others
+//  are never allocated or visited. Kept tiles are numbered row by row,
+//  and each stores its nodes in two buffers swapped after every step,
+//  like the mesh. The first and last rows of a tile read the rows next
+//  to them straight from the tiles above and below, and the ends of its
+//  rows from a halo column on either side, which a step copies from the
+//  tiles to the left and right just before it advances the tile.
+//  The nodes a tile updates are a bitmask per row: rows with every bit
+//  set (every row of a full tile) take the plain stencil loop, empty
+//  rows are skipped and the others blend the stencil with the old value
+//  under the mask.
+//
+//  The stencil is summed in the order of stencil.h, so a sparse run
+//  gives the field of the dense one. init_sparse( ) builds the tiles
+//  from a mesh set up by the scenario, which can then be freed; sparse
+//  meshes carry no source term.
+//
+typedef unsigned long long sparse_mask_t;
+
+const int SPARSE_ROWS = 16;
+const int SPARSE_COLS = 64;                     // bits in a row mask
+const int SPARSE_LD = SPARSE_COLS + 2;
+const int SPARSE_SIZE = SPARSE_ROWS * SPARSE_LD;
+const sparse_mask_t SPARSE_FULL = ~(sparse_mask_t) 0 >> (64 - SPARSE_COLS);
+
+template <typename real>
+struct sparse_t
+{
+    typedef real real_t;
+
+    int n;
+    int tiles_i;        // along each axis of the padded mesh
+    int tiles_j;
+    int ntiles;         // kept
+    int nfull;
+    int *tile_of;       // tiles_i * tiles_j: the kept tile there, or -1
+    int *neighbours;    // 4 per kept tile: above, below, left, right, or -1 if never read
+    sparse_mask_t *mask;    // SPARSE_ROWS per kept tile: bit j of row i set if node (i, j) is updated
+    sparse_mask_t *solid;   // and if it is part of the shape
+    double r;
+    real *T;
+    real *T_next;
+    int nghosts;
+    int *ghosts;        // (ghost, source, source), as offsets into T
+};
+
+inline void sparse_source( const no_source & /* source */ ) { }
+
+template <typename real>
+inline int sparse_tile( const sparse_t<real> &sp, int i, int j )
+{
+    return sp.tile_of[(i+1) / SPARSE_ROWS * sp.tiles_j + (j+1) / SPARSE_COLS];
+}
+
+//
+//  offset into T of node (i, j) of the mesh, or -1 if its tile is not
+//  kept
+//
+template <typename real>
+inline int sparse_offset( const sparse_t<real> &sp, int i, int j )
+{
+    int t = sparse_tile( sp, i, j );
+    if( t < 0 )
+        return -1;
+    return t * SPARSE_SIZE + (i+1) % SPARSE_ROWS * SPARSE_LD + (j+1) % SPARSE_COLS + 1;
+}
+
+template <typename real>
+inline bool sparse_solid( const sparse_t<real> &sp, int i, int j )
+{
+    int t = sparse_tile( sp, i, j );
+    return t >= 0 && (sp.solid[t * SPARSE_ROWS + (i+1) % SPARSE_ROWS] >> ((j+1) % SPARSE_COLS) & 1);
+}
+
+//
+//  Keep the tiles of grid that matter and copy its field into them
+//
+template <class Mesh>
+void init_sparse( sparse_t<typename Mesh::real_t> &sp, const Mesh &grid )
+{
+    typedef typename Mesh::real_t real;
+    assert( Mesh::dim == 2 );
+    sparse_source( grid.source );
+
+    const int n = grid.n;
+    const int ld = grid.ld;
+    const int N = n+2;
+
+    // 1 for updated nodes, 2 for their neighbours, 4 for the shape
+    unsigned char *keep = (unsigned char *) calloc( grid.size, sizeof(unsigned char) );
+    for( int r = 0; r < grid.rows; r++ )
+    {
+        const int row = row_index( grid, r );
+        for( int j = grid.row_begin[r]; j < grid.row_end[r]; j++ )
+        {
+            int idx = row + j;
+            if( grid.flags[idx] & NOT_UPDATED )
+                continue;
+            keep[idx] |= 1;
+            keep[idx - ld] |= 2;
+            keep[idx + ld] |= 2;
+            keep[idx - 1] |= 2;
+            keep[idx + 1] |= 2;
+        }
+    }
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            if( !(grid.flags[node_index( grid, i, j )] & HOLE) )
+                keep[node_index( grid, i, j )] |= 4;
+
+    sp.n = n;
+    sp.r = grid.r;
+    sp.tiles_i = (N + SPARSE_ROWS - 1) / SPARSE_ROWS;
+    sp.tiles_j = (N + SPARSE_COLS - 1) / SPARSE_COLS;
+    sp.tile_of = (int *) malloc( sp.tiles_i * sp.tiles_j * sizeof(int) );
+    sp.ntiles = 0;
+    for( int ti = 0; ti < sp.tiles_i; ti++ )
+        for( int tj = 0; tj < sp.tiles_j; tj++ )
+        {
+            bool kept = false;
+            for( int I = ti * SPARSE_ROWS; I < min( N, (ti+1) * SPARSE_ROWS ); I++ )
+                for( int J = tj * SPARSE_COLS; J < min( N, (tj+1) * SPARSE_COLS ); J++ )
+                    kept = kept || keep[I*ld + J];
+            sp.tile_of[ti * sp.tiles_j + tj] = kept ? sp.ntiles++ : -1;
+        }
+
+    sp.neighbours = (int *) malloc( 4 * sp.ntiles * sizeof(int) );
+    sp.mask = (sparse_mask_t *) calloc( sp.ntiles * SPARSE_ROWS, sizeof(sparse_mask_t) );
+    sp.solid = (sparse_mask_t *) calloc( sp.ntiles * SPARSE_ROWS, sizeof(sparse_mask_t) );
+    sp.T = alloc_aligned<real>( sp.ntiles * SPARSE_SIZE );
+    sp.T_next = alloc_aligned<real>( sp.ntiles * SPARSE_SIZE );
+    sp.nfull = 0;
+    for( int ti = 0; ti < sp.tiles_i; ti++ )
+        for( int tj = 0; tj < sp.tiles_j; tj++ )
+        {
+            const int t = sp.tile_of[ti * sp.tiles_j + tj];
+            if( t < 0 )
+                continue;
+            sparse_mask_t *mask = &sp.mask[t * SPARSE_ROWS];
+            sparse_mask_t *solid = &sp.solid[t * SPARSE_ROWS];
+            sparse_mask_t all = SPARSE_FULL, any = 0;
+            for( int li = 0; li < SPARSE_ROWS; li++ )
+            {
+                const int I = ti * SPARSE_ROWS + li;
+                for( int lj = 0; lj < SPARSE_COLS && I < N; lj++ )
+                {
+                    const int J = tj * SPARSE_COLS + lj;
+                    if( J >= N )
+                        break;
+                    const int at = t * SPARSE_SIZE + li * SPARSE_LD + lj+1;
+                    sp.T[at] = grid.T[I*ld + J];
+                    sp.T_next[at] = grid.T_next[I*ld + J];
+                    if( keep[I*ld + J] & 1 )
+                        mask[li] |= (sparse_mask_t) 1 << lj;
+                    if( keep[I*ld + J] & 4 )
+                        solid[li] |= (sparse_mask_t) 1 << lj;
+                }
+                all &= mask[li];
+                any |= mask[li];
+            }
+            sp.nfull += all == SPARSE_FULL;
+
+            // a side is only read if an updated node faces it
+            int *nb = &sp.neighbours[4*t];
+            nb[0] = ti > 0 && mask[0] ? sp.tile_of[(ti-1) * sp.tiles_j + tj] : -1;
+            nb[1] = ti < sp.tiles_i-1 && mask[SPARSE_ROWS-1] ? sp.tile_of[(ti+1) * sp.tiles_j + tj] : -1;
+            nb[2] = tj > 0 && (any & 1) ? sp.tile_of[ti * sp.tiles_j + tj-1] : -1;
+            nb[3] = tj < sp.tiles_j-1 && (any >> (SPARSE_COLS-1)) ? sp.tile_of[ti * sp.tiles_j + tj+1] : -1;
+        }
+    free( keep );
+
+    sp.nghosts = grid.nghosts;
+    sp.ghosts = (int *) malloc( 3 * grid.nghosts * sizeof(int) );
+    for( int g = 0; g < 3 * grid.nghosts; g++ )
+        sp.ghosts[g] = sparse_offset( sp, grid.ghosts[g] / ld - 1, grid.ghosts[g] % ld - 1 );
+}
+
+template <typename real>
+void free_sparse( sparse_t<real> &sp )
+{
+    free( sp.tile_of );
+    free( sp.neighbours );
+    free( sp.mask );
+    free( sp.solid );
+    free_aligned( sp.T );
+    free_aligned( sp.T_next );
+    free( sp.ghosts );
+}
+
+template <typename real>
+void swap_sparse( sparse_t<real> &sp )
+{
+    real *tmp = sp.T;
+    sp.T = sp.T_next;
+    sp.T_next = tmp;
+}
+
+template <typename real>
+void fill_sparse_ghosts( const sparse_t<real> &sp )
+{
+    for( int g = 0; g < sp.nghosts; g++ )
+    {
+        const int *ghost = &sp.ghosts[3*g];
+        sp.T[ghost[0]] = 0.5 * (sp.T[ghost[1]] + sp.T[ghost[2]]);
+    }
+}
+
+//
+//  Copy the halo columns of tile t of T from its neighbours, whose own
+//  nodes a step does not write
+//
+template <typename real>
+inline __attribute__((always_inline))
+void sparse_halo( const sparse_t<real> &sp, int t )
+{
+    real *T = &sp.T[t * SPARSE_SIZE];
+    const int *nb = &sp.neighbours[4*t];
+    if( nb[2] >= 0 )
+    {
+        const real *left = &sp.T[nb[2] * SPARSE_SIZE + SPARSE_COLS];
+        for( int i = 0; i < SPARSE_SIZE; i += SPARSE_LD )
+            T[i] = left[i];
+    }
+    if( nb[3] >= 0 )
+    {
+        const real *right = &sp.T[nb[3] * SPARSE_SIZE + 1];
+        for( int i = 0; i < SPARSE_SIZE; i += SPARSE_LD )
+            T[i + SPARSE_COLS+1] = right[i];
+    }
+}
+
+//
+//  Nodes [jbegin, jend) of one row, or only those whose bit is set in w
+//  if masked; up and down are the rows above and below
+//
+template <typename acc, bool mean, bool masked, typename real>
+inline __attribute__((always_inline))
+void step_sparse_row( const real * __restrict__ up, const real * __restrict__ T, const real * __restrict__ down,
+                      real * __restrict__ T_next, int jbegin, int jend, sparse_mask_t w, acc d )
+{
+    for( int j = jbegin; j < jend; j++ )
+    {
+        acc sum = (acc) up[j] + down[j] + T[j - 1] + T[j + 1];
+        real next = mean ? (real) (sum / 4) : (real) (T[j] + d * (sum - 4 * (acc) T[j]));
+        T_next[j] = !masked || (w >> j & 1) ? next : T[j];
+    }
+}
+
+//
+//  A row whose updated nodes are one run takes the plain loop over the
+//  run; only scattered ones are blended under their mask
+//
+template <typename acc, bool mean, typename real>
+inline __attribute__((always_inline))
+void step_sparse_tile( const sparse_t<real> &sp, int t, acc d )
+{
+    const int *nb = &sp.neighbours[4*t];
+    const real *T = &sp.T[t * SPARSE_SIZE + 1];
+    real *T_next = &sp.T_next[t * SPARSE_SIZE + 1];
+    const sparse_mask_t *mask = &sp.mask[t * SPARSE_ROWS];
+    const real *above = nb[0] >= 0 ? &sp.T[nb[0] * SPARSE_SIZE + SPARSE_SIZE - SPARSE_LD + 1] : T;
+    const real *below = nb[1] >= 0 ? &sp.T[nb[1] * SPARSE_SIZE + 1] : T;
+    for( int i = 0; i < SPARSE_ROWS; i++ )
+    {
+        const sparse_mask_t w = mask[i];
+        if( !w )
+            continue;
+        const int row = i * SPARSE_LD;
+        const real *up = i > 0 ? &T[row - SPARSE_LD] : above;
+        const real *down = i < SPARSE_ROWS-1 ? &T[row + SPARSE_LD] : below;
+        const int jbegin = __builtin_ctzll( w );
+        const int jend = 64 - __builtin_clzll( w );
+        if( w == SPARSE_FULL )
+            step_sparse_row<acc, mean, false>( up, &T[row], down, &T_next[row], 0, SPARSE_COLS, w, d );
+        else if( (w >> jbegin) + 1 == (sparse_mask_t) 1 << (jend - jbegin) )
+            step_sparse_row<acc, mean, false>( up, &T[row], down, &T_next[row], jbegin, jend, w, d );
+        else
+            step_sparse_row<acc, mean, true>( up, &T[row], down, &T_next[row], jbegin, jend, w, d );
+    }
+}
+
+template <typename acc, typename real>
+inline __attribute__((always_inline))
+void step_sparse_any( const sparse_t<real> &sp, int tbegin, int tend )
+{
+    const bool mean = sp.r == 0.25;
+    const acc d = (acc) sp.r;
+    for( int t = tbegin; t < tend; t++ )
+    {
+        sparse_halo( sp, t );
+        if( mean )
+            step_sparse_tile<acc, true>( sp, t, d );
+        else
+            step_sparse_tile<acc, false>( sp, t, d );
+    }
+}
+
+template <typename acc, class Sparse>
+void step_sparse_scalar( const Sparse &sp, int tbegin, int tend )
+{
+    step_sparse_any<acc>( sp, tbegin, tend );
+}
+
+template <typename acc, class Sparse>
+__attribute__((target("avx2,fma")))
+void step_sparse_avx2( const Sparse &sp, int tbegin, int tend )
+{
+    step_sparse_any<acc>( sp, tbegin, tend );
+}
+
+template <typename acc, class Sparse>
+__attribute__((target("avx512f")))
+void step_sparse_avx512( const Sparse &sp, int tbegin, int tend )
+{
+    step_sparse_any<acc>( sp, tbegin, tend );
+}
+
+//
+//  hot kernel: advance tiles [tbegin, tend) by one step, reading sp.T
+//  and writing sp.T_next; the ghosts of sp.T must be filled
+//
+template <class Sparse>
+inline void step_sparse( const Sparse &sp, int tbegin, int tend )
+{
+    typedef typename Sparse::real_t acc;
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        step_sparse_avx512<acc>( sp, tbegin, tend );
+        break;
+    case KERNEL_AVX2:
+        step_sparse_avx2<acc>( sp, tbegin, tend );
+        break;
+    default:
+        step_sparse_scalar<acc>( sp, tbegin, tend );
+    }
+}
+
+//
+//  The change of the last step over the updated nodes of tiles
+//  [tbegin, tend), as change_rows( ) for the mesh
+//
+template <typename real>
+void change_sparse( const sparse_t<real> &sp, int tbegin, int tend, double &largest, double &sq )
+{
+    double m = largest, s = sq;
+    for( int t = tbegin; t < tend; t++ )
+        for( int i = 0; i < SPARSE_ROWS; i++ )
+        {
+            const sparse_mask_t w = sp.mask[t * SPARSE_ROWS + i];
+            const int row = t * SPARSE_SIZE + i * SPARSE_LD + 1;
+            for( int j = 0; j < SPARSE_COLS; j++ )
+                if( w >> j & 1 )
+                {
+                    double d = (double) sp.T[row + j] - sp.T_next[row + j];
+                    m = fmax( m, fabs( d ) );
+                    s += d * d;
+                }
+        }
+    largest = m;
+    sq = s;
+}
+
+template <typename real>
+bool check_step( converge_t &conv, const sparse_t<real> &sp, int step )
+{
+    if( !check_due( conv, step ) )
+        return false;
+    double largest = 0, sq = 0;
+    change_sparse( sp, 0, sp.ntiles, largest, sq );
+    end_check( conv, step, largest, sq );
+    return converged( conv );
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef __HEAT_SPECTRAL_H__
+#define __HEAT_SPECTRAL_H__
+
+#include <math.h>
+#include "mesh.h"
+#include "fft.h"
+
+//
+//  spectral solution for a 2D box whose edges are all fixed
+//
+//  On the m = n-2 updated nodes of each axis, L = 4 - (sum of the 4
+//  neighbours) is diagonalized by the type I sine transform of fft.h:
+//  mode (p, q) has the eigenvalue lambda_p + lambda_q, with
+//  lambda_p = 2 - 2 cos( pi (p+1) / (m+1) ). With b the fixed
+//  neighbours plus the source term of every updated node, the steady
+//  state solves L u = b, and the field evolves under
+//  du/dt = a (b - L u), with a = alpha / h^2, as
+//
+//      u(t) = u_ss + exp( -a t L ) (u(0) - u_ss)
+//
+//  so spectral_solve( ) transforms b and u(0), scales every mode and
+//  transforms back, in O(n^2 log n) whatever t, and exactly up to
+//  rounding: the field at t is the limit of explicit steps of length
+//  dt as dt goes to 0, and t = INFINITY gives the steady state.
+//
+//  A 2D transform takes the rows, transposes, takes the rows again and
+//  transposes back, so every line is contiguous when it is transformed.
+//  The loops are orphaned omp for constructs, as in multigrid.h.
+//
+const int SPECTRAL_CHUNK = 32;
+
+struct spectral_t
+{
+    int m;
+    dst_t dst;
+    double *lambda;
+    double *decay;      // exp( -a t lambda_p )
+    double *u;          // m*m, the field and then its modes
+    double *b;
+    double *tmp;
+};
+
+template <class Mesh>
+void init_spectral( spectral_t &sp, const Mesh &grid )
+{
+    int n = grid.n;
+    assert( Mesh::dim == 2 && grid.nghosts == 0 );
+    for( int i = 1; i < n-1; i++ )
+        assert( grid.row_begin[i] == 1 && grid.row_end[i] == n-1 && !grid.row_gaps[i] );
+
+    int m = sp.m = n-2;
+    init_dst( sp.dst, m );
+    sp.lambda = alloc_aligned<double>( m );
+    sp.decay = alloc_aligned<double>( m );
+    for( int p = 0; p < m; p++ )
+        sp.lambda[p] = 2 - 2 * cos( M_PI * (p+1) / (m+1) );
+    sp.u = alloc_aligned<double>( m*m );
+    sp.b = alloc_aligned<double>( m*m );
+    sp.tmp = alloc_aligned<double>( m*m );
+}
+
+inline void free_spectral( spectral_t &sp )
+{
+    free_dst( sp.dst );
+    free_aligned( sp.lambda );
+    free_aligned( sp.decay );
+    free_aligned( sp.u );
+    free_aligned( sp.b );
+    free_aligned( sp.tmp );
+}
+
+//
+//  Transform the rows of the m*m array v, two at a time, and write them
+//  transposed to vt
+//
+inline void spectral_rows( const spectral_t &sp, double *v, double *vt )
+{
+    const int m = sp.m;
+
+    #pragma omp for
+    for( int i0 = 0; i0 < m; i0 += SPECTRAL_CHUNK )
+    {
+        double *work = alloc_aligned<double>( dst_work( sp.dst ) + 1 );
+        for( int i = i0; i < min( m, i0 + SPECTRAL_CHUNK ); i += 2 )
+            dst_lines( sp.dst, &v[i*m], i+1 < m ? &v[(i+1)*m] : NULL, work );
+        free_aligned( work );
+    }
+
+    #pragma omp for
+    for( int i0 = 0; i0 < m; i0 += SPECTRAL_CHUNK )
+        for( int j0 = 0; j0 < m; j0 += SPECTRAL_CHUNK )
+            for( int i = i0; i < min( m, i0 + SPECTRAL_CHUNK ); i++ )
+                for( int j = j0; j < min( m, j0 + SPECTRAL_CHUNK ); j++ )
+                    vt[j*m + i] = v[i*m + j];
+}
+
+//
+//  The 2D transform of v in place, through vt
+//
+inline void spectral_transform( const spectral_t &sp, double *v, double *vt )
+{
+    spectral_rows( sp, v, vt );
+    spectral_rows( sp, vt, v );
+}
+
+//
+//  Replace the field of grid by the one it evolves into after time
+//  seconds, with a = alpha / h^2, or by the steady state if time is
+//  INFINITY
+//
+template <class Mesh>
+void spectral_solve( spectral_t &sp, Mesh &grid, double a, double time )
+{
+    typedef typename Mesh::real_t real;
+    const int m = sp.m;
+    const bool steady = isinf( time );
+
+    // the updated nodes, and their fixed neighbours and source term
+    #pragma omp for
+    for( int i = 0; i < m; i++ )
+        for( int j = 0; j < m; j++ )
+        {
+            int idx = node_index( grid, i+1, j+1 );
+            double b = grid.source.add( 0.0, idx );
+            if( i == 0 )
+                b += grid.T[idx - grid.ld];
+            if( i == m-1 )
+                b += grid.T[idx + grid.ld];
+            if( j == 0 )
+                b += grid.T[idx - 1];
+            if( j == m-1 )
+                b += grid.T[idx + 1];
+            sp.b[i*m + j] = b;
+            sp.u[i*m + j] = grid.T[idx];
+        }
+    #pragma omp single
+    for( int k = 0; k < grid.source.points( ); k++ )
+    {
+        int idx = grid.source.point( k );
+        sp.b[(idx / grid.ld - 2)*m + idx % grid.ld - 2] += grid.source.point_term( k );
+    }
+
+    #pragma omp for
+    for( int p = 0; p < m; p++ )
+        sp.decay[p] = steady ? 0 : exp( -a * time * sp.lambda[p] );
+
+    // modes of b into b, and of u(0) into u
+    spectral_transform( sp, sp.b, sp.tmp );
+    if( !steady )
+        spectral_transform( sp, sp.u, sp.tmp );
+
+    // a transform applied twice scales by (2 (m+1))^2
+    const double scale = 1 / (4.0 * (m+1) * (m+1));
+    #pragma omp for
+    for( int p = 0; p < m; p++ )
+        for( int q = 0; q < m; q++ )
+        {
+            double g = sp.decay[p] * sp.decay[q];
+            double ss = sp.b[p*m + q] / (sp.lambda[p] + sp.lambda[q]);
+            sp.u[p*m + q] = scale * (steady ? ss : ss + g * (sp.u[p*m + q] - ss));
+        }
+
+    spectral_transform( sp, sp.u, sp.tmp );
+
+    #pragma omp for
+    for( int i = 0; i < m; i++ )
+        for( int j = 0; j < m; j++ )
+        {
+            int idx = node_index( grid, i+1, j+1 );
+            grid.T[idx] = grid.T_next[idx] = (real) sp.u[i*m + j];
+        }
+}
+
+#endif
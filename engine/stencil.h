@@ -0,0 +1,337 @@
+#ifndef __HEAT_STENCIL_H__
+#define __HEAT_STENCIL_H__
+
+#include <string.h>
+#include "mesh.h"
+
+//
+//  stencil kernel
+//  every updated node becomes the mean of its 2*DIM neighbours, summed
+//  as acc in the same order by every version: the outer axes first, the
+//  contiguous one last. A step with a diffusion number grid.r below
+//  1 / (2*DIM) only moves the node that fraction of the way,
+//  T + r (sum - 2*DIM T). The loop is left to the compiler to vectorize,
+//  once for each ISA. Point sources are left out of the loop:
+//  step_points( ) adds r times their term to their nodes once the rows
+//  are done.
+//
+//  Rows [rbegin, rend) are advanced, each only over the part of its
+//  updated span that lies in [jlo, jhi). A span with gaps is swept
+//  whole and blended with the old values under the mask of its flags,
+//  so the nodes in its gaps are rewritten unchanged; its ghosts are
+//  refreshed after it for that (see find_ghosts( )).
+//
+template <typename acc, int DIM, typename real>
+inline __attribute__((always_inline))
+acc neighbour_sum( const real *T, int j, int ld, int plane )
+{
+    if( DIM == 1 )
+        return (acc) T[j - 1] + T[j + 1];
+    if( DIM == 2 )
+        return (acc) T[j - ld] + T[j + ld] + T[j - 1] + T[j + 1];
+    return (acc) T[j - plane] + T[j + plane] + T[j - ld] + T[j + ld] + T[j - 1] + T[j + 1];
+}
+
+//
+//  next at an updated node and old elsewhere, chosen on the bits: the
+//  compilers do not vectorize a branch around floating point arithmetic,
+//  and AVX2 has no byte masks for doubles, but they vectorize this
+//
+template <int size> struct bits_of;
+template <> struct bits_of<4> { typedef unsigned int type; };
+template <> struct bits_of<8> { typedef unsigned long long type; };
+
+template <typename real>
+inline __attribute__((always_inline))
+real select_updated( unsigned char flags, real next, real old )
+{
+    typedef typename bits_of<sizeof(real)>::type bits;
+    bits mask = (bits) 0 - (bits) !(flags & NOT_UPDATED);
+    bits a, b;
+    memcpy( &a, &next, sizeof(real) );
+    memcpy( &b, &old, sizeof(real) );
+    a = (a & mask) | (b & ~mask);
+    memcpy( &next, &a, sizeof(real) );
+    return next;
+}
+
+//
+//  A span with gaps: the nodes that are not updated keep their value
+//
+template <typename acc, int DIM, typename real, class B, class Source>
+inline __attribute__((always_inline))
+void step_gaps( const mesh_t<DIM, real, B, Source> &grid, int row, int jbegin, int jend, bool mean, acc d )
+{
+    const int ld = grid.ld;
+    const int plane = grid.plane;
+    const Source source = grid.source;
+    const real * __restrict__ T = &grid.T[row];
+    real * __restrict__ T_next = &grid.T_next[row];
+    const unsigned char * __restrict__ flags = &grid.flags[row];
+    if( mean )
+        for( int j = jbegin; j < jend; j++ )
+        {
+            acc sum = neighbour_sum<acc, DIM>( T, j, ld, plane );
+            T_next[j] = select_updated( flags[j], (real) (source.add( sum, row + j ) / (2*DIM)), T[j] );
+        }
+    else
+        for( int j = jbegin; j < jend; j++ )
+        {
+            acc sum = neighbour_sum<acc, DIM>( T, j, ld, plane );
+            T_next[j] = select_updated( flags[j], (real) (T[j] + d * (source.add( sum, row + j ) - 2*DIM * (acc) T[j])), T[j] );
+        }
+}
+
+template <typename acc, int DIM, typename real, class B, class Source>
+inline __attribute__((always_inline))
+void step_block_any( const mesh_t<DIM, real, B, Source> &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    const int ld = grid.ld;
+    const int plane = grid.plane;
+    const Source source = grid.source;
+    const bool mean = grid.r == 1.0 / (2*DIM);
+    const acc d = (acc) grid.r;
+    for( int r = rbegin; r < rend; r++ )
+    {
+        const int row = row_index( grid, r );
+        const real * __restrict__ T = &grid.T[row];
+        real * __restrict__ T_next = &grid.T_next[row];
+        const int jbegin = max( grid.row_begin[r], jlo );
+        const int jend = min( grid.row_end[r], jhi );
+        if( grid.row_gaps[r] )
+            step_gaps( grid, row, jbegin, jend, mean, d );
+        else if( mean )
+            for( int j = jbegin; j < jend; j++ )
+            {
+                acc sum = neighbour_sum<acc, DIM>( T, j, ld, plane );
+                T_next[j] = (real) (source.add( sum, row + j ) / (2*DIM));
+            }
+        else
+            for( int j = jbegin; j < jend; j++ )
+            {
+                acc sum = neighbour_sum<acc, DIM>( T, j, ld, plane );
+                T_next[j] = (real) (T[j] + d * (source.add( sum, row + j ) - 2*DIM * (acc) T[j]));
+            }
+    }
+}
+
+template <typename acc, class Mesh>
+void step_block_scalar( const Mesh &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    step_block_any<acc>( grid, rbegin, rend, jlo, jhi );
+}
+
+template <typename acc, class Mesh>
+__attribute__((target("avx2,fma")))
+void step_block_avx2( const Mesh &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    step_block_any<acc>( grid, rbegin, rend, jlo, jhi );
+}
+
+template <typename acc, class Mesh>
+__attribute__((target("avx512f")))
+void step_block_avx512( const Mesh &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    step_block_any<acc>( grid, rbegin, rend, jlo, jhi );
+}
+
+//
+//  the kernel version in use, set once by init_kernels( )
+//
+enum kernel_isa_t { KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512 };
+
+inline kernel_isa_t &kernel_isa( )
+{
+    static kernel_isa_t isa = KERNEL_SCALAR;
+    return isa;
+}
+
+//
+//  Pick the widest kernel this CPU runs, or the one asked for by name,
+//  and return its name
+//
+inline const char *init_kernels( const char *name )
+{
+    __builtin_cpu_init( );
+    bool avx512 = __builtin_cpu_supports( "avx512f" );
+    bool avx2 = __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+
+    if( name )
+    {
+        avx512 = avx512 && strcmp( name, "avx512" ) == 0;
+        avx2 = avx2 && strcmp( name, "avx2" ) == 0;
+    }
+
+    kernel_isa( ) = avx512 ? KERNEL_AVX512 : avx2 ? KERNEL_AVX2 : KERNEL_SCALAR;
+    return avx512 ? "avx512" : avx2 ? "avx2" : "scalar";
+}
+
+//
+//  Add the point sources in rows [rbegin, rend), within [jlo, jhi), to
+//  the step just taken
+//
+template <class Mesh>
+void step_points( const Mesh &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    typedef typename Mesh::real_t real;
+    const int np = grid.source.points( );
+    if( np == 0 || rbegin >= rend )
+        return;
+    const int end = row_index( grid, rend - 1 ) + jhi;
+    for( int k = first_point( grid.source, row_index( grid, rbegin ) + jlo ); k < np && grid.source.point( k ) < end; k++ )
+    {
+        int idx = grid.source.point( k );
+        int j = idx % grid.ld - 1;
+        if( j >= jlo && j < jhi )
+            grid.T_next[idx] += (real) (grid.r * grid.source.point_term( k ));
+    }
+}
+
+template <typename acc, class Mesh>
+inline void step_block( const Mesh &grid, int rbegin, int rend, int jlo, int jhi )
+{
+    switch( kernel_isa( ) )
+    {
+    case KERNEL_AVX512:
+        step_block_avx512<acc>( grid, rbegin, rend, jlo, jhi );
+        break;
+    case KERNEL_AVX2:
+        step_block_avx2<acc>( grid, rbegin, rend, jlo, jhi );
+        break;
+    default:
+        step_block_scalar<acc>( grid, rbegin, rend, jlo, jhi );
+    }
+    step_points( grid, rbegin, rend, jlo, jhi );
+}
+
+//
+//  hot kernels: advance rows [rbegin, rend), or nodes [jbegin, jend)
+//  of row r, by one step, reading grid.T and writing grid.T_next with
+//  the stencil summed as acc (by default as the stored type). Nodes
+//  that are not updated are skipped.
+//
+template <typename acc, class Mesh>
+inline void step_rows( const Mesh &grid, int rbegin, int rend )
+{
+    step_block<acc>( grid, rbegin, rend, 0, grid.n );
+}
+
+template <class Mesh>
+inline void step_rows( const Mesh &grid, int rbegin, int rend )
+{
+    step_block<typename Mesh::real_t>( grid, rbegin, rend, 0, grid.n );
+}
+
+template <typename acc, class Mesh>
+inline void step_nodes( const Mesh &grid, int r, int jbegin, int jend )
+{
+    step_block<acc>( grid, r, r+1, jbegin, jend );
+}
+
+template <class Mesh>
+inline void step_nodes( const Mesh &grid, int r, int jbegin, int jend )
+{
+    step_block<typename Mesh::real_t>( grid, r, r+1, jbegin, jend );
+}
+
+//
+//  temporal blocking: steps are advanced in space-time tiles. A tile
+//  covers steps k0+1 to k0+nsteps and the planes [pbegin, pend) at its
+//  first step, shifted down by SWEEP_SKEW planes per step, and is swept
+//  once down the planes with step m running SWEEP_SKEW planes behind
+//  step m-1, so each plane is reused nsteps times while it is still in
+//  cache. In 3D a plane is too big for that, so the tile is also cut
+//  into blocks of width rows of every plane, shifted by one row per
+//  step, and swept once per block; only a few planes of one block are
+//  live at a time.
+//
+//  step_level( ) computes rows [rbegin, rend) of step k and refreshes
+//  the ghosts they feed last. Steps alternate between the two buffers,
+//  so step k reads the buffer written by step k-1 and overwrites step
+//  k-2, which the skews guarantee step k-1 has finished reading there.
+//  A ghost is refreshed with its last source row, so a ghost fed by
+//  two rows must have both in one block.
+//
+const int SWEEP_SKEW = 2;
+
+template <typename acc, class Mesh>
+void step_level( const Mesh &grid, int k, int rbegin, int rend )
+{
+    Mesh level = grid;
+    if( k % 2 == 0 )
+    {
+        level.T = grid.T_next;
+        level.T_next = grid.T;
+    }
+    step_rows<acc>( level, rbegin, rend );
+
+    typename Mesh::real_t *T = level.T_next;
+    for (int g = grid.ghost_start[rbegin]; g < grid.ghost_start[rend]; g++) {
+        int *ghost = &grid.ghosts[3*g];
+        T[ghost[0]] = 0.5 * (T[ghost[1]] + T[ghost[2]]);
+    }
+}
+
+template <typename acc, class Mesh>
+void step_tile( const Mesh &grid, int k0, int nsteps, int pbegin, int pend, int width )
+{
+    int per_plane = grid.rows / grid.planes;
+    int shift = per_plane > 1 ? 1 : 0;
+    int blocks = (per_plane + shift * (nsteps-1) + width - 1) / width;
+    for (int b = 0; b < blocks; b++) {
+        for (int s = pbegin; s < pend; s++) {
+            for (int m = 1; m <= nsteps; m++) {
+                int i = s - SWEEP_SKEW * (m-1);
+                if (i < 0 || i >= grid.planes)
+                    continue;
+                int jbegin = max( b * width - shift * (m-1), 0 );
+                int jend = min( (b+1) * width - shift * (m-1), per_plane );
+                if (jbegin < jend)
+                    step_level<acc>( grid, k0 + m, i * per_plane + jbegin, i * per_plane + jend );
+            }
+        }
+    }
+}
+
+//
+//  Advance nsteps steps in one tile covering the whole grid
+//
+template <typename acc, class Mesh>
+void step_blocked( Mesh &grid, int nsteps, int width )
+{
+    step_tile<acc>( grid, 0, nsteps, 0, grid.planes + SWEEP_SKEW * (nsteps-1), width );
+    if (nsteps % 2)
+        swap_grid( grid );
+}
+
+template <typename acc, class Mesh>
+void step_blocked( Mesh &grid, int nsteps )
+{
+    step_blocked<acc>( grid, nsteps, grid.rows / grid.planes );
+}
+
+//
+//  rows per block that keep the planes live in a sweep of depth steps,
+//  about SWEEP_SKEW * depth + 3 of them, within 256 KB of cache
+//
+template <class Mesh>
+inline int block_width( const Mesh &grid, int depth )
+{
+    int row = grid.ld * sizeof(typename Mesh::real_t);
+    return max( (256 << 10) / ((SWEEP_SKEW * depth + 3) * row), 1 );
+}
+
+//
+//  steps to advance from step, at most depth, so that a run of nsteps
+//  steps saving every savefreq steps (never if 0) ends a sweep at
+//  every saved step
+//
+inline int sweep_len( int step, int depth, int nsteps, int savefreq )
+{
+    int len = min( depth, nsteps - step );
+    if( savefreq > 0 )
+        len = min( len, (savefreq - step % savefreq) % savefreq + 1 );
+    return len;
+}
+
+#endif
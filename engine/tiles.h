@@ -0,0 +1,97 @@
+#ifndef __HEAT_TILES_H__
+#define __HEAT_TILES_H__
+
+#include <sched.h>
+#include "stencil.h"
+
+//
+//  OpenMP schedule of the space-time tiles of stencil.h, for the
+//  threaded drivers
+//
+
+//
+//  Wait until another thread has raised *counter to at least value
+//
+inline void wait_for( int *counter, int value )
+{
+    while( true )
+    {
+        int current;
+        #pragma omp atomic read seq_cst
+        current = *counter;
+        if( current >= value )
+            return;
+        sched_yield( );
+    }
+}
+
+inline int claim( int *next )
+{
+    int ticket;
+    #pragma omp atomic capture seq_cst
+    ticket = (*next)++;
+    return ticket;
+}
+
+//
+//  bands of height planes need this many pass counters
+//
+template <class Mesh>
+inline int tile_bands( const Mesh &grid, int depth, int height )
+{
+    return (grid.planes + SWEEP_SKEW * (depth-1) + height - 1) / height;
+}
+
+//
+//  Advance nsteps steps in space-time tiles; called by every thread of
+//  the team. The steps are cut into passes of depth steps and the planes
+//  into bands of height planes (at least SWEEP_SKEW * depth), so tile
+//  (p, c) is band p of pass c, swept by step_tile( ) in blocks of width
+//  rows. It needs only tile (p-1, c) and tile (p+1, c-1), so all tiles
+//  with the same p + 2c are independent. Threads claim tiles in that
+//  order and wait on the two tiles before them instead of on a barrier.
+//  passes[p] counts the passes done in band p and *next hands out the
+//  tiles.
+//
+template <typename acc, class Mesh>
+void step_tiles( Mesh &grid, int nsteps, int depth, int height, int width, int *passes, int *next )
+{
+    int bands = tile_bands( grid, depth, height );
+    int npasses = (nsteps + depth - 1) / depth;
+
+    int mine = claim( next );
+    int tile = 0;
+    for( int w = 0; w <= bands + 2 * npasses - 3; w++ )
+    {
+        for( int c = max( 0, (w - bands + 2) / 2 ); c <= min( npasses - 1, w / 2 ); c++, tile++ )
+        {
+            if( tile != mine )
+                continue;
+
+            int p = w - 2*c;
+            if( p > 0 )
+                wait_for( &passes[p-1], c+1 );
+            if( p+1 < bands )
+                wait_for( &passes[p+1], c );
+
+            int levels = min( depth, nsteps - c * depth );
+            step_tile<acc>( grid, c * depth, levels, p * height, (p+1) * height, width );
+
+            #pragma omp atomic write seq_cst
+            passes[p] = c+1;
+            mine = claim( next );
+        }
+    }
+
+    #pragma omp barrier
+    #pragma omp single
+    {
+      if( nsteps % 2 )
+        swap_grid( grid );
+      for( int p = 0; p < bands; p++ )
+        passes[p] = 0;
+      *next = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __HEAT_TIMESTEP_H__
+#define __HEAT_TIMESTEP_H__
+
+#include <math.h>
+#include "mesh.h"
+
+//
+//  physically scaled explicit steps
+//  With a thermal diffusivity alpha (m^2/s) and nodes grid.h apart, a
+//  step of dt seconds has the diffusion number r = alpha dt / h^2, and
+//  the explicit scheme of stencil.h is stable up to r = 1 / (2*DIM), so
+//  up to dt_max = h^2 / (2*DIM alpha). A run advances to the physical
+//  time end, in fixed steps of dt (dt_max unless a shorter step is
+//  asked for) or in adaptive ones: starting from dt, every step is
+//  scaled by TIMESTEP_SAFETY * tol / change, within [1/2, 2], so that
+//  the largest change of a step stays near tol kelvin, and is never
+//  taken beyond dt_max. Fast transients then get short steps, and the
+//  steps grow to the stability limit as they decay. The last step is
+//  cut short to land on end.
+//
+const double TIMESTEP_SAFETY = 0.9;
+
+struct timestep_t
+{
+    double alpha;
+    double h;
+    double dt;          // of the next step, before it is cut short
+    double dt_max;
+    double tol;         // 0 for fixed steps
+    double end;
+    double time;        // reached so far
+    double step;        // length of the step being taken
+    int steps;
+    double shortest;
+    double longest;
+};
+
+template <class Mesh>
+void init_timestep( timestep_t &ts, const Mesh &grid, double alpha, double dt, double tol, double end )
+{
+    ts.alpha = alpha;
+    ts.h = grid.h;
+    ts.dt_max = grid.h * grid.h / (2*Mesh::dim * alpha);
+    ts.dt = dt > 0 ? fmin( dt, ts.dt_max ) : ts.dt_max;
+    ts.tol = tol;
+    ts.end = end;
+    ts.time = 0;
+    ts.step = 0;
+    ts.steps = 0;
+    ts.shortest = ts.dt;
+    ts.longest = 0;
+}
+
+inline bool reached( const timestep_t &ts )
+{
+    return ts.end - ts.time <= 1e-12 * ts.end;
+}
+
+//
+//  Set grid up for the next step; a step of dt_max keeps the exact mean
+//  of the neighbours
+//
+template <class Mesh>
+void begin_step( timestep_t &ts, Mesh &grid )
+{
+    ts.step = fmin( ts.dt, ts.end - ts.time );
+    if( ts.step >= ts.dt_max )
+        grid.r = 1.0 / (2*Mesh::dim);
+    else
+        grid.r = ts.alpha * ts.step / (ts.h * ts.h);
+}
+
+//
+//  Account for the step just taken, which changed no node by more than
+//  change, and pick the next one
+//
+inline void end_step( timestep_t &ts, double change )
+{
+    ts.time += ts.step;
+    ts.steps++;
+    ts.shortest = fmin( ts.shortest, ts.step );
+    ts.longest = fmax( ts.longest, ts.step );
+    if( ts.tol > 0 && change > 0 )
+        ts.dt = fmin( ts.dt_max, ts.dt * fmin( 2.0, fmax( 0.5, TIMESTEP_SAFETY * ts.tol / change ) ) );
+    else if( ts.tol > 0 )
+        ts.dt = fmin( ts.dt_max, 2 * ts.dt );
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef __HEAT_UTIL_H__
+#define __HEAT_UTIL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+inline int min( int a, int b ) { return a < b ? a : b; }
+inline int max( int a, int b ) { return a > b ? a : b; }
+
+//
+//  qsort( ) order of unsigned long long keys
+//
+inline int compare_keys( const void *a, const void *b )
+{
+    unsigned long long ka = *(const unsigned long long *) a, kb = *(const unsigned long long *) b;
+    return ka < kb ? -1 : ka > kb;
+}
+
+//
+//  arena for the big arrays: fields, their halos and message buffers
+//  Every region is 64-byte aligned; one of ARENA_HUGE bytes or more is
+//  aligned and rounded up to whole 2 MB pages and asked to be backed by
+//  transparent huge pages, so a jump from row to row does not miss the
+//  TLB. A region given back by free_aligned( ) is kept, and handed out
+//  again to the next request it fits with no more than half of it to
+//  spare, so buffers are reused across steps and runs rather than
+//  mapped anew. The arena counts the bytes handed out and held, and
+//  their peaks, to size jobs by. Regions come from posix_memalign( ),
+//  so free( ) still releases one, but only free_aligned( ) keeps the
+//  counts right. Threads share it under a critical section.
+//
+const size_t ARENA_HUGE = 2 << 20;
+
+struct arena_region_t
+{
+    void *p;
+    size_t bytes;
+    bool used;
+};
+
+struct arena_t
+{
+    int count;
+    int capacity;
+    arena_region_t *region;
+    size_t used;
+    size_t held;
+    size_t peak_used;
+    size_t peak_held;
+};
+
+inline arena_t &arena( )
+{
+    static arena_t a = { 0, 0, NULL, 0, 0, 0, 0 };
+    return a;
+}
+
+inline void *arena_alloc( size_t bytes )
+{
+    const size_t align = bytes >= ARENA_HUGE ? ARENA_HUGE : 64;
+    bytes = (bytes + align - 1) & ~(align - 1);
+    void *p = NULL;
+
+    #pragma omp critical(arena)
+    {
+        arena_t &a = arena( );
+        int best = -1;
+        for( int k = 0; k < a.count; k++ )
+        {
+            const arena_region_t &r = a.region[k];
+            if( !r.used && r.bytes >= bytes && r.bytes <= 2*bytes && (best < 0 || r.bytes < a.region[best].bytes) )
+                best = k;
+        }
+        if( best < 0 && posix_memalign( &p, align, bytes ) == 0 )
+        {
+            if( align == ARENA_HUGE )
+                madvise( p, bytes, MADV_HUGEPAGE );
+            if( a.count == a.capacity )
+            {
+                a.capacity = max( 2*a.capacity, 64 );
+                a.region = (arena_region_t *) realloc( a.region, a.capacity * sizeof(arena_region_t) );
+            }
+            arena_region_t fresh = { p, bytes, false };
+            a.region[best = a.count++] = fresh;
+            a.held += bytes;
+        }
+        if( best >= 0 )
+        {
+            a.region[best].used = true;
+            p = a.region[best].p;
+            a.used += a.region[best].bytes;
+            a.peak_used = a.used > a.peak_used ? a.used : a.peak_used;
+            a.peak_held = a.held > a.peak_held ? a.held : a.peak_held;
+        }
+    }
+    return p;
+}
+
+//
+//  Give a region back to the arena, or to free( ) if it is not one
+//
+inline void free_aligned( void *p )
+{
+    if( !p )
+        return;
+    bool found = false;
+
+    #pragma omp critical(arena)
+    {
+        arena_t &a = arena( );
+        for( int k = 0; k < a.count && !found; k++ )
+            if( a.region[k].p == p && a.region[k].used )
+            {
+                a.region[k].used = false;
+                a.used -= a.region[k].bytes;
+                found = true;
+            }
+    }
+    if( !found )
+        free( p );
+}
+
+//
+//  One line for the run summary
+//
+inline void print_memory( )
+{
+    const arena_t &a = arena( );
+    printf( "memory peak = %.1f MB in use, %.1f MB held in %d regions\n",
+            a.peak_used / 1048576.0, a.peak_held / 1048576.0, a.count );
+}
+
+//
+//  Allocate a zeroed array from the arena...
+//
+template <typename real>
+inline real *alloc_aligned( int size )
+{
+    void *p = arena_alloc( (size_t) size * sizeof(real) );
+    if( p )
+        memset( p, 0, (size_t) size * sizeof(real) );
+    return (real *) p;
+}
+
+//
+//  ... or leave it unwritten, so each page is placed on the NUMA node
+//  of the thread that first writes it (unless the region is reused)
+//
+template <typename real>
+inline real *alloc_untouched( int size )
+{
+    return (real *) arena_alloc( (size_t) size * sizeof(real) );
+}
+
+//
+//  timer
+//
+inline double read_timer( )
+{
+    static bool initialized = false;
+    static struct timeval start;
+    struct timeval end;
+    if( !initialized )
+    {
+        gettimeofday( &start, NULL );
+        initialized = true;
+    }
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+}
+
+//
+//  command line option processing
+//
+inline int find_option( int argc, char **argv, const char *option )
+{
+    for( int i = 1; i < argc; i++ )
+        if( strcmp( argv[i], option ) == 0 )
+            return i;
+    return -1;
+}
+
+inline int read_int( int argc, char **argv, const char *option, int default_value )
+{
+    int iplace = find_option( argc, argv, option );
+    if( iplace >= 0 && iplace < argc-1 )
+        return atoi( argv[iplace+1] );
+    return default_value;
+}
+
+inline double read_double( int argc, char **argv, const char *option, double default_value )
+{
+    int iplace = find_option( argc, argv, option );
+    if( iplace >= 0 && iplace < argc-1 )
+        return atof( argv[iplace+1] );
+    return default_value;
+}
+
+inline char *read_string( int argc, char **argv, const char *option, char *default_value )
+{
+    int iplace = find_option( argc, argv, option );
+    if( iplace >= 0 && iplace < argc-1 )
+        return argv[iplace+1];
+    return default_value;
+}
+
+#endif
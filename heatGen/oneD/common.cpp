@@ -10,6 +10,7 @@
 
 int mesh_pts;
 double step;
+double bar_len;
 
 //
 //  tuned constants
@@ -19,23 +20,6 @@ double step;
 #define dt         0.0005 // s
 #define T_default     200 // K
 
-//
-//  timer
-//
-double read_timer( )
-{
-    static bool initialized = false;
-    static struct timeval start;
-    struct timeval end;
-    if( !initialized )
-    {
-        gettimeofday( &start, NULL );
-        initialized = true;
-    }
-    gettimeofday( &end, NULL );
-    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
-}
-
 //
 //  Set number of mesh points
 //
@@ -47,62 +31,32 @@ void set_len( int n )
 //
 //  Initialize the bar
 //
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem )
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem )
 {        
-    // Number of nodes to create
-    
-    tnodes[0].T = ltem;
-    tnodes[0].T_sum = 0;
-    tnodes[0].x = 0;
-    tnodes[0].fixed = true;
-    tnodes[0].qdot = 0;
-    tnodes[mesh_pts-1].T = rtem;
-    tnodes[mesh_pts-1].T_sum = 0;
-    tnodes[mesh_pts-1].x = bar_size;
-    tnodes[mesh_pts-1].fixed = true;
-    tnodes[mesh_pts-1].qdot = 0;
-
+    bar_len = bar_size;
     step = 1.0/(mesh_pts-1);
+    grid.h = step;
 
     for (int i = 1; i < mesh_pts-1; i++) {
-        tnodes[i].T = T_default;
-        tnodes[i].T_sum = 0;
-        tnodes[i].x = (double) i * step;
-        tnodes[i].fixed = false;
-        tnodes[i].qdot = 0;
+        grid.T[node_index( grid, i )] = T_default;
+        grid.flags[node_index( grid, i )] = 0;
     }
-    tnodes[mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[mesh_pts/2 + 1].qdot = 1010*mesh_pts*mesh_pts;
-}
+    grid.T[node_index( grid, 0 )] = ltem;
+    grid.flags[node_index( grid, 0 )] = FIXED;
+    grid.T[node_index( grid, mesh_pts-1 )] = rtem;
+    grid.flags[node_index( grid, mesh_pts-1 )] = FIXED;
 
-//
-//  interact two temperature nodes
-//
-void apply_tsum( node_t &tnode, node_t &neighbor)
-{
-    if (tnode.fixed) {
-        return;
-    }
-    tnode.T_sum += neighbor.T;
-}
+    double term = 1010*mesh_pts*mesh_pts * (grid.h * grid.h / k);
+    grid.source.add_point( node_index( grid, mesh_pts/2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 + 1 ), term );
 
-//
-//  Solve for the temperature
-//
-void tupdate( node_t &tnode, int dim )
-{
-    if (tnode.fixed) {
-        return;
-    }
-    tnode.T_sum += ( tnode.qdot * step * step)/k;
-    tnode.T = ((double) tnode.T_sum) / ((double) dim * 2);
-    tnode.T_sum = 0;
+    init_boundary( grid );
 }
 
 //
 //  I/O routines
 //
-void save( FILE *f, int step, int n, node_t *tnode )
+void save( FILE *f, int step, int n, double *T )
 {
     //static bool first = true;
     //if( first )
@@ -110,33 +64,7 @@ void save( FILE *f, int step, int n, node_t *tnode )
     //    fprintf( f, "%d\n", n );
     //    first = false;
     //}
+    double h = bar_len / (n-1);
     for( int i = 0; i < n; i++ )
-        fprintf( f, "%d,%g,%g,%g\n", step, tnode[i].x, 0.0, tnode[i].T);
-}
-
-//
-//  command line option processing
-//
-int find_option( int argc, char **argv, const char *option )
-{
-    for( int i = 1; i < argc; i++ )
-        if( strcmp( argv[i], option ) == 0 )
-            return i;
-    return -1;
-}
-
-int read_int( int argc, char **argv, const char *option, int default_value )
-{
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return atoi( argv[iplace+1] );
-    return default_value;
-}
-
-char *read_string( int argc, char **argv, const char *option, char *default_value )
-{
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return argv[iplace+1];
-    return default_value;
+        fprintf( f, "%d,%g,%g,%g\n", step, i * h, 0.0, T[i+1]);
 }
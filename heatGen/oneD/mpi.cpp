@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <math.h>
 #include "common.h"
+#include "../../engine/mpi_converge.h"
 
 int main(int argc, char **argv) {
   if (find_option(argc, argv, "-h") >= 0) {
@@ -12,6 +13,10 @@ int main(int argc, char **argv) {
     printf( "-n <int> to set the number of particles\n" );
     printf( "-o <filename> to specify the output file name\n" );
     printf( "-s <filename> to specify a summary file name\n" );
+    printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+    printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+    printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+    printf( "-l2 to compare the L2 norm of the change with -tol instead of its largest value\n" );
     printf( "-no turns off all correctness checks and particle output\n");
     return 0;
   }
@@ -19,13 +24,21 @@ int main(int argc, char **argv) {
 
   char *savename = read_string( argc, argv, "-o", NULL );
   char *sumname = read_string( argc, argv, "-s", NULL );
+  const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+
+  converge_t conv;
+  init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                 find_option( argc, argv, "-l2" ) >= 0 );
+  pending_check_t pending;
+  init_pending( pending );
 
   FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
   FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
 
-  node_t *tnodes = (node_t *) malloc( n * sizeof(node_t) );
+  grid_t grid;
+  alloc_grid( grid, n );
   set_len(n);
-  init_bar( tnodes, (double) 1.0, 400, 200 );
+  init_bar( grid, (double) 1.0, 400, 200 );
 
   // Set up MPI
   int n_proc, rank;
@@ -33,15 +46,11 @@ int main(int argc, char **argv) {
   MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  MPI_Datatype NODE;
-  int blocklen[2] = {3, 1};
-  MPI_Aint displacements[2] = {0, 24};
-  MPI_Datatype types[2] = {MPI_DOUBLE, MPI_INT};
-  MPI_Type_create_struct(2, blocklen, displacements, types, &NODE);
-  MPI_Type_commit(&NODE);
-
   // Partition the nodes across n_proc processors by x value
-  MPI_Bcast(tnodes, n, NODE, 0, MPI_COMM_WORLD);
+  // The bar is padded with a halo node at each end, so node i of the
+  // bar is T[i+1]
+  MPI_Bcast(grid.T, grid.size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(grid.T_next, grid.size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   double width = 1.0 / n_proc;
   int lindex = rank * n / n_proc;
   int rindex = (rank + 1) * n / n_proc;
@@ -49,7 +58,15 @@ int main(int argc, char **argv) {
   printf("rank: %d\n", rank);
   printf("lindex: %d, rindex: %d\n", lindex, rindex);
 
-  node_t *recv_buffer = (node_t *) malloc(n * sizeof(node_t));
+  // Partitions differ in size when n_proc does not divide n
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = p * n / n_proc + 1;
+    counts[p] = (p + 1) * n / n_proc + 1 - displs[p];
+  }
+
+  double *recv_buffer = alloc_aligned<double>(grid.size);
 
   int tag;
   int dest_rank, source_rank;
@@ -58,60 +75,68 @@ int main(int argc, char **argv) {
   double simulation_time = read_timer( );
   for (int step = 0; step < NSTEPS; ++step) {
     // Compute temperature changes
-    for (int i = lindex; i < rindex; ++i) {
-      apply_tsum(tnodes[i], tnodes[i-1]);
-      apply_tsum(tnodes[i], tnodes[i+1]);
-    }
+    // The fixed ends are skipped by the engine
+    step_nodes(grid, 0, lindex, rindex);
 
-    for (int i = lindex; i < rindex; ++i) {
-      tupdate(tnodes[i], 1);
-    }
+    swap_grid(grid);
 
     // Send adjacent particles to adjacent processors
     // Send to left
     dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
     source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
-    MPI_Sendrecv(&tnodes[lindex], 1, NODE, dest_rank, 0,
-                 recv_buffer, 1, NODE, source_rank, 0,
+    MPI_Sendrecv(&grid.T[node_index(grid, lindex)], 1, MPI_DOUBLE, dest_rank, 0,
+		 &grid.T[node_index(grid, rindex)], 1, MPI_DOUBLE, source_rank, 0,
 		 MPI_COMM_WORLD, &status);
-    if (rank != n_proc - 1) {
-	    tnodes[rindex] = recv_buffer[0];
-    }
 
     // Send to right
     dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
     source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
-    MPI_Sendrecv(&tnodes[rindex-1], 1, NODE, dest_rank, 0,
-		 recv_buffer, 1, NODE, source_rank, 0,
+    MPI_Sendrecv(&grid.T[node_index(grid, rindex-1)], 1, MPI_DOUBLE, dest_rank, 0,
+		 &grid.T[node_index(grid, lindex-1)], 1, MPI_DOUBLE, source_rank, 0,
 		 MPI_COMM_WORLD, &status);
-    if (rank != 0)
-	    tnodes[lindex-1] = recv_buffer[0];
 
     if( find_option( argc, argv, "-no" ) == -1 ) {
 	    if( fsave && (step % SAVEFREQ == 0)) {
-		    MPI_Allgather(&tnodes[lindex], rindex - lindex, NODE,
-				    recv_buffer, rindex - lindex, NODE, MPI_COMM_WORLD);
+		    MPI_Gatherv(&grid.T[node_index(grid, lindex)], rindex - lindex, MPI_DOUBLE,
+				    recv_buffer, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 		    if (rank == 0) {
 			    save( fsave, step, n, recv_buffer );
 		    }
 	    }
     }
+
+    // Stop once the bar has stopped changing. The check of a step is
+    // reduced while the next one is computed
+    if( finish_check( pending, conv ) )
+      break;
+    if( check_due( conv, step ) ) {
+      double largest = 0, sq = 0;
+      change_nodes( grid, 0, lindex, rindex, largest, sq );
+      start_check( pending, step, largest, sq );
+    }
   }
+  finish_check( pending, conv );
   simulation_time = read_timer( ) - simulation_time;
 
-  MPI_Allgather(&tnodes[lindex], rindex - lindex, NODE,
-		  recv_buffer, rindex - lindex, NODE, MPI_COMM_WORLD);
-
   if (0 == rank) {
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+    printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
   }
 
   if( fsum )
     fclose( fsum );    
-  free( tnodes );
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_grid( grid );
   if( fsave )
     fclose( fsave );
 
+  if (0 == rank)
+    print_memory( );
+
   MPI_Finalize();
 
   return 0;
@@ -10,6 +10,7 @@
 
 int mesh_pts;
 double step;
+double bar_len;
 
 //
 //  tuned constants
@@ -19,23 +20,6 @@ double step;
 #define dt         0.0005 // s
 #define T_default     200 // K
 
-//
-//  timer
-//
-double read_timer( )
-{
-    static bool initialized = false;
-    static struct timeval start;
-    struct timeval end;
-    if( !initialized )
-    {
-        gettimeofday( &start, NULL );
-        initialized = true;
-    }
-    gettimeofday( &end, NULL );
-    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
-}
-
 //
 //  Set number of mesh points
 //
@@ -47,98 +31,54 @@ void set_len( int n )
 //
 //  Initialize the bar
 //
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem )
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem )
 {        
-    // Number of nodes to create
+    bar_len = bar_size;
     step = 1.0/(mesh_pts-1);
+    grid.h = step;
     for (int j = 0; j < mesh_pts; j++) {
-        tnodes[j].T = ltem;
-        tnodes[j].T_sum = 0;
-        tnodes[j].x = step*j;
-        tnodes[j].y = 0;
-        tnodes[j].fixed = true;
-        tnodes[j].edge = true;
-        tnodes[j].qdot = 0;
+        grid.T[node_index( grid, 0, j )] = ltem;
+        grid.flags[node_index( grid, 0, j )] = FIXED;
 
-        tnodes[(mesh_pts-1)*mesh_pts + j].T = rtem;
-        tnodes[(mesh_pts-1)*mesh_pts + j].T_sum = 0;
-        tnodes[(mesh_pts-1)*mesh_pts + j].x = step*j;
-        tnodes[(mesh_pts-1)*mesh_pts + j].y = bar_size;
-        tnodes[(mesh_pts-1)*mesh_pts + j].fixed = true;
-        tnodes[(mesh_pts-1)*mesh_pts + j].edge = true;
-        tnodes[(mesh_pts-1)*mesh_pts + j].qdot = 0;
+        grid.T[node_index( grid, mesh_pts-1, j )] = rtem;
+        grid.flags[node_index( grid, mesh_pts-1, j )] = FIXED;
     }
     
     for (int i = 1; i < mesh_pts-1; i++) {
         for (int j = 1; j < mesh_pts-1; j++) {
-            tnodes[mesh_pts*i + j].T = T_default;
-            tnodes[mesh_pts*i + j].T_sum = 0;
-            tnodes[mesh_pts*i + j].x = (double) step*j;
-            tnodes[mesh_pts*i + j].y = (double) step*i;
-            tnodes[mesh_pts*i + j].fixed = false;
-            tnodes[mesh_pts*i + j].edge = false;
-            tnodes[mesh_pts*i + j].qdot = 0;
+            grid.T[node_index( grid, i, j )] = T_default;
+            grid.flags[node_index( grid, i, j )] = 0;
         }  
 
-        tnodes[mesh_pts*i].T = ltem;
-        tnodes[mesh_pts*i].T_sum = 0;
-        tnodes[mesh_pts*i].x = (double) 0;
-        tnodes[mesh_pts*i].y = (double) step*i;
-        tnodes[mesh_pts*i].fixed = true;
-        tnodes[mesh_pts*i].edge = true;
-
-        tnodes[mesh_pts*i + (mesh_pts-1)].T = rtem;
-        tnodes[mesh_pts*i + (mesh_pts-1)].T_sum = 0;
-        tnodes[mesh_pts*i + (mesh_pts-1)].x = (double) 0;
-        tnodes[mesh_pts*i + (mesh_pts-1)].y = (double) step*i;
-        tnodes[mesh_pts*i + (mesh_pts-1)].fixed = true;
-        tnodes[mesh_pts*i + (mesh_pts-1)].edge = true;
-    }
-    tnodes[(mesh_pts/2)*mesh_pts + mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2)*mesh_pts + mesh_pts/2 + 1].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2)*mesh_pts + mesh_pts/2 - 1].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 + 1)*mesh_pts + mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 - 1)*mesh_pts + mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-
-    tnodes[(mesh_pts/2 + 2)*mesh_pts + mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 - 2)*mesh_pts + mesh_pts/2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2)*mesh_pts + mesh_pts/2 + 2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2)*mesh_pts + mesh_pts/2 - 2].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 + 1)*mesh_pts + mesh_pts/2 + 1].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 - 1)*mesh_pts + mesh_pts/2 - 1].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 + 1)*mesh_pts + mesh_pts/2 - 1].qdot = 1010*mesh_pts*mesh_pts;
-    tnodes[(mesh_pts/2 - 1)*mesh_pts + mesh_pts/2 + 1].qdot = 1010*mesh_pts*mesh_pts;
-
-}
-
-//
-//  interact two temperature nodes
-//
-void apply_tsum( node_t &tnode, node_t &neighbor)
-{
-    if (tnode.fixed) {
-        return;
-    }
-    tnode.T_sum += neighbor.T;
-}
+        grid.T[node_index( grid, i, 0 )] = ltem;
+        grid.flags[node_index( grid, i, 0 )] = FIXED;
 
-//
-//  Solve for the temperature
-//
-void tupdate( node_t &tnode, double div )
-{
-    if (tnode.fixed) {
-        return;
+        grid.T[node_index( grid, i, mesh_pts-1 )] = rtem;
+        grid.flags[node_index( grid, i, mesh_pts-1 )] = FIXED;
     }
-    tnode.T_sum += ( tnode.qdot * step * step)/k;
-    tnode.T = ((double) tnode.T_sum) / ((double) div);
-    tnode.T_sum = 0;
+    double term = 1010*mesh_pts*mesh_pts * (grid.h * grid.h / k);
+    grid.source.add_point( node_index( grid, mesh_pts/2, mesh_pts/2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2, mesh_pts/2 + 1 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2, mesh_pts/2 - 1 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 + 1, mesh_pts/2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 - 1, mesh_pts/2 ), term );
+
+    grid.source.add_point( node_index( grid, mesh_pts/2 + 2, mesh_pts/2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 - 2, mesh_pts/2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2, mesh_pts/2 + 2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2, mesh_pts/2 - 2 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 + 1, mesh_pts/2 + 1 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 - 1, mesh_pts/2 - 1 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 + 1, mesh_pts/2 - 1 ), term );
+    grid.source.add_point( node_index( grid, mesh_pts/2 - 1, mesh_pts/2 + 1 ), term );
+
+    init_boundary( grid );
 }
 
 //
 //  I/O routines
 //
-void save( FILE *f, int step, int n, node_t *tnode )
+void save( FILE *f, int step, int n, double *T )
 {
     //static bool first = true;
     //if( first )
@@ -146,33 +86,21 @@ void save( FILE *f, int step, int n, node_t *tnode )
     //    fprintf( f, "%d\n", n );
     //    first = false;
     //}
-    for( int i = 0; i < n*n; i++ )
-        fprintf( f, "%d,%g,%g,%g\n", step, tnode[i].x, tnode[i].y, tnode[i].T);
+    double h = bar_len / (n-1);
+    int ld = padded_len<double>( n );
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, T[(i+1)*ld + j+1]);
 }
 
 //
-//  command line option processing
+//  the same output from quadtree leaves, every node taking the value of
+//  the cell it lies in
 //
-int find_option( int argc, char **argv, const char *option )
-{
-    for( int i = 1; i < argc; i++ )
-        if( strcmp( argv[i], option ) == 0 )
-            return i;
-    return -1;
-}
-
-int read_int( int argc, char **argv, const char *option, int default_value )
-{
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return atoi( argv[iplace+1] );
-    return default_value;
-}
-
-char *read_string( int argc, char **argv, const char *option, char *default_value )
+void save( FILE *f, int step, int n, const amr_t<double> &a )
 {
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return argv[iplace+1];
-    return default_value;
+    double h = bar_len / (n-1);
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, amr_value( a, i, j ));
 }
@@ -1,8 +1,7 @@
 #ifndef __CS267_COMMON_H__
 #define __CS267_COMMON_H__
 
-inline int min( int a, int b ) { return a < b ? a : b; }
-inline int max( int a, int b ) { return a > b ? a : b; }
+#include "../../engine/heat.h"
 
 //
 //  saving parameters
@@ -12,44 +11,26 @@ const int SAVEFREQ = 50;
 const int k = 50;
 
 //
-// mesh node data structure
-//
-typedef struct 
-{
-  double T;
-  double T_sum;
-  double x;
-  double y;
-  double qdot;
-  bool fixed;
-  bool edge;
-} node_t;
-
-//
-//  timing routines
+// mesh data structure
+// a square plate with every edge held at a fixed temperature and heat
+// generated in the middle; node (i,j) lives at (i+1)*ld + (j+1). The
+// boundary is insulated wherever init_bar leaves an edge node free.
+// See engine/mesh.h for the layout.
 //
-double read_timer( );
+typedef mesh_t<2, double, insulated, point_sources> grid_t;
 
 //
 //  simulation routines
 //
 void set_len( int n );
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem );
-void apply_tsum( node_t &tnode, node_t &neighbor );
-void tupdate( node_t &tnode, double div );
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem );
 
 
 //
 //  I/O routines
 //
 FILE *open_save( char *filename, int n );
-void save( FILE *f, int step, int n, node_t *tnodes );
-
-//
-//  argument processing routines
-//
-int find_option( int argc, char **argv, const char *option );
-int read_int( int argc, char **argv, const char *option, int default_value );
-char *read_string( int argc, char **argv, const char *option, char *default_value );
+void save( FILE *f, int step, int n, double *T );
+void save( FILE *f, int step, int n, const amr_t<double> &a );
 
 #endif
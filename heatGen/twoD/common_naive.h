@@ -21,6 +21,16 @@ typedef struct
   bool fixed;
 } node_t;
 
+//
+// neighbour lists in one array: node i interacts with the nodes
+// neighbor[start[i]] up to neighbor[start[i+1]]
+//
+typedef struct
+{
+  int *start;
+  int *neighbor;
+} neighbors_t;
+
 //
 //  timing routines
 //
@@ -33,6 +43,8 @@ void set_len( int n );
 void init_bar( node_t *tnodes, double ltem, double rtem );
 void apply_tsum( node_t &tnode, node_t &neighbor );
 void tupdate( node_t &tnode );
+void find_neighbors( node_t *tnodes, int n, neighbors_t &nb );
+void free_neighbors( neighbors_t &nb );
 
 
 //
@@ -19,6 +19,16 @@ int main( int argc, char **argv )
         printf( "-n <int> to set number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" ); 
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-mg <V|F> to solve for the steady state by multigrid V- or F-cycles instead of time stepping\n" );
+        printf( "-tol <float> to stop time stepping once no node changes by this much in a step, or -mg once\n" );
+        printf( "             no node would change by this much in a Jacobi step\n" );
+        printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-pulse <int> to switch the heat sources off and on again every <int> steps\n" );
+        printf( "-amr <float> to step quadtree leaves, fine only where cells next to each other differ by\n" );
+        printf( "             more than about this many kelvin or hold a source, instead of the whole mesh\n" );
+        printf( "-regrid <int> to regrid the -amr leaves every <int> steps (10 by default)\n" );
         printf( "-no turns off all correctness checks and particle output\n");   
         return 0;
     }
@@ -26,55 +36,158 @@ int main( int argc, char **argv )
     int n = read_int( argc, argv, "-n", 1000 );
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+    int pulse = read_int( argc, argv, "-pulse", 0 );
+    bool amr = find_option( argc, argv, "-amr" ) >= 0;
+
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
 
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;      
 
-    node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
+    grid_t grid;
+    alloc_grid( grid, n );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 400, 200 );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    if( find_option( argc, argv, "-mg" ) >= 0 )
+    {
+        //
+        //  solve for the steady state alone, in at most NSTEPS cycles; every thread
+        //  runs the cycles and shares their loops
+        //
+        mg_cycle_t kind = read_string( argc, argv, "-mg", (char *) "V" )[0] == 'F' ? MG_F : MG_V;
+        double tol = read_double( argc, argv, "-tol", 0 );
+        tol = tol > 0 ? tol : 1e-6;
+        multigrid_t mg;
+        init_multigrid( mg, grid, 0 );
+
+        double simulation_time = read_timer( );
+
+        #pragma omp parallel
+        {
+        numthreads = omp_get_num_threads();
+        do
+            mg_solve_cycle( mg, kind );
+        while( mg.residual >= tol && mg.cycles < NSTEPS );
+    }
+        simulation_time = read_timer( ) - simulation_time;
+        finish_multigrid( mg, grid );
+
+        printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+        printf( "%c-cycles = %d, levels = %d, residual = %g, %s\n", kind == MG_F ? 'F' : 'V', mg.cycles, mg.nlevels,
+                mg.residual, mg.residual < tol ? "converged" : "not converged" );
+
+        free_multigrid( mg );
+
+        if( fsave && find_option( argc, argv, "-no" ) == -1 )
+            save( fsave, mg.cycles, n, grid.T );
+    }
+    else if( amr )
+    {
+        //
+        //  simulate on quadtree leaves set up from the mesh, which is
+        //  then no longer needed; the team shares the leaves of a step
+        //  and the moves of a regrid, which follows the check of the
+        //  step, and the barrier after a save keeps a regrid from
+        //  freeing the field while it is written out
+        //
+        amr_t<double> leaves;
+        init_amr( leaves, grid, read_double( argc, argv, "-amr", 1 ) );
+        free_grid( grid );
+        int every = max( read_int( argc, argv, "-regrid", 10 ), 1 );
+
+        double simulation_time = read_timer( );
+        double largest = 0, sq = 0;
+
+        #pragma omp parallel
+        {
+        numthreads = omp_get_num_threads();
+        for( int step = 0; step < NSTEPS; step++ )
+        {
+            #pragma omp for
+            for( int L = 0; L < leaves.tree.nleaves; L++ )
+              step_amr( leaves, L, L+1 );
 
+            #pragma omp single
+            {
+              step_amr_sources( leaves );
+              swap_amr( leaves );
+              if( pulse > 0 )
+                leaves.gain = ((step+1) / pulse) % 2 ? 0 : 1;
+            }
+
+            if( find_option( argc, argv, "-no" ) == -1 && fsave && (step%SAVEFREQ) == 0 )
+            {
+              #pragma omp master
+              save( fsave, step, n, leaves );
+              #pragma omp barrier
+            }
+
+            if( check_due( conv, step ) )
+            {
+                #pragma omp for reduction(max:largest) reduction(+:sq)
+                for( int L = 0; L < leaves.tree.nleaves; L++ )
+                  change_amr( leaves, L, L+1, largest, sq );
+
+                #pragma omp single
+                {
+                  end_check( conv, step, largest, sq );
+                  largest = sq = 0;
+                }
+                if( converged( conv ) )
+                    break;
+            }
+            if( (step+1) % every == 0 )
+                regrid_amr( leaves );
+        }
+    }
+        simulation_time = read_timer( ) - simulation_time;
+
+        int count[AMR_LEVELS];
+        int levels = amr_levels( leaves, count );
+        printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+        printf( "leaves = %d on %d levels (%d", leaves.tree.nleaves, levels, count[0] );
+        for( int l = 1; l < levels; l++ )
+            printf( ", %d", count[l] );
+        printf( " from the finest), cells = %d, at most %d, or %.3g of the %d nodes; %d regrids\n",
+                leaves.tree.nleaves * AMR_BLOCK * AMR_BLOCK, leaves.peak_cells,
+                (double) leaves.peak_cells / ((double) n * n), n * n, leaves.regrids );
+        if( conv.tol > 0 )
+            printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                    conv.step, conv.max_change, conv.l2_change );
+
+        free_amr( leaves );
+    }
+    else
+    {
     //
     //  simulate a number of time steps
     //
     double simulation_time = read_timer( );
+    double largest = 0, sq = 0;
 
     #pragma omp parallel
     {
     numthreads = omp_get_num_threads();
     for( int step = 0; step < NSTEPS; step++ )
     {
-        #pragma omp for collapse(2)
+        #pragma omp for
         for( int i = 0; i < n; i++ )
-        {
-          for (int j = 0; j < n; j++)
-          {
-            if ((i-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-            if ((i+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-            if ((j-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-            if ((j+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-          }
-        }
+          step_rows( grid, i, i+1 );
  
         //
         //  move particles
         //
-        #pragma omp for collapse(2)
-        for( int i = 0; i < n; i++ ) 
+        #pragma omp single
         {
-          for( int j = 0; j < n; j++ )
-          {
-            if (tnodes[i*n + j].edge)
-              tupdate( tnodes[i*n + j], 3);
-            else
-              tupdate( tnodes[i*n + j], 4);
-          } 
-              
-        }   
+          swap_grid( grid );
+          fill_ghosts( grid, 0, n );
+          if( pulse > 0 )
+            grid.source.gain = ((step+1) / pulse) % 2 ? 0 : 1;
+        }
   
         if( find_option( argc, argv, "-no" ) == -1 ) 
         {
@@ -83,13 +196,36 @@ int main( int argc, char **argv )
           //
           #pragma omp master
           if( fsave && (step%SAVEFREQ) == 0 )
-              save( fsave, step, n, tnodes );
+              save( fsave, step, n, grid.T );
+        }
+
+        //
+        //  stop once the field has stopped changing; the change is
+        //  reduced over the team and conv is only written by the single
+        //
+        if( check_due( conv, step ) )
+        {
+            #pragma omp for reduction(max:largest) reduction(+:sq)
+            for( int i = 0; i < n; i++ )
+              change_rows( grid, i, i+1, largest, sq );
+
+            #pragma omp single
+            {
+              end_check( conv, step, largest, sq );
+              largest = sq = 0;
+            }
+            if( converged( conv ) )
+                break;
         }
     }
 }
     simulation_time = read_timer( ) - simulation_time;
     
-    printf( "n = %d,threads = %d, simulation time = %g seconds\n", n,numthreads, simulation_time);
+    printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+    }
 
     //
     // Printing summary data
@@ -97,13 +233,16 @@ int main( int argc, char **argv )
     // if( fsum)
     //     fprintf(fsum,"%d %d %g\n",n,numthreads,simulation_time);
 
+    print_memory( );
+
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );
 
-    free( tnodes );
+    if( !amr )
+        free_grid( grid );
     if( fsave )
         fclose( fsave );
     
@@ -17,6 +17,16 @@ int main( int argc, char **argv )
         printf( "-n <int> to set the number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" );
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-mg <V|F> to solve for the steady state by multigrid V- or F-cycles instead of time stepping\n" );
+        printf( "-tol <float> to stop time stepping once no node changes by this much in a step, or -mg once\n" );
+        printf( "             no node would change by this much in a Jacobi step\n" );
+        printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-pulse <int> to switch the heat sources off and on again every <int> steps\n" );
+        printf( "-amr <float> to step quadtree leaves, fine only where cells next to each other differ by\n" );
+        printf( "             more than about this many kelvin or hold a source, instead of the whole mesh\n" );
+        printf( "-regrid <int> to regrid the -amr leaves every <int> steps (10 by default)\n" );
         printf( "-no turns off all correctness checks and particle output\n");
         return 0;
     }
@@ -25,13 +35,21 @@ int main( int argc, char **argv )
 
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+    int pulse = read_int( argc, argv, "-pulse", 0 );
+    bool amr = find_option( argc, argv, "-amr" ) >= 0;
     
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
 
-    node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
+    grid_t grid;
+    alloc_grid( grid, n );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 200, 200 );
+    init_bar( grid, (double) 1.0, 200, 200 );
 
     if( find_option( argc, argv, "-no" ) == -1 )
         {
@@ -39,9 +57,89 @@ int main( int argc, char **argv )
           //  save if necessary
           //
           if( fsave )
-              save( fsave, 0, n, tnodes );
+              save( fsave, 0, n, grid.T );
         }
     
+    if( find_option( argc, argv, "-mg" ) >= 0 )
+    {
+        //
+        //  solve for the steady state alone, in at most NSTEPS cycles
+        //
+        mg_cycle_t kind = read_string( argc, argv, "-mg", (char *) "V" )[0] == 'F' ? MG_F : MG_V;
+        double tol = read_double( argc, argv, "-tol", 0 );
+        tol = tol > 0 ? tol : 1e-6;
+        multigrid_t mg;
+        init_multigrid( mg, grid, 0 );
+
+        double simulation_time = read_timer( );
+
+        do
+            mg_solve_cycle( mg, kind );
+        while( mg.residual >= tol && mg.cycles < NSTEPS );
+        simulation_time = read_timer( ) - simulation_time;
+        finish_multigrid( mg, grid );
+
+        printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+        printf( "%c-cycles = %d, levels = %d, residual = %g, %s\n", kind == MG_F ? 'F' : 'V', mg.cycles, mg.nlevels,
+                mg.residual, mg.residual < tol ? "converged" : "not converged" );
+
+        free_multigrid( mg );
+
+        if( fsave && find_option( argc, argv, "-no" ) == -1 )
+            save( fsave, mg.cycles, n, grid.T );
+    }
+    else if( amr )
+    {
+        //
+        //  simulate on quadtree leaves set up from the mesh, which is
+        //  then no longer needed; the change of a step is checked before
+        //  the leaves move
+        //
+        amr_t<double> leaves;
+        init_amr( leaves, grid, read_double( argc, argv, "-amr", 1 ) );
+        free_grid( grid );
+        int every = max( read_int( argc, argv, "-regrid", 10 ), 1 );
+
+        double simulation_time = read_timer( );
+
+        for( int step = 0; step < NSTEPS; step++ )
+        {
+            if( pulse > 0 )
+                leaves.gain = (step / pulse) % 2 ? 0 : 1;
+            step_amr( leaves, 0, leaves.tree.nleaves );
+            step_amr_sources( leaves );
+            swap_amr( leaves );
+
+            if( find_option( argc, argv, "-no" ) == -1 )
+            {
+              if( fsave && (step%SAVEFREQ) == 0 )
+                save( fsave, step, n, leaves );
+            }
+
+            if( check_step( conv, leaves, step ) )
+                break;
+            if( (step+1) % every == 0 )
+                regrid_amr( leaves );
+        }
+        simulation_time = read_timer( ) - simulation_time;
+
+        int count[AMR_LEVELS];
+        int levels = amr_levels( leaves, count );
+        printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+        printf( "leaves = %d on %d levels (%d", leaves.tree.nleaves, levels, count[0] );
+        for( int l = 1; l < levels; l++ )
+            printf( ", %d", count[l] );
+        printf( " from the finest), cells = %d, at most %d, or %.3g of the %d nodes; %d regrids\n",
+                leaves.tree.nleaves * AMR_BLOCK * AMR_BLOCK, leaves.peak_cells,
+                (double) leaves.peak_cells / ((double) n * n), n * n, leaves.regrids );
+        if( conv.tol > 0 )
+            printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                    conv.step, conv.max_change, conv.l2_change );
+
+        free_amr( leaves );
+    }
+    else
+    {
     //
     //  simulate a number of time steps
     //
@@ -50,37 +148,18 @@ int main( int argc, char **argv )
     for( int step = 0; step < NSTEPS; step++ )
     {
         //
-        //  sum temperatures for approximation
+        //  sum temperatures for approximation, with the sources on
+        //  during the even pulses
         //
-        for( int i = 0; i < n; i++ )
-        {
-          for (int j = 0; j < n; j++)
-          {
-            if ((i-1) >= 0)
-	          apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-            if ((i+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-            if ((j-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-            if ((j+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-          }
-        }
+        if( pulse > 0 )
+            grid.source.gain = (step / pulse) % 2 ? 0 : 1;
+        step_rows( grid, 0, n );
  
         //
         //  move particles
         //
-        for( int i = 0; i < n; i++ ) 
-        {
-          for( int j = 0; j < n; j++ )
-          {
-            if (tnodes[i*n + j].edge)
-              tupdate( tnodes[i*n + j], 3);
-            else
-              tupdate( tnodes[i*n + j], 4);
-          } 
-              
-        }
+        swap_grid( grid );
+        fill_ghosts( grid, 0, n );
 
         if( find_option( argc, argv, "-no" ) == -1 )
         {
@@ -88,12 +167,22 @@ int main( int argc, char **argv )
           //  save if necessary
           //
           if( fsave && (step%SAVEFREQ) == 0 )
-            save( fsave, step, n, tnodes );
+            save( fsave, step, n, grid.T );
         }
+
+        //
+        //  stop once the field has stopped changing
+        //
+        if( check_step( conv, grid, step ) )
+            break;
     }
     simulation_time = read_timer( ) - simulation_time;
     
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+    printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+    }
 
     //
     // Printing summary data
@@ -101,12 +190,15 @@ int main( int argc, char **argv )
     // if( fsum) 
     //    fprintf(fsum,"%d %g\n",n,simulation_time);
  
+    print_memory( );
+
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );    
-    free( tnodes );
+    if( !amr )
+        free_grid( grid );
     if( fsave )
         fclose( fsave );
     
@@ -10,6 +10,7 @@
 
 int mesh_pts;
 double step;
+double bar_len;
 
 //
 //  tuned constants
@@ -20,23 +21,6 @@ double step;
 #define dt         0.0005 // s
 #define T_default     300 // K
 
-//
-//  timer
-//
-double read_timer( )
-{
-    static bool initialized = false;
-    static struct timeval start;
-    struct timeval end;
-    if( !initialized )
-    {
-        gettimeofday( &start, NULL );
-        initialized = true;
-    }
-    gettimeofday( &end, NULL );
-    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
-}
-
 //
 //  Set number of mesh points
 //
@@ -48,86 +32,215 @@ void set_len( int n )
 //
 //  Initialize the bar
 //
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem )
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem )
 {        
-    // Number of nodes to create
+    bar_len = bar_size;
     step = 1.0/(mesh_pts-1);
+    grid.h = step;
     for (int i = 0; i < mesh_pts; i++) {
         for (int j = 0; j < mesh_pts; j++) {
-            tnodes[mesh_pts*i + j].T = T_default;
-            tnodes[mesh_pts*i + j].T_sum = 0;
-            tnodes[mesh_pts*i + j].x = (double) step*j;
-            tnodes[mesh_pts*i + j].y = (double) step*i;
-            tnodes[mesh_pts*i + j].fixed = false;
-            tnodes[mesh_pts*i + j].edge = false;
-            tnodes[mesh_pts*i + j].corner = false;
+            grid.T[node_index( grid, i, j )] = T_default;
+            grid.flags[node_index( grid, i, j )] = 0;
         }  
     }
 
-    tnodes[0].corner = true;
-    tnodes[mesh_pts*(mesh_pts-1)].corner = true;
-    tnodes[mesh_pts-1].corner = true;
-    tnodes[mesh_pts*(mesh_pts-1) + mesh_pts-1].corner = true;
-
-    for (int i = 0; i < mesh_pts; i++) {
-        tnodes[mesh_pts*i].edge = true;
-        tnodes[mesh_pts*i + mesh_pts - 1].edge = true;
-        tnodes[i].edge = true;
-        tnodes[mesh_pts*(mesh_pts - 1) + i].edge = true;
-    }
-
+    // cut out everything left of the right-hand band between the
+    // top and bottom bands; its borders are insulated
     for (int i = mesh_pts/10; i < mesh_pts - mesh_pts/10; i++) {
-        int j;
-        for (j = 0; j < mesh_pts - mesh_pts/10; j++) {
-            if (i == mesh_pts/10) {
-                tnodes[mesh_pts*(i-1) + j].edge = true;
-            } else if (i == mesh_pts - mesh_pts/10 - 1) {
-                tnodes[mesh_pts*(i+1) + j].edge = true;
-            }
-            tnodes[mesh_pts*i + j].x = -100;
+        for (int j = 0; j < mesh_pts - mesh_pts/10; j++) {
+            grid.flags[node_index( grid, i, j )] |= HOLE;
         }
-        tnodes[mesh_pts*i + j].edge = true;
     }
 
     for (int i = 0; i < mesh_pts/10; i++) {
-        tnodes[mesh_pts*i].T = ltem;
-        tnodes[mesh_pts*i].fixed = true;
-        tnodes[mesh_pts*(mesh_pts-i-1)].T = rtem;
-        tnodes[mesh_pts*(mesh_pts-i-1)].fixed = true;
+        grid.T[node_index( grid, i, 0 )] = ltem;
+        grid.flags[node_index( grid, i, 0 )] |= FIXED;
+        grid.T[node_index( grid, mesh_pts-i-1, 0 )] = rtem;
+        grid.flags[node_index( grid, mesh_pts-i-1, 0 )] |= FIXED;
     }
+
+    init_boundary( grid );
 }
 
 //
-//  interact two temperature nodes
+//  Drill count round holes, half as wide as a band, evenly along each
+//  of the three bands of the C; their borders are insulated too
 //
-void apply_tsum( node_t &tnode, node_t &neighbor)
+void drill_holes( grid_t &grid, int count )
 {
-    if (tnode.fixed) {
-        return;
-    }
-    double dist = fabs(tnode.x - neighbor.x);
-    if ( dist < 10) {
-        tnode.T_sum += neighbor.T;
+    int band = mesh_pts/10;
+    double radius = band / 4.0;
+    for (int k = 0; k < count; k++) {
+        double along = (k + 0.5) * mesh_pts / count;
+        double centers[3][2] = { { (band-1) / 2.0, along },
+                                 { mesh_pts - (band+1) / 2.0, along },
+                                 { along, mesh_pts - (band+1) / 2.0 } };
+        for (int c = 0; c < 3; c++) {
+            int ilo = max( (int) ceil( centers[c][0] - radius ), 0 );
+            int ihi = min( (int) floor( centers[c][0] + radius ), mesh_pts-1 );
+            int jlo = max( (int) ceil( centers[c][1] - radius ), 0 );
+            int jhi = min( (int) floor( centers[c][1] + radius ), mesh_pts-1 );
+            for (int i = ilo; i <= ihi; i++) {
+                for (int j = jlo; j <= jhi; j++) {
+                    double di = i - centers[c][0], dj = j - centers[c][1];
+                    unsigned char *flags = &grid.flags[node_index( grid, i, j )];
+                    if (di*di + dj*dj < radius*radius && !(*flags & FIXED))
+                        *flags |= HOLE;
+                }
+            }
+        }
     }
+
+    init_boundary( grid );
 }
 
 //
-//  Solve for the temperature
+//  Read a part from filename, a list of words separated by white space,
+//  with comments from # to the end of the line:
+//
+//      nodes <count>
+//      <x> <y> <temperature> <fixed>       count times
+//
+//  then either the edges, conducting heat in proportion to their weight
+//
+//      edges <count>
+//      <node> <node> <weight>              count times
 //
-void tupdate( node_t &tnode, double div )
+//  or the triangles of a mesh, by their corners
+//
+//      triangles <count>
+//      <node> <node> <node>                count times
+//
+//  Nodes are numbered from 0 in the order they are listed, and fixed
+//  nodes (fixed not 0) keep their temperature. A triangle mesh takes
+//  the piecewise linear element's weights, half the cotangents of the
+//  angles facing each edge, and a third of the area of each triangle
+//  as the mass of each of its corners; the weights only stay positive,
+//  and the steps stable, if no angle is obtuse. The step length is the
+//  longest stable one.
+//
+static bool read_word( FILE *f, char *word )
+{
+    while (fscanf( f, " %63s", word ) == 1) {
+        if (word[0] != '#')
+            return true;
+        int c;
+        while ((c = fgetc( f )) != EOF && c != '\n')
+            ;
+    }
+    return false;
+}
+
+bool load_part( part_t &part, const char *filename )
 {
-    if (tnode.fixed) {
-        return;
+    FILE *f = fopen( filename, "r" );
+    if (!f)
+        return false;
+
+    char word[64];
+    int nnodes = 0;
+    if (!read_word( f, word ) || strcmp( word, "nodes" ) || !read_word( f, word ) || (nnodes = atoi( word )) <= 0) {
+        fclose( f );
+        return false;
+    }
+    alloc_graph( part, nnodes );
+    bool ok = true;
+    for (int i = 0; i < nnodes && ok; i++) {
+        double v[4];
+        for (int k = 0; k < 4 && ok; k++) {
+            ok = read_word( f, word );
+            v[k] = atof( word );
+        }
+        part.x[i] = v[0];
+        part.y[i] = v[1];
+        part.T[i] = part.T_next[i] = v[2];
+        part.flags[i] = v[3] != 0 ? FIXED : 0;
     }
 
-    tnode.T = ((double) tnode.T_sum) / ((double) div);
-    tnode.T_sum = 0;
+    int count = 0;
+    bool triangles = false;
+    if (ok && read_word( f, word )) {
+        triangles = !strcmp( word, "triangles" );
+        ok = (triangles || !strcmp( word, "edges" )) && read_word( f, word ) && (count = atoi( word )) >= 0;
+    }
+    int nedges = triangles ? 3*count : count;
+    int *ends = (int *) malloc( 2 * max( nedges, 1 ) * sizeof(int) );
+    double *w = (double *) malloc( max( nedges, 1 ) * sizeof(double) );
+    if (triangles)
+        for (int i = 0; i < nnodes; i++)
+            part.mass[i] = 0;
+    for (int k = 0; k < count && ok; k++) {
+        int corner[3];
+        for (int c = 0; c < (triangles ? 3 : 2) && ok; c++) {
+            ok = read_word( f, word );
+            corner[c] = atoi( word );
+            ok = ok && corner[c] >= 0 && corner[c] < nnodes;
+        }
+        if (!ok)
+            break;
+        if (!triangles) {
+            ok = read_word( f, word );
+            ends[2*k] = corner[0];
+            ends[2*k + 1] = corner[1];
+            w[k] = atof( word );
+            continue;
+        }
+
+        // the edge facing corner c, weighted by the cotangent of its angle
+        double area = 0;
+        for (int c = 0; c < 3; c++) {
+            int a = corner[(c+1) % 3], b = corner[(c+2) % 3], o = corner[c];
+            double ux = part.x[a] - part.x[o], uy = part.y[a] - part.y[o];
+            double vx = part.x[b] - part.x[o], vy = part.y[b] - part.y[o];
+            double cross = fabs( ux*vy - uy*vx );
+            ends[2*(3*k + c)] = a;
+            ends[2*(3*k + c) + 1] = b;
+            w[3*k + c] = cross > 0 ? 0.5 * (ux*vx + uy*vy) / cross : 0;
+            area = 0.5 * cross;
+        }
+        for (int c = 0; c < 3; c++)
+            part.mass[corner[c]] += area / 3;
+    }
+    fclose( f );
+
+    if (ok) {
+        connect_graph( part, nedges, ends, w );
+        for (int i = 0; i < nnodes; i++)
+            if (part.mass[i] <= 0)
+                part.mass[i] = 1;
+        graph_time_step( part, 0 );
+    }
+    else
+        free_graph( part );
+    free( ends );
+    free( w );
+    return ok;
+}
+
+//
+//  Renumber the nodes of part by reverse Cuthill-McKee ("rcm", or NULL),
+//  along a Hilbert curve ("curve") or not at all ("none"); returns the
+//  name of the order taken
+//
+const char *order_part( part_t &part, const char *order )
+{
+    if (order && !strcmp( order, "none" ))
+        return "none";
+    int *perm = (int *) malloc( part.nnodes * sizeof(int) );
+    bool curve = order && !strcmp( order, "curve" );
+    if (curve)
+        curve_order( part, perm );
+    else
+        rcm_order( part, perm );
+    reorder_graph( part, perm );
+    free( perm );
+    return curve ? "curve" : "rcm";
 }
 
 //
 //  I/O routines
 //
-void save( FILE *f, int step, int n, node_t *tnode )
+void save( FILE *f, int step, int n, double *T, unsigned char *flags )
 {
     //static bool first = true;
     //if( first )
@@ -135,35 +248,41 @@ void save( FILE *f, int step, int n, node_t *tnode )
     //    fprintf( f, "%d\n", n );
     //    first = false;
     //}
-    for( int i = 0; i < n*n; i++ ) {
-        if (tnode[i].x > -1)
-            fprintf( f, "%d,%g,%g,%g\n", step, tnode[i].x, tnode[i].y, tnode[i].T);
+    double h = bar_len / (n-1);
+    int ld = padded_len<double>( n );
+    for( int i = 0; i < n; i++ ) {
+        for( int j = 0; j < n; j++ ) {
+            int idx = (i+1)*ld + j+1;
+            if (!(flags[idx] & HOLE))
+                fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, T[idx]);
+        }
     }
 }
 
 //
-//  command line option processing
+//  the same output from the tiles of a block-sparse run
 //
-int find_option( int argc, char **argv, const char *option )
-{
-    for( int i = 1; i < argc; i++ )
-        if( strcmp( argv[i], option ) == 0 )
-            return i;
-    return -1;
-}
-
-int read_int( int argc, char **argv, const char *option, int default_value )
+void save( FILE *f, int step, int n, const sparse_t<double> &sp )
 {
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return atoi( argv[iplace+1] );
-    return default_value;
+    double h = bar_len / (n-1);
+    for( int i = 0; i < n; i++ ) {
+        for( int j = 0; j < n; j++ ) {
+            if (sparse_solid( sp, i, j ))
+                fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, sp.T[sparse_offset( sp, i, j )]);
+        }
+    }
 }
 
-char *read_string( int argc, char **argv, const char *option, char *default_value )
+//
+//  the output of a part, node by node in the order it was set up in,
+//  from its temperatures T
+//
+void save( FILE *f, int step, const part_t &part, const double *T )
 {
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return argv[iplace+1];
-    return default_value;
+    int *at = (int *) malloc( part.nnodes * sizeof(int) );
+    for (int i = 0; i < part.nnodes; i++)
+        at[part.id[i]] = i;
+    for (int k = 0; k < part.nnodes; k++)
+        fprintf( f, "%d,%g,%g,%g\n", step, part.x[at[k]], part.y[at[k]], T[at[k]] );
+    free( at );
 }
@@ -1,8 +1,7 @@
 #ifndef __CS267_COMMON_H__
 #define __CS267_COMMON_H__
 
-inline int min( int a, int b ) { return a < b ? a : b; }
-inline int max( int a, int b ) { return a > b ? a : b; }
+#include "../engine/heat.h"
 
 //
 //  saving parameters
@@ -11,44 +10,35 @@ const int NSTEPS = 5000;
 const int SAVEFREQ = 10;
 
 //
-// mesh node data structure
+// mesh data structure
+// a C-shaped plate: a square with a HOLE cut out of it, held at fixed
+// temperatures at the ends of the C and insulated everywhere else, with
+// no heat source; node (i,j) lives at (i+1)*ld + (j+1). See
+// engine/mesh.h for the layout.
 //
-typedef struct 
-{
-  double T;
-  double T_sum;
-  double x;
-  double y;
-  bool fixed;
-  bool edge;
-  bool corner;
-} node_t;
+typedef mesh_t<2, double, insulated, no_source> grid_t;
 
 //
-//  timing routines
+// an unstructured part: the C as a graph, or a mesh read from a file
 //
-double read_timer( );
+typedef graph_t<double> part_t;
 
 //
 //  simulation routines
 //
 void set_len( int n );
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem );
-void apply_tsum( node_t &tnode, node_t &neighbor );
-void tupdate( node_t &tnode, double div );
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem );
+void drill_holes( grid_t &grid, int count );
+bool load_part( part_t &part, const char *filename );
+const char *order_part( part_t &part, const char *order );
 
 
 //
 //  I/O routines
 //
 FILE *open_save( char *filename, int n );
-void save( FILE *f, int step, int n, node_t *tnodes );
-
-//
-//  argument processing routines
-//
-int find_option( int argc, char **argv, const char *option );
-int read_int( int argc, char **argv, const char *option, int default_value );
-char *read_string( int argc, char **argv, const char *option, char *default_value );
+void save( FILE *f, int step, int n, double *T, unsigned char *flags );
+void save( FILE *f, int step, int n, const sparse_t<double> &sp );
+void save( FILE *f, int step, const part_t &part, const double *T );
 
 #endif
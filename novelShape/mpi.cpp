@@ -4,6 +4,73 @@
 #include <assert.h>
 #include <math.h>
 #include "common.h"
+#include "../engine/mpi_converge.h"
+
+//
+//  Send the edge rows of [lindex, rindex) to the neighbouring processes
+//  and receive theirs into the rows next to it
+//
+static void exchange_rows( grid_t &grid, int lindex, int rindex )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int ld = grid.ld;
+
+  int dest_rank, source_rank;
+  MPI_Status status;
+
+  // Send to left
+  dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+  source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+  MPI_Sendrecv(&grid.T[node_index( grid, lindex, -1 )], ld, MPI_DOUBLE, dest_rank, 0,
+	       &grid.T[node_index( grid, rindex, -1 )], ld, MPI_DOUBLE, source_rank, 0,
+	       MPI_COMM_WORLD, &status);
+
+  // Send to right
+  dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+  source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+  MPI_Sendrecv(&grid.T[node_index( grid, rindex-1, -1 )], ld, MPI_DOUBLE, dest_rank, 0,
+	       &grid.T[node_index( grid, lindex-1, -1 )], ld, MPI_DOUBLE, source_rank, 0,
+	       MPI_COMM_WORLD, &status);
+}
+
+//
+//  communication of graph.h between processes owning ranges of the
+//  nodes of a part: process p owns [first[p], first[p+1]) and reads
+//  [reach[2p], reach[2p+1]), and gets the nodes it reads but does not
+//  own from whoever owns them. With the nodes renumbered to a small
+//  bandwidth those are only its neighbouring processes.
+//
+struct part_comm
+{
+  int n_proc, rank;
+  int *first;
+  int *reach;
+
+  void sum( double *x, int count ) const
+  {
+    MPI_Allreduce(MPI_IN_PLACE, x, count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  }
+  void exchange( double *v ) const
+  {
+    MPI_Request *requests = (MPI_Request *) malloc(2 * n_proc * sizeof(MPI_Request));
+    int count = 0;
+    for (int p = 0; p < n_proc; ++p) {
+      if (p == rank)
+        continue;
+      int from = max(reach[2*rank], first[p]), to = min(reach[2*rank + 1], first[p+1]);
+      if (from < to)
+        MPI_Irecv(&v[from], to - from, MPI_DOUBLE, p, 0, MPI_COMM_WORLD, &requests[count++]);
+      from = max(reach[2*p], first[rank]);
+      to = min(reach[2*p + 1], first[rank+1]);
+      if (from < to)
+        MPI_Isend(&v[from], to - from, MPI_DOUBLE, p, 0, MPI_COMM_WORLD, &requests[count++]);
+    }
+    MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+  }
+};
 
 int main(int argc, char **argv) {
   if (find_option(argc, argv, "-h") >= 0) {
@@ -12,6 +79,19 @@ int main(int argc, char **argv) {
     printf( "-n <int> to set the number of particles\n" );
     printf( "-o <filename> to specify the output file name\n" );
     printf( "-s <filename> to specify a summary file name\n" );
+    printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+    printf( "-sor to solve for the steady state by red-black SOR instead of time stepping\n" );
+    printf( "-omega <float> to set the over-relaxation factor with -sor (estimated by default)\n" );
+    printf( "-tol <float> to stop time stepping once no node changes by this much in a step, or -sor\n" );
+    printf( "             once no node changes by this much in a sweep, or -cg once the residual has shrunk by it\n" );
+    printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+    printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+    printf( "-holes <int> to drill that many round holes along each band of the C\n" );
+    printf( "-graph to run the C as an unstructured mesh, stepped as a sparse matrix product\n" );
+    printf( "-cg to solve the -graph mesh for the steady state by conjugate gradients instead (implies -graph)\n" );
+    printf( "-mesh <filename> to run the unstructured part read from the file instead (see common.cpp)\n" );
+    printf( "-order <name> to number the nodes of -graph by rcm (reverse Cuthill-McKee, the default), curve\n" );
+    printf( "              (along a Hilbert curve) or none\n" );
     printf( "-no turns off all correctness checks and particle output\n");
     return 0;
   }
@@ -19,13 +99,25 @@ int main(int argc, char **argv) {
 
   char *savename = read_string( argc, argv, "-o", NULL );
   char *sumname = read_string( argc, argv, "-s", NULL );
+  const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+
+  converge_t conv;
+  init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                 find_option( argc, argv, "-l2" ) >= 0 );
+  char *meshname = read_string( argc, argv, "-mesh", NULL );
+  bool solve_cg = find_option( argc, argv, "-cg" ) >= 0;
+  bool graph = find_option( argc, argv, "-graph" ) >= 0 || meshname || solve_cg;
+  int status = 0;
 
   FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
   FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
 
-  node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
+  grid_t grid;
+  alloc_grid( grid, n );
   set_len( n );
-  init_bar( tnodes, (double) 1.0, 400, 200 );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  if( read_int( argc, argv, "-holes", 0 ) > 0 )
+    drill_holes( grid, read_int( argc, argv, "-holes", 0 ) );
 
   // Set up MPI
   int n_proc, rank;
@@ -33,89 +125,241 @@ int main(int argc, char **argv) {
   MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  MPI_Datatype NODE;
-  int blocklen[2] = {4, 2};
-  MPI_Aint displacements[2] = {0, 32};
-  MPI_Datatype types[2] = {MPI_DOUBLE, MPI_C_BOOL};
-  MPI_Type_create_struct(2, blocklen, displacements, types, &NODE);
-  MPI_Type_commit(&NODE);
+  // SOR relaxes the structured mesh; the graph has its own solver
+  if( graph && find_option( argc, argv, "-sor" ) >= 0 ) {
+    if (0 == rank)
+      fprintf( stderr, "-sor is not available with -graph or -mesh; use -cg for their steady state\n" );
+    MPI_Finalize();
+    return 1;
+  }
+
+  // The tiles would need a halo exchange of their own, which this
+  // driver does not do
+  if( find_option( argc, argv, "-sparse" ) >= 0 ) {
+    if (0 == rank)
+      fprintf( stderr, "-sparse is not available with MPI; use the serial or openmp driver\n" );
+    MPI_Finalize();
+    return 1;
+  }
 
   // Partition the nodes across n_proc processors by x value
-  MPI_Bcast(tnodes, n * n, NODE, 0, MPI_COMM_WORLD);
+  // Rows are padded with a halo node on each side, and row i of the
+  // grid starts at (i+1)*ld
+  int ld = grid.ld;
+  MPI_Bcast(grid.T, (n+2) * ld, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(grid.T_next, (n+2) * ld, MPI_DOUBLE, 0, MPI_COMM_WORLD);
   double width = 1.0 / n_proc;
   int lindex = rank * n / n_proc;
   int rindex = (rank + 1) * n / n_proc;
 
-  int tag;
-  int dest_rank, source_rank;
-  MPI_Status status;
+  // Partitions differ in size when n_proc does not divide n
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * ld;
+    counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+  }
+
+  double *recv_buffer = alloc_aligned<double>((n+2) * ld);
+
+  if( graph ) {
+    // The part as a graph Laplacian, set up alike by every process and
+    // renumbered for locality; each process owns a range of its nodes
+    part_t part;
+    if( meshname ) {
+      if( !load_part( part, meshname ) ) {
+        if (0 == rank)
+          fprintf( stderr, "cannot read a part from %s\n", meshname );
+        MPI_Finalize();
+        return 1;
+      }
+    }
+    else
+      init_graph( part, grid );
+    int bandwidth = graph_bandwidth( part );
+    const char *order = order_part( part, read_string( argc, argv, "-order", NULL ) );
+    int nnodes = part.nnodes;
+
+    part_comm comm;
+    comm.n_proc = n_proc;
+    comm.rank = rank;
+    comm.first = (int *) malloc((n_proc + 1) * sizeof(int));
+    comm.reach = (int *) malloc(2 * n_proc * sizeof(int));
+    for (int p = 0; p <= n_proc; ++p)
+      comm.first[p] = p * nnodes / n_proc;
+    int first = comm.first[rank], last = comm.first[rank+1];
+    graph_reach( part, first, last, comm.reach[2*rank], comm.reach[2*rank + 1] );
+    MPI_Allgather(MPI_IN_PLACE, 2, MPI_INT, comm.reach, 2, MPI_INT, MPI_COMM_WORLD);
+    int halo = 0;
+    for (int p = 0; p < n_proc; ++p)
+      halo = max(halo, comm.first[p] - comm.reach[2*p] + comm.reach[2*p + 1] - comm.first[p+1]);
 
-  node_t *recv_buffer = (node_t *) malloc(n * n * sizeof(node_t));
+    int *part_counts = (int *) malloc(n_proc * sizeof(int));
+    for (int p = 0; p < n_proc; ++p)
+      part_counts[p] = comm.first[p+1] - comm.first[p];
+    double *part_buffer = alloc_aligned<double>(nnodes);
+
+    double simulation_time = read_timer( );
+    int iterations = 0;
+    if( solve_cg ) {
+      graph_cg_t cg;
+      init_graph_cg( cg, part, read_double( argc, argv, "-tol", 0 ) );
+      graph_solve( part, cg, first, last, comm );
+      iterations = cg.iterations;
+      free_graph_cg( cg );
+    }
+    else {
+      pending_check_t pending;
+      init_pending( pending );
+      for (int step = 0; step < NSTEPS; ++step) {
+        step_graph( part, first, last );
+        swap_graph( part );
+        comm.exchange( part.T );
+
+        if( find_option( argc, argv, "-no" ) == -1 && fsave && (step % SAVEFREQ == 0) ) {
+          MPI_Gatherv(&part.T[first], last - first, MPI_DOUBLE,
+                      part_buffer, part_counts, comm.first, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+          if (rank == 0)
+            save( fsave, step, part, part_buffer );
+        }
+
+        if( finish_check( pending, conv ) )
+          break;
+        if( check_due( conv, step ) ) {
+          double largest = 0, sq = 0;
+          change_graph( part, first, last, largest, sq );
+          start_check( pending, step, largest, sq );
+        }
+      }
+      finish_check( pending, conv );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    if (0 == rank) {
+      printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+      printf( "nodes = %d, edges = %d, bandwidth = %d (%d as set up), order = %s, largest halo = %d nodes\n",
+              nnodes, part.nedges / 2, graph_bandwidth( part ), bandwidth, order, halo );
+      if( solve_cg )
+        printf( "conjugate gradient iterations = %d\n", iterations );
+      else if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+    }
+
+    if( fsave && solve_cg && find_option( argc, argv, "-no" ) == -1 ) {
+      MPI_Gatherv(&part.T[first], last - first, MPI_DOUBLE,
+                  part_buffer, part_counts, comm.first, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      if (rank == 0)
+        save( fsave, iterations, part, part_buffer );
+    }
+    free_aligned( part_buffer );
+    free( part_counts );
+    free( comm.first );
+    free( comm.reach );
+    free_graph( part );
+  }
+  else if( find_option( argc, argv, "-sor" ) >= 0 ) {
+    // Solve for the steady state alone, in at most NSTEPS sweeps or as
+    // many as the shape needs; every colour is followed by a halo
+    // exchange and every sweep by a reduction of the largest change, so
+    // all processes stop together, and the exit status tells whether
+    // they converged
+    sor_t sor;
+    init_sor( sor, grid, read_double( argc, argv, "-omega", 0 ), read_double( argc, argv, "-tol", 0 ) );
+
+    double simulation_time = read_timer( );
+    while( !converged( sor ) && sor.sweeps < max( NSTEPS, sor.limit ) ) {
+      double change = 0;
+      for (int color = 0; color < sor.colors; ++color) {
+        change = fmax( change, relax_rows( grid, sor, color, lindex, rindex ) );
+        exchange_rows( grid, lindex, rindex );
+        fill_ghosts( grid, lindex, rindex );
+      }
+      double global;
+      MPI_Allreduce(&change, &global, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      end_sweep( sor, global );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    if (0 == rank) {
+      printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+      printf( "sweeps = %d, omega = %g, last change = %g, %s\n", sor.sweeps, sor.omega, sor.change,
+              converged( sor ) ? "converged" : "not converged" );
+    }
+    if (!converged( sor ))
+      status = 1;
+
+    if( fsave && find_option( argc, argv, "-no" ) == -1 ) {
+      MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, MPI_DOUBLE,
+                  recv_buffer, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      if (rank == 0) {
+        save( fsave, sor.sweeps, n, recv_buffer, grid.flags );
+      }
+    }
+    free_sor( sor );
+  }
+  else {
+  pending_check_t pending;
+  init_pending( pending );
 
   double simulation_time = read_timer( );
   for (int step = 0; step < NSTEPS; ++step) {
     // Compute temperature changes
-    for (int i = lindex; i < rindex; ++i) {
-      for (int j = 0; j < n; ++j) {
-	      if ((i-1) >= 0)
-		      apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-	      if ((i+1) < n)
-		      apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-	      if ((j-1) >= 0)
-		      apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-	      if ((j+1) < n)
-		      apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-      }
-    }
+    step_rows( grid, lindex, rindex );
 
     // Update temperatures
-    for( int i = lindex; i < rindex; i++ ) {
-      for( int j = 0; j < n; ++j ) {
-	if (tnodes[i*n + j].edge)
-	  tupdate( tnodes[i*n + j], 3);
-        else
-	  tupdate( tnodes[i*n + j], 4);
-      } 
-    }
+    swap_grid( grid );
 
     // Send adjacent particles to adjacent processors
-    // Send to left
-    dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
-    source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
-    MPI_Sendrecv(&tnodes[lindex*n], n, NODE, dest_rank, 0,
-		    &tnodes[rindex*n], n, NODE, source_rank, 0,
-		    MPI_COMM_WORLD, &status);
-
-    // Send to right
-    dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
-    source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
-    MPI_Sendrecv(&tnodes[(rindex-1)*n], n, NODE, dest_rank, 0,
-		 &tnodes[(lindex-1)*n], n, NODE, source_rank, 0,
-		 MPI_COMM_WORLD, &status);
+    exchange_rows( grid, lindex, rindex );
+
+    // Ghosts may copy nodes that just arrived from a neighbour
+    fill_ghosts( grid, lindex, rindex );
 
     if( find_option( argc, argv, "-no" ) == -1 ) {
 	    if( fsave && (step % SAVEFREQ == 0)) {
-		    MPI_Allgather(&tnodes[lindex*n], (rindex - lindex) * n, NODE,
-				    recv_buffer, (rindex - lindex) * n, NODE, MPI_COMM_WORLD);
+		    MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, MPI_DOUBLE,
+				    recv_buffer, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 		    if (rank == 0) {
-			    save( fsave, step, n, recv_buffer );
+			    save( fsave, step, n, recv_buffer, grid.flags );
 		    }
 	    }
     }
+
+    // Stop once the field has stopped changing. The check of a step is
+    // reduced while the next one is computed
+    if( finish_check( pending, conv ) )
+      break;
+    if( check_due( conv, step ) ) {
+      double largest = 0, sq = 0;
+      change_rows( grid, lindex, rindex, largest, sq );
+      start_check( pending, step, largest, sq );
+    }
   }
+  finish_check( pending, conv );
   simulation_time = read_timer( ) - simulation_time;
 
   if (0 == rank) {
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+    printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+  }
   }
 
   if( fsum )
     fclose( fsum );    
-  free( tnodes );
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_grid( grid );
   if( fsave )
     fclose( fsave );
 
+  if (0 == rank)
+    print_memory( );
+
   MPI_Finalize();
 
-  return 0;
+  return status;
 }
@@ -19,6 +19,21 @@ int main( int argc, char **argv )
         printf( "-n <int> to set number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" ); 
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-sor to solve for the steady state by red-black SOR instead of time stepping\n" );
+        printf( "-omega <float> to set the over-relaxation factor with -sor (estimated by default)\n" );
+        printf( "-tol <float> to stop time stepping once no node changes by this much in a step, or -sor\n" );
+        printf( "             once no node changes by this much in a sweep, or -cg once the residual has shrunk by it\n" );
+        printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-holes <int> to drill that many round holes along each band of the C\n" );
+        printf( "-sparse to time step only the tiles of the mesh the shape occupies, unless they would cover\n" );
+        printf( "        more than the whole mesh\n" );
+        printf( "-graph to run the C as an unstructured mesh, stepped as a sparse matrix product\n" );
+        printf( "-cg to solve the -graph mesh for the steady state by conjugate gradients instead (implies -graph)\n" );
+        printf( "-mesh <filename> to run the unstructured part read from the file instead (see common.cpp)\n" );
+        printf( "-order <name> to number the nodes of -graph by rcm (reverse Cuthill-McKee, the default), curve\n" );
+        printf( "              (along a Hilbert curve) or none\n" );
         printf( "-no turns off all correctness checks and particle output\n");   
         return 0;
     }
@@ -26,55 +41,273 @@ int main( int argc, char **argv )
     int n = read_int( argc, argv, "-n", 1000 );
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+    char *meshname = read_string( argc, argv, "-mesh", NULL );
+    bool solve_cg = find_option( argc, argv, "-cg" ) >= 0;
+    bool graph = find_option( argc, argv, "-graph" ) >= 0 || meshname || solve_cg;
+    bool sparse = find_option( argc, argv, "-sparse" ) >= 0 && find_option( argc, argv, "-sor" ) < 0 && !graph;
+    int status = 0;
+
+    //
+    //  SOR relaxes the structured mesh; the graph has its own solver
+    //
+    if( graph && find_option( argc, argv, "-sor" ) >= 0 )
+    {
+        fprintf( stderr, "-sor is not available with -graph or -mesh; use -cg for their steady state\n" );
+        return 1;
+    }
 
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;      
 
-    node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
+    grid_t grid;
+    alloc_grid( grid, n );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 400, 200 );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    if( read_int( argc, argv, "-holes", 0 ) > 0 )
+        drill_holes( grid, read_int( argc, argv, "-holes", 0 ) );
+
+    //
+    //  tiles only pay where the shape leaves most of the mesh out; at
+    //  small n their padding can cover more than the mesh itself
+    //
+    sparse_t<double> sp;
+    double dense = 0;
+    if( sparse )
+    {
+        init_sparse( sp, grid );
+        dense = 100.0 * sp.ntiles * SPARSE_SIZE / grid.size;
+        if( dense >= 100 )
+        {
+            printf( "tiles would cover %.1f%% of the dense mesh; stepping the dense mesh instead\n", dense );
+            free_sparse( sp );
+            sparse = false;
+        }
+    }
+
+    if( graph )
+    {
+        //
+        //  the part as a graph Laplacian, renumbered for locality, with
+        //  the threads taking chunks of nodes; the mesh only sets up the C
+        //
+        part_t part;
+        if( meshname )
+        {
+            if( !load_part( part, meshname ) )
+            {
+                fprintf( stderr, "cannot read a part from %s\n", meshname );
+                return 1;
+            }
+        }
+        else
+            init_graph( part, grid );
+        free_grid( grid );
+        int bandwidth = graph_bandwidth( part );
+        const char *order = order_part( part, read_string( argc, argv, "-order", NULL ) );
+        const int nnodes = part.nnodes;
+
+        double simulation_time = read_timer( );
+        double largest = 0, sq = 0;
+        graph_cg_t cg;
+        if( solve_cg )
+            init_graph_cg( cg, part, read_double( argc, argv, "-tol", 0 ) );
+
+        #pragma omp parallel
+        {
+        numthreads = omp_get_num_threads();
+        if( solve_cg )
+            graph_solve( part, cg, 0, nnodes, local_comm( ) );
+        else
+        for( int step = 0; step < NSTEPS; step++ )
+        {
+            #pragma omp for
+            for( int i = 0; i < nnodes; i += GRAPH_CHUNK )
+              step_graph( part, i, min( i + GRAPH_CHUNK, nnodes ) );
+
+            #pragma omp single
+            swap_graph( part );
+
+            if( find_option( argc, argv, "-no" ) == -1 )
+            {
+              #pragma omp master
+              if( fsave && (step%SAVEFREQ) == 0 )
+                  save( fsave, step, part, part.T );
+            }
+
+            if( check_due( conv, step ) )
+            {
+                #pragma omp for reduction(max:largest) reduction(+:sq)
+                for( int i = 0; i < nnodes; i += GRAPH_CHUNK )
+                  change_graph( part, i, min( i + GRAPH_CHUNK, nnodes ), largest, sq );
+
+                #pragma omp single
+                {
+                  end_check( conv, step, largest, sq );
+                  largest = sq = 0;
+                }
+                if( converged( conv ) )
+                    break;
+            }
+        }
+    }
+        simulation_time = read_timer( ) - simulation_time;
+
+        printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+        printf( "nodes = %d, edges = %d, bandwidth = %d (%d as set up), order = %s\n", nnodes, part.nedges / 2,
+                graph_bandwidth( part ), bandwidth, order );
+        if( solve_cg )
+        {
+            printf( "conjugate gradient iterations = %d\n", cg.iterations );
+            if( fsave && find_option( argc, argv, "-no" ) == -1 )
+                save( fsave, cg.iterations, part, part.T );
+            free_graph_cg( cg );
+        }
+        else if( conv.tol > 0 )
+            printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                    conv.step, conv.max_change, conv.l2_change );
+
+        free_graph( part );
+    }
+    else if( find_option( argc, argv, "-sor" ) >= 0 )
+    {
+        //
+        //  solve for the steady state alone, in at most NSTEPS sweeps or
+        //  as many as the shape needs; done is only written by the single
+        //  at the end of a sweep, two barriers after every thread last
+        //  read it, and the exit status tells whether it converged
+        //
+        sor_t sor;
+        init_sor( sor, grid, read_double( argc, argv, "-omega", 0 ), read_double( argc, argv, "-tol", 0 ) );
+        double change = 0;
+        bool done = false;
+
+        double simulation_time = read_timer( );
 
+        #pragma omp parallel
+        {
+        numthreads = omp_get_num_threads();
+        while( !done )
+        {
+            for( int color = 0; color < sor.colors; color++ )
+            {
+                #pragma omp for reduction(max:change)
+                for( int i = 0; i < n; i++ )
+                  change = fmax( change, relax_rows( grid, sor, color, i, i+1 ) );
+
+                #pragma omp single
+                fill_ghosts( grid, 0, n );
+            }
+
+            #pragma omp single
+            {
+              end_sweep( sor, change );
+              done = converged( sor ) || sor.sweeps == max( NSTEPS, sor.limit );
+              change = 0;
+            }
+        }
+    }
+        simulation_time = read_timer( ) - simulation_time;
+
+        printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+        printf( "sweeps = %d, omega = %g, last change = %g, %s\n", sor.sweeps, sor.omega, sor.change,
+                converged( sor ) ? "converged" : "not converged" );
+        if( !converged( sor ) )
+            status = 1;
+
+        free_sor( sor );
+
+        if( fsave && find_option( argc, argv, "-no" ) == -1 )
+            save( fsave, sor.sweeps, n, grid.T, grid.flags );
+    }
+    else if( sparse )
+    {
+        //
+        //  simulate the time steps on the tiles the shape occupies; the
+        //  mesh only sets them up
+        //
+        free_grid( grid );
+
+        double simulation_time = read_timer( );
+        double largest = 0, sq = 0;
+
+        #pragma omp parallel
+        {
+        numthreads = omp_get_num_threads();
+        for( int step = 0; step < NSTEPS; step++ )
+        {
+            #pragma omp for
+            for( int t = 0; t < sp.ntiles; t++ )
+              step_sparse( sp, t, t+1 );
+
+            #pragma omp single
+            {
+              swap_sparse( sp );
+              fill_sparse_ghosts( sp );
+            }
+
+            if( find_option( argc, argv, "-no" ) == -1 )
+            {
+              #pragma omp master
+              if( fsave && (step%SAVEFREQ) == 0 )
+                  save( fsave, step, n, sp );
+            }
+
+            if( check_due( conv, step ) )
+            {
+                #pragma omp for reduction(max:largest) reduction(+:sq)
+                for( int t = 0; t < sp.ntiles; t++ )
+                  change_sparse( sp, t, t+1, largest, sq );
+
+                #pragma omp single
+                {
+                  end_check( conv, step, largest, sq );
+                  largest = sq = 0;
+                }
+                if( converged( conv ) )
+                    break;
+            }
+        }
+    }
+        simulation_time = read_timer( ) - simulation_time;
+
+        printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+        printf( "tiles = %d of %d, %d full, %.1f%% of the dense mesh\n", sp.ntiles, sp.tiles_i * sp.tiles_j, sp.nfull, dense );
+        if( conv.tol > 0 )
+            printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                    conv.step, conv.max_change, conv.l2_change );
+
+        free_sparse( sp );
+    }
+    else
+    {
     //
     //  simulate a number of time steps
     //
     double simulation_time = read_timer( );
+    double largest = 0, sq = 0;
 
     #pragma omp parallel
     {
     numthreads = omp_get_num_threads();
     for( int step = 0; step < NSTEPS; step++ )
     {
-        #pragma omp for collapse(2)
+        #pragma omp for
         for( int i = 0; i < n; i++ )
-        {
-          for (int j = 0; j < n; j++)
-          {
-            if ((i-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-            if ((i+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-            if ((j-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-            if ((j+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-          }
-        }
+          step_rows( grid, i, i+1 );
  
         //
         //  move particles
         //
-        #pragma omp for collapse(2)
-        for( int i = 0; i < n; i++ ) 
+        #pragma omp single
         {
-          for( int j = 0; j < n; j++ )
-          {
-            if (tnodes[i*n + j].edge)
-              tupdate( tnodes[i*n + j], 3);
-            else
-              tupdate( tnodes[i*n + j], 4);
-          } 
-              
-        }   
+          swap_grid( grid );
+          fill_ghosts( grid, 0, n );
+        }
   
         if( find_option( argc, argv, "-no" ) == -1 ) 
         {
@@ -83,13 +316,36 @@ int main( int argc, char **argv )
           //
           #pragma omp master
           if( fsave && (step%SAVEFREQ) == 0 )
-              save( fsave, step, n, tnodes );
+              save( fsave, step, n, grid.T, grid.flags );
+        }
+
+        //
+        //  stop once the field has stopped changing; the change is
+        //  reduced over the team and conv is only written by the single
+        //
+        if( check_due( conv, step ) )
+        {
+            #pragma omp for reduction(max:largest) reduction(+:sq)
+            for( int i = 0; i < n; i++ )
+              change_rows( grid, i, i+1, largest, sq );
+
+            #pragma omp single
+            {
+              end_check( conv, step, largest, sq );
+              largest = sq = 0;
+            }
+            if( converged( conv ) )
+                break;
         }
     }
 }
     simulation_time = read_timer( ) - simulation_time;
     
-    printf( "n = %d,threads = %d, simulation time = %g seconds\n", n,numthreads, simulation_time);
+    printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+    }
 
     //
     // Printing summary data
@@ -97,15 +353,18 @@ int main( int argc, char **argv )
     // if( fsum)
     //     fprintf(fsum,"%d %d %g\n",n,numthreads,simulation_time);
 
+    print_memory( );
+
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );
 
-    free( tnodes );
+    if( !sparse && !graph )
+        free_grid( grid );
     if( fsave )
         fclose( fsave );
     
-    return 0;
+    return status;
 }
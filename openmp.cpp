@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <math.h>
 #include "common.h"
+#include "engine/numa.h"
 #include "omp.h"
 
 //
@@ -19,6 +20,11 @@ int main( int argc, char **argv )
         printf( "-n <int> to set number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" ); 
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+        printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change with -tol instead of its largest value\n" );
+        printf( "-pin to pin each thread to one CPU, so the field stays on the NUMA node of its thread\n" );
         printf( "-no turns off all correctness checks and particle output\n");   
         return 0;
     }
@@ -26,13 +32,23 @@ int main( int argc, char **argv )
     int n = read_int( argc, argv, "-n", 1000 );
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+    double largest = 0, sq = 0;
 
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;      
 
-    node_t *tnodes = (node_t *) malloc( n * sizeof(node_t) );
+    if( find_option( argc, argv, "-pin" ) >= 0 )
+        pin_threads( );
+
+    grid_t grid;
+    alloc_grid( grid, n );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 400, 200 );
+    init_bar( grid, (double) 1.0, 400, 200 );
 
     //
     //  simulate a number of time steps
@@ -47,20 +63,17 @@ int main( int argc, char **argv )
         //
         //  sum temperatures for approximation
         //
-        #pragma omp for
-        for( int i = 1; i < n-1; i++ )
-        {
-          apply_tsum( tnodes[i], tnodes[i-1]);
-          apply_tsum( tnodes[i], tnodes[i+1]);
-        }
+        // each thread advances one contiguous block of the bar
+        int tid = omp_get_thread_num();
+        step_nodes( grid, 0, tid*n/numthreads, (tid+1)*n/numthreads );
+        #pragma omp barrier
         
 		
         //
         //  move particles
         //
-        #pragma omp for
-        for( int i = 0; i < n; i++ ) 
-          tupdate( tnodes[i], 1);   
+        #pragma omp single
+        swap_grid( grid );
   
         if( find_option( argc, argv, "-no" ) == -1 ) 
         {
@@ -69,13 +82,36 @@ int main( int argc, char **argv )
           //
           #pragma omp master
           if( fsave && (step%SAVEFREQ) == 0 )
-              save( fsave, step, n, tnodes );
+              save( fsave, step, n, grid.T );
+        }
+
+        //
+        //  stop once the bar has stopped changing; the check of each
+        //  block is reduced over the team
+        //
+        if( check_due( conv, step ) )
+        {
+            #pragma omp for reduction(max:largest) reduction(+:sq)
+            for( int t = 0; t < numthreads; t++ )
+              change_nodes( grid, 0, t*n/numthreads, (t+1)*n/numthreads, largest, sq );
+
+            #pragma omp single
+            {
+              end_check( conv, step, largest, sq );
+              largest = sq = 0;
+            }
+            if( converged( conv ) )
+                break;
         }
     }
 }
     simulation_time = read_timer( ) - simulation_time;
     
-    printf( "n = %d,threads = %d, simulation time = %g seconds\n", n,numthreads, simulation_time);
+    printf( "n = %d,threads = %d, kernel = %s, simulation time = %g seconds\n", n,numthreads, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+    print_numa( numa_placement( grid ) );
 
     //
     // Printing summary data
@@ -83,13 +119,15 @@ int main( int argc, char **argv )
     // if( fsum)
     //     fprintf(fsum,"%d %d %g\n",n,numthreads,simulation_time);
 
+    print_memory( );
+
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );
 
-    free( tnodes );
+    free_grid( grid );
     if( fsave )
         fclose( fsave );
     
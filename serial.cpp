@@ -17,6 +17,10 @@ int main( int argc, char **argv )
         printf( "-n <int> to set the number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" );
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+        printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change with -tol instead of its largest value\n" );
         printf( "-no turns off all correctness checks and particle output\n");
         return 0;
     }
@@ -25,13 +29,19 @@ int main( int argc, char **argv )
 
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
     
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
 
-    node_t *tnodes = (node_t *) malloc( n * sizeof(node_t) );
+    grid_t grid;
+    alloc_grid( grid, n );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 400, 200 );
+    init_bar( grid, (double) 1.0, 400, 200 );
 
     if( find_option( argc, argv, "-no" ) == -1 )
         {
@@ -39,7 +49,7 @@ int main( int argc, char **argv )
           //  save if necessary
           //
           if( fsave )
-              save( fsave, 0, n, tnodes );
+              save( fsave, 0, n, grid.T );
         }
     
     //
@@ -52,19 +62,13 @@ int main( int argc, char **argv )
         //
         //  sum temperatures for approximation
         //
-        // We know the ends are fixed in 1D
-        // no checks required.
-        for( int i = 1; i < n-1; i++ )
-        {
-		  apply_tsum( tnodes[i], tnodes[i-1]);
-          apply_tsum( tnodes[i], tnodes[i+1]);
-        }
+        // The fixed ends are skipped by the engine
+        step_rows( grid, 0, 1 );
  
         //
         //  move particles
         //
-        for( int i = 0; i < n; i++ ) 
-          tupdate( tnodes[i], 1);		
+        swap_grid( grid );
 
         if( find_option( argc, argv, "-no" ) == -1 )
         {
@@ -72,12 +76,21 @@ int main( int argc, char **argv )
           //  save if necessary
           //
           if( fsave && ((step+1)%SAVEFREQ) == 0 )
-            save( fsave, step, n, tnodes );
+            save( fsave, step, n, grid.T );
         }
+
+        //
+        //  stop once the bar has stopped changing
+        //
+        if( check_step( conv, grid, step ) )
+            break;
     }
     simulation_time = read_timer( ) - simulation_time;
     
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+    printf( "n = %d, kernel = %s, simulation time = %g seconds\n", n, kernel, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
 
     //
     // Printing summary data
@@ -85,12 +98,14 @@ int main( int argc, char **argv )
     // if( fsum) 
     //    fprintf(fsum,"%d %g\n",n,simulation_time);
  
+    print_memory( );
+
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );    
-    free( tnodes );
+    free_grid( grid );
     if( fsave )
         fclose( fsave );
     
@@ -33,6 +33,12 @@ int main( int argc, char **argv )
     set_len( n );
     init_bar( tnodes, 400, 200 );
 
+    //
+    //  find the neighbours of every node once, by a cell list
+    //
+    neighbors_t nb;
+    find_neighbors( tnodes, n, nb );
+
     if( find_option( argc, argv, "-no" ) == -1 )
         {
           //
@@ -54,8 +60,8 @@ int main( int argc, char **argv )
         //
         for( int i = 0; i < n; i++ )
         {
-            for (int j = 0; j < n; j++ )
-				apply_tsum( tnodes[i], tnodes[j]);
+            for( int k = nb.start[i]; k < nb.start[i+1]; k++ )
+                apply_tsum( tnodes[i], tnodes[nb.neighbor[k]] );
         }
  
         //
@@ -88,6 +94,7 @@ int main( int argc, char **argv )
     //
     if( fsum )
         fclose( fsum );    
+    free_neighbors( nb );
     free( tnodes );
     if( fsave )
         fclose( fsave );
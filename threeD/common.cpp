@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <float.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "common.h"
+
+int mesh_pts;
+double bar_len;
+
+//
+//  tuned constants
+//  assume copper block
+//
+#define cond          413 // W/m-K
+#define dx          0.005 // m
+#define dt         0.0005 // s
+#define T_default     300 // K
+
+//
+//  Set number of mesh points
+//
+void set_len( int n )
+{
+    mesh_pts = n;
+}
+
+//
+//  Initialize the block: the faces i = 0 and i = n-1 are fixed, the
+//  rest of the surface is insulated
+//
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem )
+{
+    bar_len = bar_size;
+    grid.h = bar_size/(mesh_pts-1);
+    for (int j = 0; j < mesh_pts; j++) {
+        for (int l = 0; l < mesh_pts; l++) {
+            grid.T[node_index( grid, 0, j, l )] = ltem;
+            grid.flags[node_index( grid, 0, j, l )] = FIXED;
+
+            grid.T[node_index( grid, mesh_pts-1, j, l )] = rtem;
+            grid.flags[node_index( grid, mesh_pts-1, j, l )] = FIXED;
+        }
+    }
+
+    for (int i = 1; i < mesh_pts-1; i++) {
+        for (int j = 0; j < mesh_pts; j++) {
+            for (int l = 0; l < mesh_pts; l++) {
+                grid.T[node_index( grid, i, j, l )] = T_default;
+                grid.flags[node_index( grid, i, j, l )] = 0;
+            }
+        }
+    }
+
+    init_boundary( grid );
+}
+
+//
+//  I/O routines
+//
+void save( FILE *f, int step, int n, double *T )
+{
+    double h = bar_len / (n-1);
+    int ld = padded_len<double>( n );
+    int plane = (n+2) * ld;
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            for( int l = 0; l < n; l++ )
+                fprintf( f, "%d,%g,%g,%g,%g\n", step, l * h, j * h, i * h, T[(i+1)*plane + (j+1)*ld + l+1]);
+}
@@ -0,0 +1,33 @@
+#ifndef __CS267_COMMON_H__
+#define __CS267_COMMON_H__
+
+#include "../engine/heat.h"
+
+//
+//  saving parameters
+//
+const int NSTEPS = 1000;
+const int SAVEFREQ = 100;
+
+//
+// mesh data structure
+// a cube with two opposite faces held at a fixed temperature and no
+// heat source; node (i,j,l) lives at (i+1)*plane + (j+1)*ld + (l+1).
+// The other four faces are insulated. See engine/mesh.h for the layout
+// and engine/stencil.h for the kernels and the blocked sweeps.
+//
+typedef mesh_t<3, double, insulated, no_source> grid_t;
+
+//
+//  simulation routines
+//
+void set_len( int n );
+void init_bar( grid_t &grid, double bar_size, double ltem, double rtem );
+
+
+//
+//  I/O routines
+//
+void save( FILE *f, int step, int n, double *T );
+
+#endif
@@ -0,0 +1,187 @@
+#include <mpi.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "common.h"
+#include "../engine/mpi_converge.h"
+
+//
+//  Advance planes [lindex, rindex) by nsteps steps, sweeping the planes
+//  as step_tile( ) does. Step m also recomputes the nsteps-m planes on
+//  each side that step m+1 reads, so a halo nsteps planes deep, swapped
+//  once before the sweep, serves all of its steps.
+//
+static void step_slab( grid_t &grid, int nsteps, int lindex, int rindex, int width )
+{
+  int per_plane = grid.rows / grid.planes;
+  int shift = per_plane > 1 ? 1 : 0;
+  int blocks = (per_plane + shift * (nsteps-1) + width - 1) / width;
+  int pbegin = max( lindex - (nsteps-1), 0 );
+  int pend = min( rindex + (nsteps-1), grid.planes ) + SWEEP_SKEW * (nsteps-1);
+  for (int b = 0; b < blocks; b++) {
+    for (int s = pbegin; s < pend; s++) {
+      for (int m = 1; m <= nsteps; m++) {
+        int i = s - SWEEP_SKEW * (m-1);
+        if (i < max( lindex - (nsteps-m), 0 ) || i >= min( rindex + (nsteps-m), grid.planes ))
+          continue;
+        int jbegin = max( b * width - shift * (m-1), 0 );
+        int jend = min( (b+1) * width - shift * (m-1), per_plane );
+        if (jbegin < jend)
+          step_level<double>( grid, m, i * per_plane + jbegin, i * per_plane + jend );
+      }
+    }
+  }
+  if (nsteps % 2)
+    swap_grid( grid );
+}
+
+int main(int argc, char **argv) {
+  if (find_option(argc, argv, "-h") >= 0) {
+    printf( "Options:\n" );
+    printf( "-h to see this help\n" );
+    printf( "-n <int> to set the number of nodes per side\n" );
+    printf( "-o <filename> to specify the output file name\n" );
+    printf( "-s <filename> to specify a summary file name\n" );
+    printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+    printf( "-b <int> to advance up to <int> steps per sweep between halo swaps (temporal blocking);\n" );
+    printf( "         at most the planes of the thinnest slab\n" );
+    printf( "-w <int> to set the rows of a plane per block (spatial blocking)\n" );
+    printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+    printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+    printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+    printf( "-no turns off all correctness checks and particle output\n");
+    return 0;
+  }
+  int n = read_int( argc, argv, "-n", 100 );
+
+  char *savename = read_string( argc, argv, "-o", NULL );
+  char *sumname = read_string( argc, argv, "-s", NULL );
+  const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+  int depth = max( read_int( argc, argv, "-b", 1 ), 1 );
+
+  converge_t conv;
+  init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                 find_option( argc, argv, "-l2" ) >= 0 );
+
+  FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
+  FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
+  FILE *fout = find_option( argc, argv, "-no" ) == -1 ? fsave : NULL;
+
+  set_len( n );
+
+  // Set up MPI
+  int n_proc, rank;
+  MPI_Init(&argc, &argv);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // Partition the nodes across n_proc processors by plane
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  // A halo of depth planes must come from the next slab alone
+  depth = max( min( depth, n / n_proc ), 1 );
+
+  grid_t grid;
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  int width = max( read_int( argc, argv, "-w", block_width( grid, depth ) ), 1 );
+
+  // Planes are padded with a halo plane on each side, and plane i of
+  // the grid starts at (i+1)*plane
+  int plane = grid.plane;
+  MPI_Bcast(grid.T, grid.size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(grid.T_next, grid.size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  int dest_rank, source_rank;
+  MPI_Status status;
+
+  // Partitions differ in size when n_proc does not divide n
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * plane;
+    counts[p] = ((p + 1) * n / n_proc + 1) * plane - displs[p];
+  }
+
+  double *recv_buffer = alloc_aligned<double>(grid.size);
+
+  pending_check_t pending;
+  init_pending( pending );
+
+  double simulation_time = read_timer( );
+  for (int step = 0; step < NSTEPS; ++step) {
+    // Advance several steps per sweep, block by block, stopping at saved
+    // and checked steps
+    int nsteps = sweep_len( step, depth, NSTEPS, fout ? SAVEFREQ : 0 );
+    if( conv.tol > 0 )
+      nsteps = min( nsteps, sweep_len( step, depth, NSTEPS, conv.every ) );
+    step_slab( grid, nsteps, lindex, rindex, width );
+    step += nsteps - 1;
+
+    // Send depth planes to adjacent processors, enough for the next sweep
+    // Send to left
+    dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+    source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+    MPI_Sendrecv(&grid.T[node_index( grid, lindex, -1, -1 )], depth * plane, MPI_DOUBLE, dest_rank, 0,
+		    &grid.T[node_index( grid, rindex, -1, -1 )], depth * plane, MPI_DOUBLE, source_rank, 0,
+		    MPI_COMM_WORLD, &status);
+
+    // Send to right
+    dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+    source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+    MPI_Sendrecv(&grid.T[node_index( grid, rindex-depth, -1, -1 )], depth * plane, MPI_DOUBLE, dest_rank, 0,
+		 &grid.T[node_index( grid, lindex-depth, -1, -1 )], depth * plane, MPI_DOUBLE, source_rank, 0,
+		 MPI_COMM_WORLD, &status);
+
+    if( fout && (step % SAVEFREQ == 0)) {
+	    MPI_Gatherv(&grid.T[node_index( grid, lindex, -1, -1 )], (rindex - lindex) * plane, MPI_DOUBLE,
+			    recv_buffer, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	    if (rank == 0) {
+		    save( fout, step, n, recv_buffer );
+	    }
+    }
+
+    // Stop once the field has stopped changing. The check of a step is
+    // reduced while the next one is computed
+    if( finish_check( pending, conv ) )
+      break;
+    if( check_due( conv, step ) ) {
+      double largest = 0, sq = 0;
+      change_rows( grid, lindex * n, rindex * n, largest, sq );
+      start_check( pending, step, largest, sq );
+    }
+  }
+  finish_check( pending, conv );
+  simulation_time = read_timer( ) - simulation_time;
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, steps per sweep = %d, rows per block = %d, simulation time = %g seconds\n",
+            n, kernel, depth, width, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+  }
+
+  if( fsum && rank == 0 )
+    fprintf( fsum, "%d %d %g\n", n, n_proc, simulation_time );
+
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_grid( grid );
+
+  if( fsum )
+    fclose( fsum );
+  if( fsave )
+    fclose( fsave );
+
+  if (0 == rank)
+    print_memory( );
+
+  MPI_Finalize();
+
+  return 0;
+}
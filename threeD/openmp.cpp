@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "common.h"
+#include "../engine/tiles.h"
+#include "omp.h"
+
+//
+//  Run nsteps steps from the initial field without saving, as the
+//  reference for the tiled runs
+//
+static double run_reference( grid_t &grid, int n, int nsteps )
+{
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    double reference_time = read_timer( );
+    #pragma omp parallel
+    for( int step = 0; step < nsteps; step++ )
+    {
+        #pragma omp for
+        for( int i = 0; i < n; i++ )
+          step_rows( grid, i*n, (i+1)*n );
+
+        #pragma omp single
+        {
+          swap_grid( grid );
+          fill_ghosts( grid, 0, grid.rows );
+        }
+    }
+    return read_timer( ) - reference_time;
+}
+
+//
+//  benchmarking program
+//
+int main( int argc, char **argv )
+{   
+    int numthreads;
+
+    if( find_option( argc, argv, "-h" ) >= 0 )
+    {
+        printf( "Options:\n" );
+        printf( "-h to see this help\n" );
+        printf( "-n <int> to set the number of nodes per side\n" );
+        printf( "-o <filename> to specify the output file name\n" );
+        printf( "-s <filename> to specify a summary file name\n" ); 
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-b <int> to advance <int> steps per space-time tile (temporal blocking)\n" );
+        printf( "-r <int> to set the planes per space-time tile with -b\n" );
+        printf( "-w <int> to set the rows of a plane per block (spatial blocking)\n" );
+        printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+        printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-no turns off all correctness checks and particle output\n");   
+        return 0;
+    }
+
+    int n = read_int( argc, argv, "-n", 100 );
+    char *savename = read_string( argc, argv, "-o", NULL );
+    char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+    int depth = max( read_int( argc, argv, "-b", 1 ), 1 );
+    int height = read_int( argc, argv, "-r", 4 * depth );
+
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+
+    FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
+    FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;      
+    bool saving = fsave && find_option( argc, argv, "-no" ) == -1;
+
+    set_len( n );
+
+    grid_t grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    int width = max( read_int( argc, argv, "-w", block_width( grid, depth ) ), 1 );
+
+    //
+    //  tile bookkeeping for step_tiles( ); a band must be at least as
+    //  tall as the skew of a whole pass
+    //
+    height = max( height, SWEEP_SKEW * depth );
+    int *passes = (int *) calloc( tile_bands( grid, depth, height ), sizeof(int) );
+    int next = 0;
+
+    //
+    //  save if necessary
+    //
+    if( saving )
+        save( fsave, 0, n, grid.T );
+
+    //
+    //  simulate a number of time steps
+    //
+    double simulation_time = read_timer( );
+    double save_time = 0;
+    int steps = NSTEPS;
+    double largest = 0, sq = 0;
+
+    #pragma omp parallel
+    {
+    numthreads = omp_get_num_threads();
+    for( int step = 0; step < NSTEPS; )
+    {
+        //
+        //  advance in space-time tiles up to the next saved or checked
+        //  step
+        //
+        int nsteps = sweep_len( step, NSTEPS, NSTEPS, saving ? SAVEFREQ : 0 );
+        if( conv.tol > 0 )
+            nsteps = min( nsteps, sweep_len( step, NSTEPS, NSTEPS, conv.every ) );
+        step_tiles<double>( grid, nsteps, depth, height, width, passes, &next );
+        step += nsteps - 1;
+  
+        //
+        //  save if necessary, timing the output apart; the barrier keeps
+        //  the next steps from overwriting the field while it is written
+        //  out
+        //
+        if( saving && (step%SAVEFREQ) == 0 )
+        {
+            #pragma omp master
+            {
+              double t = read_timer( );
+              save( fsave, step, n, grid.T );
+              save_time += read_timer( ) - t;
+            }
+            #pragma omp barrier
+        }
+
+        //
+        //  stop once the field has stopped changing; the change is
+        //  reduced over the team, and conv and steps are only written
+        //  by the single
+        //
+        if( check_due( conv, step ) )
+        {
+            #pragma omp for reduction(max:largest) reduction(+:sq)
+            for( int i = 0; i < n; i++ )
+              change_rows( grid, i*n, (i+1)*n, largest, sq );
+
+            #pragma omp single
+            {
+              end_check( conv, step, largest, sq );
+              if( converged( conv ) )
+                steps = step + 1;
+              largest = sq = 0;
+            }
+            if( converged( conv ) )
+                break;
+        }
+        step++;
+    }
+}
+    simulation_time = read_timer( ) - simulation_time;
+    
+    printf( "n = %d,threads = %d, kernel = %s, rows per block = %d, simulation time = %g seconds\n", n,numthreads, kernel, width, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+
+    if( depth > 1 )
+    {
+        //
+        //  rerun step by step, without saving, to report the speedup
+        //  over the tiled steps alone and check the fields
+        //
+        grid_t ref;
+        double reference_time = run_reference( ref, n, steps );
+        printf( "steps per tile = %d, planes per tile = %d, step by step = %g seconds, speedup = %g, max difference = %g\n",
+                depth, height, reference_time, reference_time / (simulation_time - save_time), max_diff( grid, ref, 0, grid.rows ) );
+        free_grid( ref );
+    }
+
+    //
+    // Printing summary data
+    //
+    if( fsum )
+        fprintf( fsum, "%d %d %g\n", n, numthreads, simulation_time );
+
+    print_memory( );
+
+    //
+    // Clearing space
+    //
+    if( fsum )
+        fclose( fsum );
+
+    if( fsave )
+        fclose( fsave );
+
+    free( passes );
+    free_grid( grid );
+    
+    return 0;
+}
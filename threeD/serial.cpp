@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "common.h"
+
+//
+//  Run nsteps steps from the initial field without saving, as the
+//  reference for the blocked runs
+//
+static double run_reference( grid_t &grid, int n, int nsteps )
+{
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    double reference_time = read_timer( );
+    for( int step = 0; step < nsteps; step++ )
+    {
+        step_rows( grid, 0, grid.rows );
+        swap_grid( grid );
+        fill_ghosts( grid, 0, grid.rows );
+    }
+    return read_timer( ) - reference_time;
+}
+
+//
+//  benchmarking program
+//
+int main( int argc, char **argv )
+{    
+
+    if( find_option( argc, argv, "-h" ) >= 0 )
+    {
+        printf( "Options:\n" );
+        printf( "-h to see this help\n" );
+        printf( "-n <int> to set the number of nodes per side\n" );
+        printf( "-o <filename> to specify the output file name\n" );
+        printf( "-s <filename> to specify a summary file name\n" );
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-b <int> to advance up to <int> steps per sweep (temporal blocking)\n" );
+        printf( "-w <int> to set the rows of a plane per block (spatial blocking)\n" );
+        printf( "-tol <float> to stop once no node changes by this much in a step\n" );
+        printf( "-every <int> to check for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-no turns off all correctness checks and particle output\n");
+        return 0;
+    }
+
+    int n = read_int( argc, argv, "-n", 100 );
+
+    char *savename = read_string( argc, argv, "-o", NULL );
+    char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+    int depth = max( read_int( argc, argv, "-b", 1 ), 1 );
+    
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
+
+    FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
+    FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
+    bool saving = fsave && find_option( argc, argv, "-no" ) == -1;
+
+    set_len( n );
+
+    grid_t grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    int width = max( read_int( argc, argv, "-w", block_width( grid, depth ) ), 1 );
+
+    //
+    //  save if necessary
+    //
+    if( saving )
+        save( fsave, 0, n, grid.T );
+    
+    //
+    //  simulate a number of time steps
+    //
+    double simulation_time = read_timer( );
+    double save_time = 0;
+    int steps = NSTEPS;
+	
+    for( int step = 0; step < NSTEPS; )
+    {
+        //
+        //  advance several steps per sweep, block by block, stopping
+        //  at saved and checked steps
+        //
+        int nsteps = sweep_len( step, depth, NSTEPS, saving ? SAVEFREQ : 0 );
+        if( conv.tol > 0 )
+            nsteps = min( nsteps, sweep_len( step, depth, NSTEPS, conv.every ) );
+        step_blocked<double>( grid, nsteps, width );
+        step += nsteps - 1;
+
+        //
+        //  save if necessary, timing the output apart
+        //
+        if( saving && (step%SAVEFREQ) == 0 )
+        {
+            double t = read_timer( );
+            save( fsave, step, n, grid.T );
+            save_time += read_timer( ) - t;
+        }
+
+        //
+        //  stop once the field has stopped changing
+        //
+        if( check_step( conv, grid, step ) )
+        {
+            steps = step + 1;
+            break;
+        }
+        step++;
+    }
+    simulation_time = read_timer( ) - simulation_time;
+    
+    printf( "n = %d, kernel = %s, rows per block = %d, simulation time = %g seconds\n", n, kernel, width, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+
+    if( depth > 1 )
+    {
+        //
+        //  rerun step by step, without saving, to report the speedup
+        //  over the blocked steps alone and check the fields
+        //
+        grid_t ref;
+        double reference_time = run_reference( ref, n, steps );
+        printf( "steps per sweep = %d, step by step = %g seconds, speedup = %g, max difference = %g\n",
+                depth, reference_time, reference_time / (simulation_time - save_time), max_diff( grid, ref, 0, grid.rows ) );
+        free_grid( ref );
+    }
+
+    //
+    // Printing summary data
+    //
+    if( fsum )
+        fprintf( fsum, "%d %g\n", n, simulation_time );
+
+    print_memory( );
+
+    //
+    // Clearing space
+    //
+    if( fsum )
+        fclose( fsum );    
+    if( fsave )
+        fclose( fsave );
+    free_grid( grid );
+    
+    return 0;
+}
@@ -9,117 +9,89 @@
 #include "common.h"
 
 int mesh_pts;
+double bar_len;
 
 //
 //  tuned constants
 //  assume copper bar
 //
 #define cond          413 // W/m-K
-#define dx          0.005 // m
+#define rho          8960 // kg/m^3
+#define cp            385 // J/kg-K
 #define dt         0.0005 // s
 #define T_default     300 // K
 
 //
-//  timer
+//  Set number of mesh points
 //
-double read_timer( )
+void set_len( int n )
 {
-    static bool initialized = false;
-    static struct timeval start;
-    struct timeval end;
-    if( !initialized )
-    {
-        gettimeofday( &start, NULL );
-        initialized = true;
-    }
-    gettimeofday( &end, NULL );
-    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+    mesh_pts = n;
 }
 
 //
-//  Set number of mesh points
+//  Thermal diffusivity of the bar, in m^2/s
 //
-void set_len( int n )
+double diffusivity( )
 {
-    mesh_pts = n;
+    return (double) cond / (rho * cp);
+}
+
+//
+//  Length of a time step, in seconds, when none is given
+//
+double default_step( )
+{
+    return dt;
+}
+
+//
+//  Diffusion number alpha step / h^2 of an implicit step of step
+//  seconds with nodes h apart; a step of 0 is as long as the largest
+//  stable explicit one, r = 1/4
+//
+double diffusion_number( double step, double h )
+{
+    return step > 0 ? diffusivity( ) * step / (h * h) : 0.25;
 }
 
 //
 //  Initialize the bar
 //
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem )
+template <typename real>
+void init_bar( grid_t<real> &grid, double bar_size, double ltem, double rtem )
 {        
-    // Number of nodes to create
-    double step = 1.0/(mesh_pts-1);
+    bar_len = bar_size;
+    grid.h = bar_size/(mesh_pts-1);
     for (int j = 0; j < mesh_pts; j++) {
-        tnodes[j].T = ltem;
-        tnodes[j].T_sum = 0;
-        tnodes[j].x = step*j;
-        tnodes[j].y = 0;
-        tnodes[j].fixed = true;
-        tnodes[j].edge = true;
-
-        tnodes[(mesh_pts-1)*mesh_pts + j].T = rtem;
-        tnodes[(mesh_pts-1)*mesh_pts + j].T_sum = 0;
-        tnodes[(mesh_pts-1)*mesh_pts + j].x = step*j;
-        tnodes[(mesh_pts-1)*mesh_pts + j].y = bar_size;
-        tnodes[(mesh_pts-1)*mesh_pts + j].fixed = true;
-        tnodes[(mesh_pts-1)*mesh_pts + j].edge = true;
+        grid.T[node_index( grid, 0, j )] = ltem;
+        grid.flags[node_index( grid, 0, j )] = FIXED;
+
+        grid.T[node_index( grid, mesh_pts-1, j )] = rtem;
+        grid.flags[node_index( grid, mesh_pts-1, j )] = FIXED;
     }
     
     for (int i = 1; i < mesh_pts-1; i++) {
         for (int j = 1; j < mesh_pts-1; j++) {
-            tnodes[mesh_pts*i + j].T = T_default;
-            tnodes[mesh_pts*i + j].T_sum = 0;
-            tnodes[mesh_pts*i + j].x = (double) step*j;
-            tnodes[mesh_pts*i + j].y = (double) step*i;
-            tnodes[mesh_pts*i + j].fixed = false;
-            tnodes[mesh_pts*i + j].edge = false;
+            grid.T[node_index( grid, i, j )] = T_default;
+            grid.flags[node_index( grid, i, j )] = 0;
         }  
 
-        tnodes[mesh_pts*i].T = ltem;
-        tnodes[mesh_pts*i].T_sum = 0;
-        tnodes[mesh_pts*i].x = (double) 0;
-        tnodes[mesh_pts*i].y = (double) step*i;
-        tnodes[mesh_pts*i].fixed = true;
-        tnodes[mesh_pts*i].edge = true;
-
-        tnodes[mesh_pts*i + (mesh_pts-1)].T = rtem;
-        tnodes[mesh_pts*i + (mesh_pts-1)].T_sum = 0;
-        tnodes[mesh_pts*i + (mesh_pts-1)].x = (double) 0;
-        tnodes[mesh_pts*i + (mesh_pts-1)].y = (double) step*i;
-        tnodes[mesh_pts*i + (mesh_pts-1)].fixed = true;
-        tnodes[mesh_pts*i + (mesh_pts-1)].edge = true;
-    }
-}
+        grid.T[node_index( grid, i, 0 )] = ltem;
+        grid.flags[node_index( grid, i, 0 )] = FIXED;
 
-//
-//  interact two temperature nodes
-//
-void apply_tsum( node_t &tnode, node_t &neighbor)
-{
-    if (tnode.fixed) {
-        return;
+        grid.T[node_index( grid, i, mesh_pts-1 )] = rtem;
+        grid.flags[node_index( grid, i, mesh_pts-1 )] = FIXED;
     }
-    tnode.T_sum += neighbor.T;
-}
 
-//
-//  Solve for the temperature
-//
-void tupdate( node_t &tnode, double div )
-{
-    if (tnode.fixed) {
-        return;
-    }
-    tnode.T = ((double) tnode.T_sum) / ((double) div);
-    tnode.T_sum = 0;
+    init_boundary( grid );
 }
 
 //
 //  I/O routines
 //
-void save( FILE *f, int step, int n, node_t *tnode )
+template <typename real>
+void save( FILE *f, int step, int n, real *T )
 {
     //static bool first = true;
     //if( first )
@@ -127,33 +99,47 @@ void save( FILE *f, int step, int n, node_t *tnode )
     //    fprintf( f, "%d\n", n );
     //    first = false;
     //}
-    for( int i = 0; i < n*n; i++ )
-        fprintf( f, "%d,%g,%g,%g\n", step, tnode[i].x, tnode[i].y, tnode[i].T);
+    double h = bar_len / (n-1);
+    int ld = padded_len<real>( n );
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, T[(i+1)*ld + j+1]);
 }
 
 //
-//  command line option processing
+//  the same output labelled by the physical time in seconds instead of
+//  the step
 //
-int find_option( int argc, char **argv, const char *option )
+template <typename real>
+void save_at( FILE *f, double time, int n, real *T )
 {
-    for( int i = 1; i < argc; i++ )
-        if( strcmp( argv[i], option ) == 0 )
-            return i;
-    return -1;
+    double h = bar_len / (n-1);
+    int ld = padded_len<real>( n );
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            fprintf( f, "%g,%g,%g,%g\n", time, j * h, i * h, T[(i+1)*ld + j+1]);
 }
 
-int read_int( int argc, char **argv, const char *option, int default_value )
+//
+//  the same output from a field T in the Morton layout of m
+//
+template <typename real>
+void save( FILE *f, int step, int n, const morton_t<real> &m, const real *T )
 {
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return atoi( argv[iplace+1] );
-    return default_value;
+    double h = bar_len / (n-1);
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            fprintf( f, "%d,%g,%g,%g\n", step, j * h, i * h, T[morton_offset( m, i, j )]);
 }
 
-char *read_string( int argc, char **argv, const char *option, char *default_value )
-{
-    int iplace = find_option( argc, argv, option );
-    if( iplace >= 0 && iplace < argc-1 )
-        return argv[iplace+1];
-    return default_value;
-}
+//
+//  the routines above are built for double and float temperatures
+//
+#define INSTANTIATE_GRID( real ) \
+    template void init_bar( grid_t<real> &grid, double bar_size, double ltem, double rtem ); \
+    template void save( FILE *f, int step, int n, real *T ); \
+    template void save_at( FILE *f, double time, int n, real *T ); \
+    template void save( FILE *f, int step, int n, const morton_t<real> &m, const real *T );
+
+INSTANTIATE_GRID( double )
+INSTANTIATE_GRID( float )
@@ -1,8 +1,7 @@
 #ifndef __CS267_COMMON_H__
 #define __CS267_COMMON_H__
 
-inline int min( int a, int b ) { return a < b ? a : b; }
-inline int max( int a, int b ) { return a > b ? a : b; }
+#include "../engine/heat.h"
 
 //
 //  saving parameters
@@ -11,43 +10,32 @@ const int NSTEPS = 5000;
 const int SAVEFREQ = 10;
 
 //
-// mesh node data structure
-//
-typedef struct 
-{
-  double T;
-  double T_sum;
-  double x;
-  double y;
-  bool fixed;
-  bool edge;
-} node_t;
-
-//
-//  timing routines
+// mesh data structure
+// a square plate with every edge held at a fixed temperature and no
+// heat source; node (i,j) lives at (i+1)*ld + (j+1). The boundary is
+// insulated wherever init_bar leaves an edge node free. Temperatures
+// are stored as real, which is double or float; see engine/mesh.h for
+// the layout and engine/stencil.h for the kernels and temporal blocking.
 //
-double read_timer( );
+template <typename real>
+using grid_t = mesh_t<2, real, insulated, no_source>;
 
 //
 //  simulation routines
 //
 void set_len( int n );
-void init_bar( node_t *tnodes, double bar_size, double ltem, double rtem );
-void apply_tsum( node_t &tnode, node_t &neighbor );
-void tupdate( node_t &tnode, double div );
+double diffusivity( );
+double default_step( );
+double diffusion_number( double step, double h );
+template <typename real> void init_bar( grid_t<real> &grid, double bar_size, double ltem, double rtem );
 
 
 //
 //  I/O routines
 //
 FILE *open_save( char *filename, int n );
-void save( FILE *f, int step, int n, node_t *tnodes );
-
-//
-//  argument processing routines
-//
-int find_option( int argc, char **argv, const char *option );
-int read_int( int argc, char **argv, const char *option, int default_value );
-char *read_string( int argc, char **argv, const char *option, char *default_value );
+template <typename real> void save( FILE *f, int step, int n, real *T );
+template <typename real> void save_at( FILE *f, double time, int n, real *T );
+template <typename real> void save( FILE *f, int step, int n, const morton_t<real> &m, const real *T );
 
 #endif
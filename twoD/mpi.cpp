@@ -3,7 +3,695 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include "common.h"
+#include "../engine/mpi_converge.h"
+
+template <typename real> MPI_Datatype mpi_type( );
+template <> MPI_Datatype mpi_type<double>( ) { return MPI_DOUBLE; }
+template <> MPI_Datatype mpi_type<float>( ) { return MPI_FLOAT; }
+
+//
+//  Send the edge rows of [lindex, rindex) of v, laid out as the nodes of
+//  grid, to the neighbouring processes and receive theirs into the rows
+//  next to it
+//
+template <typename real, typename value>
+static void exchange_rows( const grid_t<real> &grid, value *v, int lindex, int rindex )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<value>( );
+  int ld = grid.ld;
+
+  int dest_rank, source_rank;
+  MPI_Status status;
+
+  // Send to left
+  dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+  source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+  MPI_Sendrecv(&v[node_index( grid, lindex, -1 )], ld, type, dest_rank, 0,
+	       &v[node_index( grid, rindex, -1 )], ld, type, source_rank, 0,
+	       MPI_COMM_WORLD, &status);
+
+  // Send to right
+  dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+  source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+  MPI_Sendrecv(&v[node_index( grid, rindex-1, -1 )], ld, type, dest_rank, 0,
+	       &v[node_index( grid, lindex-1, -1 )], ld, type, source_rank, 0,
+	       MPI_COMM_WORLD, &status);
+}
+
+template <typename real>
+static void exchange_rows( grid_t<real> &grid, int lindex, int rindex )
+{
+  exchange_rows( grid, grid.T, lindex, rindex );
+}
+
+//
+//  communication of implicit.h for a process owning rows [lindex, rindex)
+//
+template <typename real>
+struct mpi_comm
+{
+  const grid_t<real> &grid;
+  int lindex, rindex;
+
+  void sum( double *x, int count ) const
+  {
+    MPI_Allreduce(MPI_IN_PLACE, x, count, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  }
+  template <typename value> void exchange( value *v ) const
+  {
+    exchange_rows( grid, v, lindex, rindex );
+  }
+};
+
+//
+//  Simulate with temperatures stored as real and summed as acc, each
+//  process updating the rows [lindex, rindex) of grid, for at most steps
+//  steps or until conv says the field has stopped changing; steps is
+//  then set to the number of steps taken
+//
+template <typename real, typename acc>
+static double run( grid_t<real> &grid, int n, int lindex, int rindex, FILE *fsave, converge_t &conv, int &steps )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+
+  // Rows are padded with a halo node on each side, and row i of the
+  // grid starts at (i+1)*ld
+  int ld = grid.ld;
+  MPI_Bcast(grid.T, (n+2) * ld, type, 0, MPI_COMM_WORLD);
+  MPI_Bcast(grid.T_next, (n+2) * ld, type, 0, MPI_COMM_WORLD);
+
+  // Partitions differ in size when n_proc does not divide n
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * ld;
+    counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+  }
+
+  real *recv_buffer = alloc_aligned<real>((n+2) * ld);
+
+  pending_check_t pending;
+  init_pending( pending );
+
+  double simulation_time = read_timer( );
+  int step;
+  for (step = 0; step < steps; ++step) {
+    // Compute temperature changes
+    step_rows<acc>( grid, lindex, rindex );
+
+    // Update temperatures
+    swap_grid( grid );
+
+    // Send adjacent particles to adjacent processors
+    exchange_rows( grid, lindex, rindex );
+
+    // Ghosts may copy nodes that just arrived from a neighbour
+    fill_ghosts( grid, lindex, rindex );
+
+    if( fsave && (step % SAVEFREQ == 0)) {
+	    MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, type,
+			    recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+	    if (rank == 0) {
+		    save( fsave, step, n, recv_buffer );
+	    }
+    }
+
+    // Stop once the field has stopped changing. The check of a step is
+    // reduced while the next one is computed
+    if( finish_check( pending, conv ) ) {
+      ++step;
+      break;
+    }
+    if( check_due( conv, step ) ) {
+      double largest = 0, sq = 0;
+      change_rows( grid, lindex, rindex, largest, sq );
+      start_check( pending, step, largest, sq );
+    }
+  }
+  finish_check( pending, conv );
+  simulation_time = read_timer( ) - simulation_time;
+  steps = step;
+
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  return simulation_time;
+}
+
+template <typename real, typename acc>
+static void simulate( int n, converge_t conv, FILE *fsave, FILE *fsum, const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // Partition the nodes across n_proc processors by x value
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  grid_t<real> grid;
+  int steps = NSTEPS;
+  double simulation_time = run<real, acc>( grid, n, lindex, rindex, fsave, conv, steps );
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    if( conv.tol > 0 )
+      printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+              conv.step, conv.max_change, conv.l2_change );
+  }
+
+  // Summary data, with the largest deviation from a double precision
+  // run when the temperatures are stored as float
+  if( fsum ) {
+    double deviation = 0;
+    if( sizeof(real) != sizeof(double) ) {
+      grid_t<double> ref;
+      converge_t fixed;
+      init_converge( fixed, 0, 1, false );
+      run<double, double>( ref, n, lindex, rindex, NULL, fixed, steps );
+      double local = max_diff( grid, ref, lindex, rindex );
+      MPI_Reduce(&local, &deviation, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+      free_grid( ref );
+    }
+    if (rank == 0)
+      fprintf( fsum, "%d %d %g %s %g\n", n, n_proc, simulation_time, precision, deviation );
+  }
+
+  free_grid( grid );
+}
+
+//
+//  Tiles [first[p], first[p+1]) of a Morton field belong to process p.
+//  Send the edges of the tiles of this process that the tiles of
+//  another need, tile by tile and side by side, and receive theirs, in
+//  the same order, into the same places of T, where the frames of the
+//  tiles of this process copy them from. Each buffer holds an edge of
+//  every side of every tile.
+//
+template <typename real>
+static void exchange_tiles( const morton_t<real> &m, const int *first, real *send, real *recv, MPI_Request *requests )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  int nsent = 0, nreceived = 0, nrequests = 0;
+  for (int q = 0; q < n_proc; ++q) {
+    if (q == rank)
+      continue;
+    int sent = nsent, received = nreceived;
+    for (int t = first[rank]; t < first[rank+1]; ++t)
+      for (int s = 0; s < 4; ++s) {
+        int nb = m.neighbours[4*t + s];
+        if (nb < first[q] || nb >= first[q+1])
+          continue;
+        int stride, edge = morton_edge( t, s, stride );
+        for (int k = 0; k < MORTON_TILE; ++k)
+          send[nsent++] = m.T[edge + k*stride];
+      }
+    for (int t = first[q]; t < first[q+1]; ++t)
+      for (int s = 0; s < 4; ++s) {
+        int nb = m.neighbours[4*t + s];
+        if (nb >= first[rank] && nb < first[rank+1])
+          nreceived += MORTON_TILE;
+      }
+    if (nreceived > received) {
+      MPI_Irecv(&recv[received], nreceived - received, type, q, 0, MPI_COMM_WORLD, &requests[nrequests++]);
+      MPI_Isend(&send[sent], nsent - sent, type, q, 0, MPI_COMM_WORLD, &requests[nrequests++]);
+    }
+  }
+  MPI_Waitall(nrequests, requests, MPI_STATUSES_IGNORE);
+
+  nreceived = 0;
+  for (int q = 0; q < n_proc; ++q) {
+    if (q == rank)
+      continue;
+    for (int t = first[q]; t < first[q+1]; ++t)
+      for (int s = 0; s < 4; ++s) {
+        int nb = m.neighbours[4*t + s];
+        if (nb < first[rank] || nb >= first[rank+1])
+          continue;
+        int stride, edge = morton_edge( t, s, stride );
+        for (int k = 0; k < MORTON_TILE; ++k)
+          m.T[edge + k*stride] = recv[nreceived++];
+      }
+  }
+}
+
+//
+//  run( ) with the field in tiles along a Z curve, each process
+//  updating a run of tiles, a compact block of the field
+//
+template <typename real, typename acc>
+static double run_morton( morton_t<real> &m, int n, FILE *fsave, converge_t &conv, int &steps )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  {
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    init_morton( m, grid );
+    free_grid( grid );
+  }
+
+  // Runs of tiles differ in length when n_proc does not divide them
+  int *first = (int *) malloc((n_proc + 1) * sizeof(int));
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p <= n_proc; ++p)
+    first[p] = p * m.ntiles / n_proc;
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = first[p] * MORTON_SIZE;
+    counts[p] = (first[p+1] - first[p]) * MORTON_SIZE;
+  }
+
+  real *send = alloc_aligned<real>(4 * MORTON_TILE * m.ntiles);
+  real *recv = alloc_aligned<real>(4 * MORTON_TILE * m.ntiles);
+  MPI_Request *requests = (MPI_Request *) malloc(2 * n_proc * sizeof(MPI_Request));
+  real *recv_buffer = alloc_aligned<real>(m.ntiles * MORTON_SIZE);
+
+  pending_check_t pending;
+  init_pending( pending );
+
+  double simulation_time = read_timer( );
+  int step;
+  for (step = 0; step < steps; ++step) {
+    step_morton<acc>( m, first[rank], first[rank+1] );
+    swap_morton( m );
+    exchange_tiles( m, first, send, recv, requests );
+    fill_morton_ghosts( m );
+
+    if( fsave && (step % SAVEFREQ == 0)) {
+      MPI_Gatherv(&m.T[displs[rank]], counts[rank], type, recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+      if (rank == 0)
+        save( fsave, step, n, m, recv_buffer );
+    }
+
+    if( finish_check( pending, conv ) ) {
+      ++step;
+      break;
+    }
+    if( check_due( conv, step ) ) {
+      double largest = 0, sq = 0;
+      change_morton( m, first[rank], first[rank+1], largest, sq );
+      start_check( pending, step, largest, sq );
+    }
+  }
+  finish_check( pending, conv );
+  simulation_time = read_timer( ) - simulation_time;
+  steps = step;
+
+  free_aligned( recv_buffer );
+  free_aligned( send );
+  free_aligned( recv );
+  free( requests );
+  free( first );
+  free( counts );
+  free( displs );
+  return simulation_time;
+}
+
+template <typename real, typename acc>
+static void simulate_morton( int n, converge_t conv, FILE *fsave, FILE *fsum, const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  morton_t<real> m;
+  int steps = NSTEPS;
+  double simulation_time = run_morton<real, acc>( m, n, fsave, conv, steps );
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "layout = morton, %d tiles of %d x %d nodes\n", m.ntiles, MORTON_TILE, MORTON_TILE );
+    if( conv.tol > 0 )
+      printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+              conv.step, conv.max_change, conv.l2_change );
+  }
+
+  // Summary data, with the largest deviation from a double precision
+  // run when the temperatures are stored as float
+  if( fsum ) {
+    double deviation = 0;
+    if( sizeof(real) != sizeof(double) ) {
+      morton_t<double> ref;
+      converge_t fixed;
+      init_converge( fixed, 0, 1, false );
+      run_morton<double, double>( ref, n, NULL, fixed, steps );
+      double local = 0;
+      int tbegin = rank * m.ntiles / n_proc, tend = (rank + 1) * m.ntiles / n_proc;
+      for (int t = tbegin; t < tend; ++t)
+        for (int li = 0; li < MORTON_TILE; ++li) {
+          int row = t * MORTON_SIZE + (li+1) * MORTON_LD + 1;
+          for (int j = m.row_begin[t * MORTON_TILE + li]; j < m.row_end[t * MORTON_TILE + li]; ++j)
+            local = fmax( local, fabs( (double) m.T[row + j] - ref.T[row + j] ) );
+        }
+      MPI_Reduce(&local, &deviation, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+      free_morton( ref );
+    }
+    if (rank == 0)
+      fprintf( fsum, "%d %d %g %s %g\n", n, n_proc, simulation_time, precision, deviation );
+  }
+
+  free_morton( m );
+}
+
+//
+//  Solve for the steady state alone by red-black SOR, in at most NSTEPS
+//  sweeps or the sor.limit the bar needs. Every colour is followed by a
+//  halo exchange, and every sweep by a reduction of the largest change,
+//  so all processes stop together.
+//
+template <typename real, typename acc>
+static void solve_steady( int n, double omega, double tol, FILE *fsave, FILE *fsum,
+                          const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  grid_t<real> grid;
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  int ld = grid.ld;
+
+  sor_t sor;
+  init_sor( sor, grid, omega, tol );
+
+  double simulation_time = read_timer( );
+  while( !converged( sor ) && sor.sweeps < max( NSTEPS, sor.limit ) ) {
+    double change = 0;
+    for (int color = 0; color < sor.colors; ++color) {
+      change = fmax( change, relax_rows<acc>( grid, sor, color, lindex, rindex ) );
+      exchange_rows( grid, lindex, rindex );
+      fill_ghosts( grid, lindex, rindex );
+    }
+    double global;
+    MPI_Allreduce(&change, &global, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    end_sweep( sor, global );
+  }
+  simulation_time = read_timer( ) - simulation_time;
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "sweeps = %d, omega = %g, last change = %g, %s\n", sor.sweeps, sor.omega, sor.change,
+            converged( sor ) ? "converged" : "not converged" );
+  }
+
+  if( fsave ) {
+    int *counts = (int *) malloc(n_proc * sizeof(int));
+    int *displs = (int *) malloc(n_proc * sizeof(int));
+    for (int p = 0; p < n_proc; ++p) {
+      displs[p] = (p * n / n_proc + 1) * ld;
+      counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+    }
+    real *recv_buffer = alloc_aligned<real>((n+2) * ld);
+    MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, type,
+                recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+      save( fsave, sor.sweeps, n, recv_buffer );
+    free_aligned( recv_buffer );
+    free( counts );
+    free( displs );
+  }
+
+  if( fsum && rank == 0 )
+    fprintf( fsum, "%d %d %g %s %d\n", n, n_proc, simulation_time, precision, sor.sweeps );
+
+  free_sor( sor );
+  free_grid( grid );
+}
+
+//
+//  Advance to the physical time end_time, in fixed steps of step_len
+//  seconds (the largest stable step if 0) or, with a tolerance tol in
+//  kelvin, in steps adapted to change no node by much more than tol,
+//  starting from step_len (the default step if 0). Frames are saved
+//  every SAVEFREQ steps and at end_time, labelled by their time in
+//  seconds.
+//  Every process keeps its own ts; the largest change of an adapted
+//  step is reduced over all of them, so they all pick the same next
+//  step.
+//
+template <typename real, typename acc>
+static void simulate_physical( int n, double end_time, double step_len, double tol, FILE *fsave, FILE *fsum,
+                               const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  grid_t<real> grid;
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  int ld = grid.ld;
+
+  timestep_t ts;
+  if( tol > 0 && step_len <= 0 )
+    step_len = default_step( );
+  init_timestep( ts, grid, diffusivity( ), step_len, tol, end_time );
+
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * ld;
+    counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+  }
+  real *recv_buffer = alloc_aligned<real>((n+2) * ld);
+
+  double simulation_time = read_timer( );
+  while( !reached( ts ) ) {
+    begin_step( ts, grid );
+    step_rows<acc>( grid, lindex, rindex );
+    swap_grid( grid );
+    exchange_rows( grid, lindex, rindex );
+    fill_ghosts( grid, lindex, rindex );
+
+    double change = 0, sq = 0;
+    if( tol > 0 ) {
+      double local = 0;
+      change_rows( grid, lindex, rindex, local, sq );
+      MPI_Allreduce(&local, &change, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    }
+    end_step( ts, change );
+
+    if( fsave && (ts.steps % SAVEFREQ == 0 || reached( ts ))) {
+      MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, type,
+                  recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+      if (rank == 0)
+        save_at( fsave, ts.time, n, recv_buffer );
+    }
+  }
+  simulation_time = read_timer( ) - simulation_time;
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "physical time = %g s in %d steps of %g to %g s (stable up to %g s), or %d steps of %g s\n",
+            ts.time, ts.steps, ts.shortest, ts.longest, ts.dt_max, (int) ceil( end_time / default_step( ) ), default_step( ) );
+  }
+
+  if( fsum && rank == 0 )
+    fprintf( fsum, "%d %d %g %s %g %d\n", n, n_proc, simulation_time, precision, ts.time, ts.steps );
+
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_grid( grid );
+}
+
+//
+//  Advance NSTEPS implicit steps of step seconds with the theta scheme.
+//  Every CG iteration exchanges the search direction and reduces two
+//  pairs of dot products over all processes.
+//
+template <typename real>
+static void simulate_implicit( int n, double theta, double step_len, double tol, FILE *fsave, FILE *fsum,
+                               const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  grid_t<real> grid;
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  int ld = grid.ld;
+
+  implicit_t imp;
+  init_implicit( imp, grid, diffusion_number( step_len, grid.h ), theta, tol );
+  mpi_comm<real> comm = { grid, lindex, rindex };
+
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * ld;
+    counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+  }
+  real *recv_buffer = alloc_aligned<real>((n+2) * ld);
+
+  int iterations = 0;
+  double simulation_time = read_timer( );
+  for (int step = 0; step < NSTEPS; ++step) {
+    implicit_step( grid, imp, lindex, rindex, comm );
+    iterations += imp.iterations;
+
+    if( fsave && (step % SAVEFREQ == 0)) {
+      MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, type,
+                  recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+      if (rank == 0)
+        save( fsave, step, n, recv_buffer );
+    }
+  }
+  simulation_time = read_timer( ) - simulation_time;
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "%s, diffusion number = %g (explicit steps take 0.25), CG iterations per step = %g\n",
+            theta == 1 ? "backward Euler" : "Crank-Nicolson", imp.r, (double) iterations / NSTEPS );
+  }
+
+  if( fsum && rank == 0 )
+    fprintf( fsum, "%d %d %g %s %g %d\n", n, n_proc, simulation_time, precision, imp.r, iterations );
+
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_implicit( imp );
+  free_grid( grid );
+}
+
+//
+//  Solve the columns of the second ADI half step for rows
+//  [lindex, rindex). A column crosses every process, so the columns are
+//  pipelined in blocks of ADI_COLUMNS: a process eliminates a block
+//  down its rows as soon as the one above has passed on the eliminated
+//  right hand sides of its last row, and substitutes back up them as
+//  soon as the one below has passed on the solution of its first row,
+//  while the others work on the next block.
+//
+template <typename real>
+static void adi_columns( const grid_t<real> &grid, const adi_t &adi, int lindex, int rindex )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int up = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
+  int down = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
+  int n = grid.n;
+
+  for (int jlo = 0; jlo < n; jlo += ADI_COLUMNS) {
+    int jhi = min(n, jlo + ADI_COLUMNS);
+    int above = row_index( grid, lindex - 1 ) + jlo;
+    int last = row_index( grid, rindex - 1 ) + jlo;
+    adi_edges( grid, adi, jlo, jhi );
+    MPI_Recv(&adi.d[above], jhi - jlo, MPI_DOUBLE, up, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    adi_forward( grid, adi, lindex, rindex, jlo, jhi );
+    MPI_Send(&adi.d[last], jhi - jlo, MPI_DOUBLE, down, 0, MPI_COMM_WORLD);
+  }
+
+  for (int jlo = 0; jlo < n; jlo += ADI_COLUMNS) {
+    int jhi = min(n, jlo + ADI_COLUMNS);
+    int below = row_index( grid, rindex ) + jlo;
+    int first = row_index( grid, lindex ) + jlo;
+    MPI_Recv(&adi.d[below], jhi - jlo, MPI_DOUBLE, down, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    adi_backward( grid, adi, lindex, rindex, jlo, jhi );
+    MPI_Send(&adi.d[first], jhi - jlo, MPI_DOUBLE, up, 1, MPI_COMM_WORLD);
+  }
+}
+
+//
+//  Advance NSTEPS ADI steps of step seconds. The rows of the first half
+//  step are local once the rows next to the slab have been exchanged,
+//  and solved in the batches of adi.h cut to the slab; the columns of
+//  the second are pipelined by adi_columns( ).
+//
+template <typename real>
+static void simulate_adi( int n, double step_len, FILE *fsave, FILE *fsum,
+                          const char *kernel, const char *precision )
+{
+  int n_proc, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Datatype type = mpi_type<real>( );
+
+  int lindex = rank * n / n_proc;
+  int rindex = (rank + 1) * n / n_proc;
+
+  grid_t<real> grid;
+  alloc_grid( grid, n );
+  init_bar( grid, (double) 1.0, 400, 200 );
+  int ld = grid.ld;
+
+  adi_t adi;
+  init_adi( adi, grid, diffusion_number( step_len, grid.h ) );
+
+  int *counts = (int *) malloc(n_proc * sizeof(int));
+  int *displs = (int *) malloc(n_proc * sizeof(int));
+  for (int p = 0; p < n_proc; ++p) {
+    displs[p] = (p * n / n_proc + 1) * ld;
+    counts[p] = ((p + 1) * n / n_proc + 1) * ld - displs[p];
+  }
+  real *recv_buffer = alloc_aligned<real>((n+2) * ld);
+
+  double simulation_time = read_timer( );
+  for (int step = 0; step < NSTEPS; ++step) {
+    exchange_rows( grid, lindex, rindex );
+    for (int r = lindex; r < rindex; r = min(rindex, (r / ADI_LANES + 1) * ADI_LANES))
+      adi_rows( grid, adi, r, min(rindex, (r / ADI_LANES + 1) * ADI_LANES) );
+    adi_columns( grid, adi, lindex, rindex );
+
+    if( fsave && (step % SAVEFREQ == 0)) {
+      MPI_Gatherv(&grid.T[node_index( grid, lindex, -1 )], (rindex - lindex) * ld, type,
+                  recv_buffer, counts, displs, type, 0, MPI_COMM_WORLD);
+      if (rank == 0)
+        save( fsave, step, n, recv_buffer );
+    }
+  }
+  simulation_time = read_timer( ) - simulation_time;
+
+  if (0 == rank) {
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "ADI, diffusion number = %g (explicit steps take 0.25)\n", adi.r );
+  }
+
+  if( fsum && rank == 0 )
+    fprintf( fsum, "%d %d %g %s %g\n", n, n_proc, simulation_time, precision, adi.r );
+
+  free_aligned( recv_buffer );
+  free( counts );
+  free( displs );
+  free_adi( adi );
+  free_grid( grid );
+}
 
 int main(int argc, char **argv) {
   if (find_option(argc, argv, "-h") >= 0) {
@@ -12,6 +700,25 @@ int main(int argc, char **argv) {
     printf( "-n <int> to set the number of particles\n" );
     printf( "-o <filename> to specify the output file name\n" );
     printf( "-s <filename> to specify a summary file name\n" );
+    printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+    printf( "-prec <name> to store temperatures as double, float or mixed (float summed as double, not\n" );
+    printf( "              with -implicit or -adi)\n" );
+    printf( "-sor to solve for the steady state by red-black SOR instead of time stepping\n" );
+    printf( "-omega <float> to set the over-relaxation factor with -sor (estimated by default)\n" );
+    printf( "-tol <float> to stop time stepping once no node changes by this much in a step, -sor once no\n" );
+    printf( "             node changes by this much in a sweep, or an -implicit step\n" );
+    printf( "             once CG has reduced the residual by this factor\n" );
+    printf( "-implicit <be|cn> to take backward Euler or Crank-Nicolson steps solved by preconditioned CG\n" );
+    printf( "-adi to take alternating-direction implicit steps solved line by line\n" );
+    printf( "-dt <float> to set the length of an -implicit, -adi or -time step, or the first -adapt one, in\n" );
+    printf( "            seconds; -time steps default to the largest stable one and -adapt starts from the\n" );
+    printf( "            default one, while the 5000 -implicit or -adi steps default to spanning -time, or without\n" );
+    printf( "            it to the largest stable explicit step\n" );
+    printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+    printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+    printf( "-time <float> to advance physically scaled steps to this many seconds of simulated time\n" );
+    printf( "-adapt <float> to adapt -time steps to change no node by more than about this many kelvin\n" );
+    printf( "-layout <name> to store the field row by row (row) or in tiles along a Z curve (morton)\n" );
     printf( "-no turns off all correctness checks and particle output\n");
     return 0;
   }
@@ -19,102 +726,127 @@ int main(int argc, char **argv) {
 
   char *savename = read_string( argc, argv, "-o", NULL );
   char *sumname = read_string( argc, argv, "-s", NULL );
+  const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+  const char *precision = read_string( argc, argv, "-prec", (char *) "double" );
+  const char *layout = read_string( argc, argv, "-layout", (char *) "row" );
+  bool morton = strcmp( layout, "morton" ) == 0;
 
   FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
   FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
+  FILE *fout = find_option( argc, argv, "-no" ) == -1 ? fsave : NULL;
+
+  converge_t conv;
+  init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                 find_option( argc, argv, "-l2" ) >= 0 );
 
-  node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
   set_len( n );
-  init_bar( tnodes, (double) 1.0, 400, 200 );
 
   // Set up MPI
-  int n_proc, rank;
   MPI_Init(&argc, &argv);
-  MPI_Comm_size(MPI_COMM_WORLD, &n_proc);
+  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  MPI_Datatype NODE;
-  int blocklen[2] = {4, 2};
-  MPI_Aint displacements[2] = {0, 32};
-  MPI_Datatype types[2] = {MPI_DOUBLE, MPI_C_BOOL};
-  MPI_Type_create_struct(2, blocklen, displacements, types, &NODE);
-  MPI_Type_commit(&NODE);
-
-  // Partition the nodes across n_proc processors by x value
-  MPI_Bcast(tnodes, n * n, NODE, 0, MPI_COMM_WORLD);
-  double width = 1.0 / n_proc;
-  int lindex = rank * n / n_proc;
-  int rindex = (rank + 1) * n / n_proc;
-
-  int tag;
-  int dest_rank, source_rank;
-  MPI_Status status;
+  if( !morton && strcmp( layout, "row" ) != 0 ) {
+    if (0 == rank)
+      fprintf( stderr, "unknown -layout %s; use row or morton\n", layout );
+    MPI_Finalize();
+    return 1;
+  }
 
-  node_t *recv_buffer = (node_t *) malloc(n * n * sizeof(node_t));
+  if( strcmp( precision, "double" ) && strcmp( precision, "float" ) && strcmp( precision, "mixed" ) ) {
+    if (0 == rank)
+      fprintf( stderr, "unknown -prec %s; use double, float or mixed\n", precision );
+    MPI_Finalize();
+    return 1;
+  }
 
-  double simulation_time = read_timer( );
-  for (int step = 0; step < NSTEPS; ++step) {
-    // Compute temperature changes
-    for (int i = lindex; i < rindex; ++i) {
-      for (int j = 0; j < n; ++j) {
-	      if ((i-1) >= 0)
-		      apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-	      if ((i+1) < n)
-		      apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-	      if ((j-1) >= 0)
-		      apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-	      if ((j+1) < n)
-		      apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-      }
-    }
+  // Multigrid would need its coarse levels spread over the processes,
+  // which this driver does not do
+  if( find_option( argc, argv, "-mg" ) >= 0 ) {
+    if (0 == rank)
+      fprintf( stderr, "-mg is not available with MPI; use -sor, or the serial or openmp driver\n" );
+    MPI_Finalize();
+    return 1;
+  }
 
-    // Update temperatures
-    for( int i = lindex; i < rindex; i++ ) {
-      for( int j = 0; j < n; ++j ) {
-	if (tnodes[i*n + j].edge)
-	  tupdate( tnodes[i*n + j], 3);
-        else
-	  tupdate( tnodes[i*n + j], 4);
-      } 
-    }
+  // Sine transforms of the whole plate would need an all-to-all
+  // transpose of the slabs, which this driver does not do either
+  if( find_option( argc, argv, "-spectral" ) >= 0 ) {
+    if (0 == rank)
+      fprintf( stderr, "-spectral is not available with MPI; use the serial or openmp driver\n" );
+    MPI_Finalize();
+    return 1;
+  }
 
-    // Send adjacent particles to adjacent processors
-    // Send to left
-    dest_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
-    source_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
-    MPI_Sendrecv(&tnodes[lindex*n], n, NODE, dest_rank, 0,
-		    &tnodes[rindex*n], n, NODE, source_rank, 0,
-		    MPI_COMM_WORLD, &status);
-
-    // Send to right
-    dest_rank = (rank == n_proc - 1) ? MPI_PROC_NULL : (rank + 1);
-    source_rank = (rank == 0) ? MPI_PROC_NULL : (rank - 1);
-    MPI_Sendrecv(&tnodes[(rindex-1)*n], n, NODE, dest_rank, 0,
-		 &tnodes[(lindex-1)*n], n, NODE, source_rank, 0,
-		 MPI_COMM_WORLD, &status);
-
-    if( find_option( argc, argv, "-no" ) == -1 ) {
-	    if( fsave && (step % SAVEFREQ == 0)) {
-		    MPI_Allgather(&tnodes[lindex*n], (rindex - lindex) * n, NODE,
-				    recv_buffer, (rindex - lindex) * n, NODE, MPI_COMM_WORLD);
-		    if (rank == 0) {
-			    save( fsave, step, n, recv_buffer );
-		    }
-	    }
-    }
+  // The implicit and ADI solvers store and sum the field in one type
+  if( strcmp( precision, "mixed" ) == 0 &&
+      ( find_option( argc, argv, "-implicit" ) >= 0 || find_option( argc, argv, "-adi" ) >= 0 ) ) {
+    if (0 == rank)
+      fprintf( stderr, "-prec mixed is not available with -implicit or -adi; use double or float\n" );
+    MPI_Finalize();
+    return 1;
   }
-  simulation_time = read_timer( ) - simulation_time;
 
-  if (0 == rank) {
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+  if( find_option( argc, argv, "-implicit" ) >= 0 ) {
+    double theta = strcmp( read_string( argc, argv, "-implicit", (char *) "be" ), "cn" ) == 0 ? 0.5 : 1;
+    double step_len = read_double( argc, argv, "-dt", read_double( argc, argv, "-time", 0 ) / NSTEPS );
+    double tol = read_double( argc, argv, "-tol", 0 );
+    if( strcmp( precision, "double" ) == 0 )
+      simulate_implicit<double>( n, theta, step_len, tol, fout, fsum, kernel, precision );
+    else
+      simulate_implicit<float>( n, theta, step_len, tol, fout, fsum, kernel, precision );
+  }
+  else if( find_option( argc, argv, "-adi" ) >= 0 ) {
+    double step_len = read_double( argc, argv, "-dt", read_double( argc, argv, "-time", 0 ) / NSTEPS );
+    if( strcmp( precision, "double" ) == 0 )
+      simulate_adi<double>( n, step_len, fout, fsum, kernel, precision );
+    else
+      simulate_adi<float>( n, step_len, fout, fsum, kernel, precision );
+  }
+  else if( find_option( argc, argv, "-sor" ) >= 0 ) {
+    double omega = read_double( argc, argv, "-omega", 0 );
+    double tol = read_double( argc, argv, "-tol", 0 );
+    if( strcmp( precision, "float" ) == 0 )
+      solve_steady<float, float>( n, omega, tol, fout, fsum, kernel, precision );
+    else if( strcmp( precision, "mixed" ) == 0 )
+      solve_steady<float, double>( n, omega, tol, fout, fsum, kernel, precision );
+    else
+      solve_steady<double, double>( n, omega, tol, fout, fsum, kernel, "double" );
   }
+  else if( find_option( argc, argv, "-time" ) >= 0 ) {
+    double end_time = read_double( argc, argv, "-time", 0 );
+    double step_len = read_double( argc, argv, "-dt", 0 );
+    double tol = read_double( argc, argv, "-adapt", 0 );
+    if( strcmp( precision, "float" ) == 0 )
+      simulate_physical<float, float>( n, end_time, step_len, tol, fout, fsum, kernel, precision );
+    else if( strcmp( precision, "mixed" ) == 0 )
+      simulate_physical<float, double>( n, end_time, step_len, tol, fout, fsum, kernel, precision );
+    else
+      simulate_physical<double, double>( n, end_time, step_len, tol, fout, fsum, kernel, "double" );
+  }
+  else if( morton ) {
+    if( strcmp( precision, "float" ) == 0 )
+      simulate_morton<float, float>( n, conv, fout, fsum, kernel, precision );
+    else if( strcmp( precision, "mixed" ) == 0 )
+      simulate_morton<float, double>( n, conv, fout, fsum, kernel, precision );
+    else
+      simulate_morton<double, double>( n, conv, fout, fsum, kernel, "double" );
+  }
+  else if( strcmp( precision, "float" ) == 0 )
+    simulate<float, float>( n, conv, fout, fsum, kernel, precision );
+  else if( strcmp( precision, "mixed" ) == 0 )
+    simulate<float, double>( n, conv, fout, fsum, kernel, precision );
+  else
+    simulate<double, double>( n, conv, fout, fsum, kernel, "double" );
 
   if( fsum )
-    fclose( fsum );    
-  free( tnodes );
+    fclose( fsum );
   if( fsave )
     fclose( fsave );
 
+  if (0 == rank)
+    print_memory( );
+
   MPI_Finalize();
 
   return 0;
@@ -2,8 +2,527 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include "common.h"
 
+//
+//  Run nsteps steps from the initial field without saving, as the
+//  reference for the blocked and the reduced precision runs
+//
+template <typename real, typename acc>
+static double run_reference( grid_t<real> &grid, int n, int nsteps )
+{
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+    double reference_time = read_timer( );
+    for( int step = 0; step < nsteps; step++ )
+    {
+        step_rows<acc>( grid, 0, n );
+        swap_grid( grid );
+        fill_ghosts( grid, 0, n );
+    }
+    return read_timer( ) - reference_time;
+}
+
+//
+//  Simulate with temperatures stored as real and summed as acc, until
+//  conv says the field has stopped changing
+//
+template <typename real, typename acc>
+static void simulate( int n, int depth, converge_t conv, bool saving, FILE *fsave, FILE *fsum,
+                      const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    //
+    //  save if necessary
+    //
+    if( saving )
+        save( fsave, 0, n, grid.T );
+    
+    //
+    //  simulate a number of time steps
+    //
+    double simulation_time = read_timer( );
+    double save_time = 0;
+    int steps = NSTEPS;
+	
+    for( int step = 0; step < NSTEPS; )
+    {
+        if( depth > 1 )
+        {
+            //
+            //  advance several steps per sweep, stopping at saved and
+            //  checked steps
+            //
+            int nsteps = sweep_len( step, depth, NSTEPS, saving ? SAVEFREQ : 0 );
+            if( conv.tol > 0 )
+                nsteps = min( nsteps, sweep_len( step, depth, NSTEPS, conv.every ) );
+            step_blocked<acc>( grid, nsteps );
+            step += nsteps - 1;
+        }
+        else
+        {
+            //
+            //  sum temperatures for approximation
+            //
+            step_rows<acc>( grid, 0, n );
+ 
+            //
+            //  move particles
+            //
+            swap_grid( grid );
+            fill_ghosts( grid, 0, n );
+        }
+
+        //
+        //  save if necessary, timing the output apart
+        //
+        if( saving && (step%SAVEFREQ) == 0 )
+        {
+            double t = read_timer( );
+            save( fsave, step, n, grid.T );
+            save_time += read_timer( ) - t;
+        }
+
+        //
+        //  stop once the field has stopped changing
+        //
+        if( check_step( conv, grid, step ) )
+        {
+            steps = step + 1;
+            break;
+        }
+        step++;
+    }
+    simulation_time = read_timer( ) - simulation_time;
+    
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+
+    if( depth > 1 )
+    {
+        //
+        //  rerun step by step, without saving, to report the speedup
+        //  over the blocked steps alone and check the fields
+        //
+        grid_t<real> ref;
+        double reference_time = run_reference<real, acc>( ref, n, steps );
+        printf( "steps per sweep = %d, step by step = %g seconds, speedup = %g, max difference = %g\n",
+                depth, reference_time, reference_time / (simulation_time - save_time), max_diff( grid, ref, 0, n ) );
+        free_grid( ref );
+    }
+
+    //
+    // Printing summary data, with the largest deviation from a double
+    // precision run when the temperatures are stored as float
+    //
+    if( fsum )
+    {
+        double deviation = 0;
+        if( sizeof(real) != sizeof(double) )
+        {
+            grid_t<double> ref;
+            run_reference<double, double>( ref, n, steps );
+            deviation = max_diff( grid, ref, 0, n );
+            free_grid( ref );
+        }
+        fprintf( fsum, "%d %g %s %g\n", n, simulation_time, precision, deviation );
+    }
+
+    free_grid( grid );
+}
+
+//
+//  The largest difference between the field of m and that of grid
+//
+template <typename real, typename ref_real>
+static double morton_diff( const morton_t<real> &m, const grid_t<ref_real> &grid, int n )
+{
+    double largest = 0;
+    for( int i = 0; i < n; i++ )
+        for( int j = 0; j < n; j++ )
+            largest = fmax( largest, fabs( (double) m.T[morton_offset( m, i, j )] - grid.T[node_index( grid, i, j )] ) );
+    return largest;
+}
+
+//
+//  simulate( ) with the field in tiles along a Z curve
+//
+template <typename real, typename acc>
+static void simulate_morton( int n, converge_t conv, bool saving, FILE *fsave, FILE *fsum,
+                             const char *kernel, const char *precision )
+{
+    morton_t<real> m;
+    {
+        grid_t<real> grid;
+        alloc_grid( grid, n );
+        init_bar( grid, (double) 1.0, 400, 200 );
+        init_morton( m, grid );
+        free_grid( grid );
+    }
+
+    if( saving )
+        save( fsave, 0, n, m, m.T );
+
+    double simulation_time = read_timer( );
+    int steps = NSTEPS;
+    for( int step = 0; step < NSTEPS; step++ )
+    {
+        step_morton<acc>( m, 0, m.ntiles );
+        swap_morton( m );
+        fill_morton_ghosts( m );
+
+        if( saving && (step%SAVEFREQ) == 0 )
+            save( fsave, step, n, m, m.T );
+
+        if( check_step( conv, m, step ) )
+        {
+            steps = step + 1;
+            break;
+        }
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "layout = morton, %d tiles of %d x %d nodes\n", m.ntiles, MORTON_TILE, MORTON_TILE );
+    if( conv.tol > 0 )
+        printf( "%s at step %d, largest change = %g, L2 change = %g\n", converged( conv ) ? "converged" : "not converged",
+                conv.step, conv.max_change, conv.l2_change );
+
+    if( fsum )
+    {
+        double deviation = 0;
+        if( sizeof(real) != sizeof(double) )
+        {
+            grid_t<double> ref;
+            run_reference<double, double>( ref, n, steps );
+            deviation = morton_diff( m, ref, n );
+            free_grid( ref );
+        }
+        fprintf( fsum, "%d %g %s %g\n", n, simulation_time, precision, deviation );
+    }
+
+    free_morton( m );
+}
+
+//
+//  Solve for the steady state alone by red-black SOR, in at most NSTEPS
+//  sweeps or the sor.limit the bar needs
+//
+template <typename real, typename acc>
+static void solve_steady( int n, double omega, double tol, FILE *fsave, FILE *fsum,
+                          const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    sor_t sor;
+    init_sor( sor, grid, omega, tol );
+
+    double simulation_time = read_timer( );
+    while( !converged( sor ) && sor.sweeps < max( NSTEPS, sor.limit ) )
+        end_sweep( sor, relax_sweep<acc>( grid, sor ) );
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "sweeps = %d, omega = %g, last change = %g, %s\n", sor.sweeps, sor.omega, sor.change,
+            converged( sor ) ? "converged" : "not converged" );
+
+    if( fsave )
+        save( fsave, sor.sweeps, n, grid.T );
+    if( fsum )
+        fprintf( fsum, "%d %g %s %d\n", n, simulation_time, precision, sor.sweeps );
+
+    free_sor( sor );
+    free_grid( grid );
+}
+
+//
+//  Solve for the steady state alone by multigrid cycles of the given
+//  kind, in at most NSTEPS cycles
+//
+template <typename real>
+static void solve_multigrid( int n, mg_cycle_t kind, double tol, FILE *fsave, FILE *fsum,
+                             const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    multigrid_t mg;
+    init_multigrid( mg, grid, 0 );
+    tol = tol > 0 ? tol : 1e-6;
+
+    double simulation_time = read_timer( );
+    do
+        mg_solve_cycle( mg, kind );
+    while( mg.residual >= tol && mg.cycles < NSTEPS );
+    simulation_time = read_timer( ) - simulation_time;
+    finish_multigrid( mg, grid );
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "%c-cycles = %d, levels = %d, residual = %g, %s\n", kind == MG_F ? 'F' : 'V', mg.cycles, mg.nlevels,
+            mg.residual, mg.residual < tol ? "converged" : "not converged" );
+
+    if( fsave )
+        save( fsave, mg.cycles, n, grid.T );
+    if( fsum )
+        fprintf( fsum, "%d %g %s %d\n", n, simulation_time, precision, mg.cycles );
+
+    free_multigrid( mg );
+    free_grid( grid );
+}
+
+//
+//  Solve for the steady state, or the field after time seconds, in one
+//  go by sine transforms
+//
+template <typename real>
+static void solve_spectral( int n, double time, FILE *fsave, FILE *fsum,
+                            const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    spectral_t spec;
+    init_spectral( spec, grid );
+
+    double simulation_time = read_timer( );
+    spectral_solve( spec, grid, diffusivity( ) / (grid.h * grid.h), time );
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    if( isinf( time ) )
+        printf( "spectral steady state, %d x %d modes\n", spec.m, spec.m );
+    else
+        printf( "spectral field at t = %g s, %d x %d modes\n", time, spec.m, spec.m );
+
+    if( fsave )
+        save( fsave, 1, n, grid.T );
+    if( fsum )
+        fprintf( fsum, "%d %g %s %g\n", n, simulation_time, precision, time );
+
+    free_spectral( spec );
+    free_grid( grid );
+}
+
+//
+//  Advance to the physical time end_time, in fixed steps of step_len
+//  seconds (the largest stable step if 0) or, with a tolerance tol in
+//  kelvin, in steps adapted to change no node by much more than tol,
+//  starting from step_len (the default step if 0). Frames are saved
+//  every SAVEFREQ steps and at end_time, labelled by their time in
+//  seconds.
+//
+template <typename real, typename acc>
+static void simulate_physical( int n, double end_time, double step_len, double tol, bool saving, FILE *fsave, FILE *fsum,
+                               const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    timestep_t ts;
+    if( tol > 0 && step_len <= 0 )
+        step_len = default_step( );
+    init_timestep( ts, grid, diffusivity( ), step_len, tol, end_time );
+
+    if( saving )
+        save_at( fsave, 0.0, n, grid.T );
+
+    double simulation_time = read_timer( );
+    while( !reached( ts ) )
+    {
+        begin_step( ts, grid );
+        step_rows<acc>( grid, 0, n );
+        swap_grid( grid );
+        fill_ghosts( grid, 0, n );
+
+        double change = 0, sq = 0;
+        if( tol > 0 )
+            change_rows( grid, 0, n, change, sq );
+        end_step( ts, change );
+
+        if( saving && (ts.steps%SAVEFREQ) == 0 )
+            save_at( fsave, ts.time, n, grid.T );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    //
+    //  always save the field at end_time
+    //
+    if( saving && (ts.steps%SAVEFREQ) != 0 )
+        save_at( fsave, ts.time, n, grid.T );
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "physical time = %g s in %d steps of %g to %g s (stable up to %g s), or %d steps of %g s\n",
+            ts.time, ts.steps, ts.shortest, ts.longest, ts.dt_max, (int) ceil( end_time / default_step( ) ), default_step( ) );
+
+    if( fsum )
+        fprintf( fsum, "%d %g %s %g %d\n", n, simulation_time, precision, ts.time, ts.steps );
+
+    free_grid( grid );
+}
+
+//
+//  Advance NSTEPS implicit steps of step seconds with the theta scheme
+//
+template <typename real>
+static void simulate_implicit( int n, double theta, double step_len, double tol, bool saving, FILE *fsave, FILE *fsum,
+                               const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    implicit_t imp;
+    init_implicit( imp, grid, diffusion_number( step_len, grid.h ), theta, tol );
+    local_comm comm;
+
+    if( saving )
+        save( fsave, 0, n, grid.T );
+
+    double simulation_time = read_timer( );
+    int iterations = 0;
+    for( int step = 0; step < NSTEPS; step++ )
+    {
+        implicit_step( grid, imp, 0, n, comm );
+        iterations += imp.iterations;
+
+        if( saving && (step%SAVEFREQ) == 0 )
+            save( fsave, step, n, grid.T );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "%s, diffusion number = %g (explicit steps take 0.25), CG iterations per step = %g\n",
+            theta == 1 ? "backward Euler" : "Crank-Nicolson", imp.r, (double) iterations / NSTEPS );
+
+    if( fsum )
+        fprintf( fsum, "%d %g %s %g %d\n", n, simulation_time, precision, imp.r, iterations );
+
+    free_implicit( imp );
+    free_grid( grid );
+}
+
+//
+//  simulate_implicit( ) with each step solved by multigrid cycles of the
+//  given kind until no node would change by tol in a Jacobi step, and,
+//  when checking, against the same steps solved by CG
+//
+template <typename real>
+static void simulate_implicit_mg( int n, double theta, double step_len, mg_cycle_t kind, double tol, bool checking,
+                                  bool saving, FILE *fsave, FILE *fsum, const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    double r = diffusion_number( step_len, grid.h );
+    multigrid_t mg;
+    init_multigrid( mg, grid, 1 / (theta * r) );
+    tol = tol > 0 ? tol : 1e-8;
+
+    if( saving )
+        save( fsave, 0, n, grid.T );
+
+    double simulation_time = read_timer( );
+    int unconverged = 0;
+    double worst = 0;
+    for( int step = 0; step < NSTEPS; step++ )
+    {
+        mg_load( mg, grid, theta );
+        int first = mg.cycles;
+        do
+            mg_solve_cycle( mg, kind );
+        while( mg.residual >= tol && mg.cycles - first < MG_MAX_CYCLES );
+        if( mg.residual >= tol )
+        {
+            unconverged++;
+            worst = fmax( worst, mg.residual );
+        }
+        finish_multigrid( mg, grid );
+
+        if( saving && (step%SAVEFREQ) == 0 )
+            save( fsave, step, n, grid.T );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "%s, diffusion number = %g (explicit steps take 0.25), %c-cycles per step = %g\n",
+            theta == 1 ? "backward Euler" : "Crank-Nicolson", r, kind == MG_F ? 'F' : 'V', (double) mg.cycles / NSTEPS );
+    if( unconverged )
+        printf( "%d steps not converged in %d cycles, largest residual left = %g\n", unconverged, MG_MAX_CYCLES, worst );
+
+    if( checking )
+    {
+        //
+        //  rerun the steps by CG to check the fields
+        //
+        grid_t<real> ref;
+        alloc_grid( ref, n );
+        init_bar( ref, (double) 1.0, 400, 200 );
+        implicit_t imp;
+        init_implicit( imp, ref, r, theta, 1e-12 );
+        local_comm comm;
+        for( int step = 0; step < NSTEPS; step++ )
+            implicit_step( ref, imp, 0, n, comm );
+        printf( "max difference from CG = %g\n", max_diff( grid, ref, 0, n ) );
+        free_implicit( imp );
+        free_grid( ref );
+    }
+
+    if( fsum )
+        fprintf( fsum, "%d %g %s %g %d\n", n, simulation_time, precision, r, mg.cycles );
+
+    free_multigrid( mg );
+    free_grid( grid );
+}
+
+//
+//  Advance NSTEPS ADI steps of step seconds
+//
+template <typename real>
+static void simulate_adi( int n, double step_len, bool saving, FILE *fsave, FILE *fsum,
+                          const char *kernel, const char *precision )
+{
+    grid_t<real> grid;
+    alloc_grid( grid, n );
+    init_bar( grid, (double) 1.0, 400, 200 );
+
+    adi_t adi;
+    init_adi( adi, grid, diffusion_number( step_len, grid.h ) );
+
+    if( saving )
+        save( fsave, 0, n, grid.T );
+
+    double simulation_time = read_timer( );
+    for( int step = 0; step < NSTEPS; step++ )
+    {
+        adi_step( grid, adi );
+
+        if( saving && (step%SAVEFREQ) == 0 )
+            save( fsave, step, n, grid.T );
+    }
+    simulation_time = read_timer( ) - simulation_time;
+
+    printf( "n = %d, kernel = %s, precision = %s, simulation time = %g seconds\n", n, kernel, precision, simulation_time);
+    printf( "ADI, diffusion number = %g (explicit steps take 0.25)\n", adi.r );
+
+    if( fsum )
+        fprintf( fsum, "%d %g %s %g\n", n, simulation_time, precision, adi.r );
+
+    free_adi( adi );
+    free_grid( grid );
+}
+
 //
 //  benchmarking program
 //
@@ -17,6 +536,33 @@ int main( int argc, char **argv )
         printf( "-n <int> to set the number of particles\n" );
         printf( "-o <filename> to specify the output file name\n" );
         printf( "-s <filename> to specify a summary file name\n" );
+        printf( "-k <name> to force the scalar, avx2 or avx512 kernel\n" );
+        printf( "-b <int> to advance up to <int> steps per sweep (temporal blocking)\n" );
+        printf( "-prec <name> to store temperatures as double, float or mixed (float summed as double, not\n" );
+        printf( "              with -implicit, -adi, -mg or -spectral)\n" );
+        printf( "-sor to solve for the steady state by red-black SOR instead of time stepping\n" );
+        printf( "-omega <float> to set the over-relaxation factor with -sor (estimated by default)\n" );
+        printf( "-mg <V|F> to solve for the steady state by multigrid V- or F-cycles instead of time stepping\n" );
+        printf( "          (with -implicit, to solve each implicit step by them instead of CG)\n" );
+        printf( "-spectral [<float>] to jump straight to the steady state, or to the field after <float>\n" );
+        printf( "                    seconds, by sine transforms instead of time stepping\n" );
+        printf( "-tol <float> to stop time stepping once no node changes by this much in a step, -sor once\n" );
+        printf( "             no node changes by this much in a sweep, or -mg once no node\n" );
+        printf( "             would change by this much in a Jacobi step, or an -implicit step once CG has\n" );
+        printf( "             reduced the residual by this factor\n" );
+        printf( "-implicit <be|cn> to take backward Euler or Crank-Nicolson steps solved by preconditioned CG,\n" );
+        printf( "                  or by multigrid cycles with -mg\n" );
+        printf( "-adi to take alternating-direction implicit steps solved line by line\n" );
+        printf( "-dt <float> to set the length of an -implicit, -adi or -time step, or the first -adapt one, in\n" );
+        printf( "            seconds; -time steps default to the largest stable one and -adapt starts from the\n" );
+        printf( "            default one, while the 5000 -implicit or -adi steps default to spanning -time, or without\n" );
+        printf( "            it to the largest stable explicit step\n" );
+        printf( "-every <int> to check time stepping for -tol every <int> steps (10 by default)\n" );
+        printf( "-l2 to compare the L2 norm of the change of a step with -tol instead of its largest value\n" );
+        printf( "-time <float> to advance physically scaled steps to this many seconds of simulated time\n" );
+        printf( "-adapt <float> to adapt -time steps to change no node by more than about this many kelvin\n" );
+        printf( "-layout <name> to store the field row by row (row) or in tiles along a Z curve (morton,\n" );
+        printf( "               not with -b)\n" );
         printf( "-no turns off all correctness checks and particle output\n");
         return 0;
     }
@@ -25,88 +571,148 @@ int main( int argc, char **argv )
 
     char *savename = read_string( argc, argv, "-o", NULL );
     char *sumname = read_string( argc, argv, "-s", NULL );
+    const char *kernel = init_kernels( read_string( argc, argv, "-k", NULL ) );
+    int depth = max( read_int( argc, argv, "-b", 1 ), 1 );
+    const char *precision = read_string( argc, argv, "-prec", (char *) "double" );
+    const char *layout = read_string( argc, argv, "-layout", (char *) "row" );
+    bool morton = strcmp( layout, "morton" ) == 0;
+
+    if( !morton && strcmp( layout, "row" ) != 0 )
+    {
+        fprintf( stderr, "unknown -layout %s; use row or morton\n", layout );
+        return 1;
+    }
+
+    if( strcmp( precision, "double" ) && strcmp( precision, "float" ) && strcmp( precision, "mixed" ) )
+    {
+        fprintf( stderr, "unknown -prec %s; use double, float or mixed\n", precision );
+        return 1;
+    }
+
+    //
+    //  the Morton steps are not blocked in time
+    //
+    if( morton && depth > 1 )
+    {
+        fprintf( stderr, "-b is not available with -layout morton\n" );
+        return 1;
+    }
+
+    //
+    //  the implicit, ADI, multigrid and spectral solvers store and sum
+    //  the field in one type
+    //
+    if( strcmp( precision, "mixed" ) == 0 &&
+        ( find_option( argc, argv, "-implicit" ) >= 0 || find_option( argc, argv, "-adi" ) >= 0 ||
+          find_option( argc, argv, "-mg" ) >= 0 || find_option( argc, argv, "-spectral" ) >= 0 ) )
+    {
+        fprintf( stderr, "-prec mixed is not available with -implicit, -adi, -mg or -spectral; use double or float\n" );
+        return 1;
+    }
     
     FILE *fsave = savename ? fopen( savename, "w" ) : NULL;
     FILE *fsum = sumname ? fopen ( sumname, "a" ) : NULL;
+    bool saving = fsave && find_option( argc, argv, "-no" ) == -1;
+
+    converge_t conv;
+    init_converge( conv, read_double( argc, argv, "-tol", 0 ), read_int( argc, argv, "-every", 10 ),
+                   find_option( argc, argv, "-l2" ) >= 0 );
 
-    node_t *tnodes = (node_t *) malloc( n * n * sizeof(node_t) );
     set_len( n );
-    init_bar( tnodes, (double) 1.0, 400, 200 );
 
-    if( find_option( argc, argv, "-no" ) == -1 )
-        {
-          //
-          //  save if necessary
-          //
-          if( fsave )
-              save( fsave, 0, n, tnodes );
-        }
-    
-    //
-    //  simulate a number of time steps
-    //
-    double simulation_time = read_timer( );
-	
-    for( int step = 0; step < NSTEPS; step++ )
+    if( find_option( argc, argv, "-implicit" ) >= 0 )
     {
-        //
-        //  sum temperatures for approximation
-        //
-        for( int i = 0; i < n; i++ )
-        {
-          for (int j = 0; j < n; j++)
-          {
-            if ((i-1) >= 0)
-	          apply_tsum( tnodes[i*n + j], tnodes[(i-1)*n + j]);
-            if ((i+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[(i+1)*n + j]);
-            if ((j-1) >= 0)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j - 1]);
-            if ((j+1) < n)
-              apply_tsum( tnodes[i*n + j], tnodes[i*n + j + 1]);
-          }
-        }
- 
-        //
-        //  move particles
-        //
-        for( int i = 0; i < n; i++ ) 
+        double theta = strcmp( read_string( argc, argv, "-implicit", (char *) "be" ), "cn" ) == 0 ? 0.5 : 1;
+        double step_len = read_double( argc, argv, "-dt", read_double( argc, argv, "-time", 0 ) / NSTEPS );
+        double tol = read_double( argc, argv, "-tol", 0 );
+        if( find_option( argc, argv, "-mg" ) >= 0 )
         {
-          for( int j = 0; j < n; j++ )
-          {
-            if (tnodes[i*n + j].edge)
-              tupdate( tnodes[i*n + j], 3);
+            bool checking = find_option( argc, argv, "-no" ) == -1;
+            mg_cycle_t kind = read_string( argc, argv, "-mg", (char *) "V" )[0] == 'F' ? MG_F : MG_V;
+            if( strcmp( precision, "double" ) == 0 )
+                simulate_implicit_mg<double>( n, theta, step_len, kind, tol, checking, saving, fsave, fsum, kernel, precision );
             else
-              tupdate( tnodes[i*n + j], 4);
-          } 
-              
-        }
-
-        if( find_option( argc, argv, "-no" ) == -1 )
-        {
-          //
-          //  save if necessary
-          //
-          if( fsave && (step%SAVEFREQ) == 0 )
-            save( fsave, step, n, tnodes );
+                simulate_implicit_mg<float>( n, theta, step_len, kind, tol, checking, saving, fsave, fsum, kernel, precision );
         }
+        else if( strcmp( precision, "double" ) == 0 )
+            simulate_implicit<double>( n, theta, step_len, tol, saving, fsave, fsum, kernel, precision );
+        else
+            simulate_implicit<float>( n, theta, step_len, tol, saving, fsave, fsum, kernel, precision );
     }
-    simulation_time = read_timer( ) - simulation_time;
-    
-    printf( "n = %d, simulation time = %g seconds\n", n, simulation_time);
+    else if( find_option( argc, argv, "-adi" ) >= 0 )
+    {
+        double step_len = read_double( argc, argv, "-dt", read_double( argc, argv, "-time", 0 ) / NSTEPS );
+        if( strcmp( precision, "double" ) == 0 )
+            simulate_adi<double>( n, step_len, saving, fsave, fsum, kernel, precision );
+        else
+            simulate_adi<float>( n, step_len, saving, fsave, fsum, kernel, precision );
+    }
+    else if( find_option( argc, argv, "-mg" ) >= 0 )
+    {
+        mg_cycle_t kind = read_string( argc, argv, "-mg", (char *) "V" )[0] == 'F' ? MG_F : MG_V;
+        double tol = read_double( argc, argv, "-tol", 0 );
+        FILE *fout = saving ? fsave : NULL;
+        if( strcmp( precision, "double" ) == 0 )
+            solve_multigrid<double>( n, kind, tol, fout, fsum, kernel, precision );
+        else
+            solve_multigrid<float>( n, kind, tol, fout, fsum, kernel, precision );
+    }
+    else if( find_option( argc, argv, "-spectral" ) >= 0 )
+    {
+        double time = read_double( argc, argv, "-spectral", 0 );
+        FILE *fout = saving ? fsave : NULL;
+        if( strcmp( precision, "double" ) == 0 )
+            solve_spectral<double>( n, time > 0 ? time : INFINITY, fout, fsum, kernel, precision );
+        else
+            solve_spectral<float>( n, time > 0 ? time : INFINITY, fout, fsum, kernel, precision );
+    }
+    else if( find_option( argc, argv, "-sor" ) >= 0 )
+    {
+        double omega = read_double( argc, argv, "-omega", 0 );
+        double tol = read_double( argc, argv, "-tol", 0 );
+        FILE *fout = saving ? fsave : NULL;
+        if( strcmp( precision, "float" ) == 0 )
+            solve_steady<float, float>( n, omega, tol, fout, fsum, kernel, precision );
+        else if( strcmp( precision, "mixed" ) == 0 )
+            solve_steady<float, double>( n, omega, tol, fout, fsum, kernel, precision );
+        else
+            solve_steady<double, double>( n, omega, tol, fout, fsum, kernel, "double" );
+    }
+    else if( find_option( argc, argv, "-time" ) >= 0 )
+    {
+        double end_time = read_double( argc, argv, "-time", 0 );
+        double step_len = read_double( argc, argv, "-dt", 0 );
+        double tol = read_double( argc, argv, "-adapt", 0 );
+        if( strcmp( precision, "float" ) == 0 )
+            simulate_physical<float, float>( n, end_time, step_len, tol, saving, fsave, fsum, kernel, precision );
+        else if( strcmp( precision, "mixed" ) == 0 )
+            simulate_physical<float, double>( n, end_time, step_len, tol, saving, fsave, fsum, kernel, precision );
+        else
+            simulate_physical<double, double>( n, end_time, step_len, tol, saving, fsave, fsum, kernel, "double" );
+    }
+    else if( morton )
+    {
+        if( strcmp( precision, "float" ) == 0 )
+            simulate_morton<float, float>( n, conv, saving, fsave, fsum, kernel, precision );
+        else if( strcmp( precision, "mixed" ) == 0 )
+            simulate_morton<float, double>( n, conv, saving, fsave, fsum, kernel, precision );
+        else
+            simulate_morton<double, double>( n, conv, saving, fsave, fsum, kernel, "double" );
+    }
+    else if( strcmp( precision, "float" ) == 0 )
+        simulate<float, float>( n, depth, conv, saving, fsave, fsum, kernel, precision );
+    else if( strcmp( precision, "mixed" ) == 0 )
+        simulate<float, double>( n, depth, conv, saving, fsave, fsum, kernel, precision );
+    else
+        simulate<double, double>( n, depth, conv, saving, fsave, fsum, kernel, "double" );
+
+    print_memory( );
 
-    //
-    // Printing summary data
-    //
-    // if( fsum) 
-    //    fprintf(fsum,"%d %g\n",n,simulation_time);
- 
     //
     // Clearing space
     //
     if( fsum )
         fclose( fsum );    
-    free( tnodes );
     if( fsave )
         fclose( fsave );
     